@@ -0,0 +1,278 @@
+/*
+ * Benchmark of MPD response reading (lmpdc.c) over big listall from
+ * local fake MPD server, which sends response in randomly sized chunks,
+ * so lines, "OK" and "ACK" get split at random points.
+ * Modes:
+ *   frame  - line framing only, no Lua values (checks every record arrived),
+ *   listall - mpd:listall() into table,
+ *   iter   - for file in mpd:iter_listall() loop, one name at a time,
+ *   legacy - old way: recv chunks into Lua strings till one ends with
+ *            "OK\n", concat them and scan for "file: " lines.
+ * Reports throughput and peak memory of Lua state.
+ * Usage: ./benchmpd [frame|listall|iter|legacy] [MB] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include "lmpdc.c"
+
+static char *listing;
+static size_t listingsz, nfiles;
+static int port;
+static size_t lua_bytes, lua_peak;
+
+/* "directory: " and "file: " lines, 4 albums of 12 tracks per artist */
+static void
+make_listing(size_t mb)
+{
+	size_t max = mb * 1024 * 1024, len = 0;
+	int artist, album, track;
+
+	listing = malloc(max + 4096);
+	for (artist = 0; len < max; artist++) {
+		len += sprintf(listing + len, "directory: music/Artist %05d\n", artist);
+		for (album = 0; album < 4 && len < max; album++) {
+			len += sprintf(listing + len, "directory: music/Artist %05d/Album %d\n", artist, album);
+			for (track = 1; track <= 12 && len < max; track++) {
+				len += sprintf(listing + len, "file: music/Artist %05d/Album %d/%02d - Some Track Title.flac\n",
+					artist, album, track);
+				nfiles++;
+			}
+		}
+	}
+	listingsz = len;
+	memcpy(listing + len, "OK\n", 3);
+}
+
+/* last chunk keeps at least final "OK\n", or legacy reader would hang */
+static int
+send_chunked(int fd, const char *buf, size_t len, size_t max, unsigned int *seed)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = 1 + rand_r(seed) % max;
+		if (n + 3 > len) n = len;
+		if (send(fd, buf, n, 0) != (ssize_t)n) return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * answers listall with listing, ping with OK split in two packets
+ * and anything else with ACK sent by a few bytes
+ */
+static void *
+server(void *arg)
+{
+	int lsock = *(int *)arg, fd;
+	unsigned int seed = 1;
+	char cmd[256];
+	size_t len;
+	ssize_t n;
+
+	while ((fd = accept(lsock, NULL, NULL)) >= 0) {
+		send(fd, "OK MPD 0.23.5\n", 14, 0);
+		len = 0;
+		while ((n = recv(fd, cmd + len, sizeof(cmd) - 1 - len, 0)) > 0) {
+			char *eol;
+			len += n;
+			cmd[len] = '\0';
+			while ((eol = strchr(cmd, '\n')) != NULL) {
+				*eol = '\0';
+				if (strncmp(cmd, "listall", 7) == 0) {
+					send_chunked(fd, listing, listingsz + 3, 16384, &seed);
+				} else if (strcmp(cmd, "ping") == 0) {
+					send(fd, "O", 1, 0);
+					usleep(1000);
+					send(fd, "K\n", 2, 0);
+				} else {
+					char ack[300];
+					int acklen = snprintf(ack, sizeof(ack), "ACK [5@0] {%s} unknown command\n", cmd);
+					send_chunked(fd, ack, acklen, 8, &seed);
+				}
+				len -= eol + 1 - cmd;
+				memmove(cmd, eol + 1, len + 1);
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+static void
+start_server(void)
+{
+	static int lsock;
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	pthread_t thread;
+
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lsock, (struct sockaddr *)&sin, sizeof(sin)) || listen(lsock, 4)
+		|| getsockname(lsock, (struct sockaddr *)&sin, &sinlen)) {
+		perror("fake server");
+		exit(1);
+	}
+	port = ntohs(sin.sin_port);
+	pthread_create(&thread, NULL, server, &lsock);
+	pthread_detach(thread);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void*
+bench_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	lua_bytes += nsize - osize;
+	if (lua_bytes > lua_peak) lua_peak = lua_bytes;
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+/* the way lmpdc used to read responses, for comparison */
+static int
+legacy_listall(lua_State *L)
+{
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	char buf[BUFSIZ], *ptr, *eol, *eon;
+	const char *str;
+	size_t len;
+	ssize_t recvsz;
+	int cnt = 0, i = 0;
+
+	send(mpdc->sh, "listall\n", 8, 0);
+	while ((recvsz = recv(mpdc->sh, buf, BUFSIZ, 0)) > 0) {
+		if (cnt++ > 50) {
+			lua_concat(L, cnt - 1);
+			cnt = 2;
+		}
+		if (recvsz >= 3 && strncmp(buf + recvsz - 3, "OK\n", 3) == 0) {
+			lua_pushlstring(L, buf, recvsz - 3);
+			break;
+		}
+		lua_pushlstring(L, buf, recvsz);
+	}
+	if (cnt > 1) lua_concat(L, cnt);
+
+	str = lua_tolstring(L, -1, &len);
+	ptr = (char *)str;
+	lua_newtable(L);
+	while (len > 0 && (eon = strchr(ptr, ':'))) {
+		eol = strchr(eon, '\n');
+		if (strncmp(ptr, "file", eon - ptr) == 0) {
+			lua_pushlstring(L, eon + 2, eol - eon - 2);
+			lua_rawseti(L, -2, ++i);
+		}
+		len -= eol - ptr + 1;
+		ptr = eol + 1;
+	}
+	lua_remove(L, -2);
+	return 1;
+}
+
+static size_t
+frame_listall(mpdc_type_t mpdc)
+{
+	const char *key, *value;
+	size_t klen, vlen, n = 0;
+	mpdc_reply_t r;
+
+	mpdc_send(mpdc, "listall\n");
+	while ((r = mpdc_reply(mpdc, &key, &klen, &value, &vlen)) == mr_pair)
+		if (klen == 4 && memcmp(key, "file", 4) == 0) n++;
+	if (r != mr_ok) {
+		fprintf(stderr, "listall didn't end with OK\n");
+		exit(1);
+	}
+
+	/* OK & ACK split between packets are recognized too */
+	mpdc_send(mpdc, "ping\n");
+	if (mpdc_reply(mpdc, &key, &klen, &value, &vlen) != mr_ok) {
+		fprintf(stderr, "split OK isn't recognized\n");
+		exit(1);
+	}
+	mpdc_send(mpdc, "nosuchcommand\n");
+	if (mpdc_reply(mpdc, &key, &klen, &value, &vlen) != mr_ack) {
+		fprintf(stderr, "ACK isn't recognized\n");
+		exit(1);
+	}
+	return n;
+}
+
+int main (int argc, char* argv[]) {
+	const char *mode = argc > 1? argv[1]: "frame";
+	size_t mb = argc > 2? atoi(argv[2]): 50, n = 0;
+	int i, rounds = argc > 3? atoi(argv[3]): 3;
+	lua_State *L = lua_newstate(bench_alloc, NULL);
+	mpdc_type_t mpdc;
+	double start, best = 0, t;
+	char script[128];
+
+	make_listing(mb);
+	start_server();
+
+	luaL_openlibs(L);
+	lua_pushcfunction(L, luaopen_mpdc);
+	lua_call(L, 0, 0);
+	lua_register(L, "legacy_listall", legacy_listall);
+	snprintf(script, sizeof(script), "mpd = mpdc.open('127.0.0.1', %d)", port);
+	if (luaL_dostring(L, script)) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		return 1;
+	}
+	lua_getglobal(L, "mpd");
+	mpdc = luaL_checkudata(L, -1, "mpd_client");
+	lua_pop(L, 1);
+
+	for (i = 0; i < rounds; i++) {
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		lua_peak = lua_bytes;
+		start = now();
+		if (strcmp(mode, "frame") == 0) {
+			n = frame_listall(mpdc);
+		} else {
+			if (luaL_dostring(L, strcmp(mode, "legacy") == 0? "return #legacy_listall(mpd)":
+				strcmp(mode, "iter") == 0? "local n = 0 for file in mpd:iter_listall() do n = n + 1 end return n":
+				"return #mpd:listall()")) {
+				fprintf(stderr, "%s\n", lua_tostring(L, -1));
+				return 1;
+			}
+			n = lua_tointeger(L, -1);
+			lua_pop(L, 1);
+		}
+		t = now() - start;
+		if (best == 0 || t < best) best = t;
+	}
+
+	if (n != nfiles) {
+		fprintf(stderr, "%lu files read of %lu sent\n", (unsigned long)n, (unsigned long)nfiles);
+		return 1;
+	}
+	printf("%s: %lu files, %.1f MB in %.3f s, %.1f MB/s, lua peak %.1f MB\n", mode, (unsigned long)n,
+		listingsz / 1048576.0, best, listingsz / 1048576.0 / best, lua_peak / 1048576.0);
+
+	lua_close(L);
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Benchmark of compressed time series (luaseries.h): bytes per sample
+ * and encode/decode throughput over recorded counter traces (see
+ * seriesrec.lua), every column of trace is a separate series.
+ * Without trace, synthetic kern.cp_time and ipstat like counters
+ * sampled at 1Hz with some jitter are used.
+ * Usage: ./benchseries [trace.txt] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "luaseries.h"
+
+#define MAXCOLS 64
+
+static int64_t *times;
+static double *values[MAXCOLS];
+static size_t nsamples, maxsamples;
+static int ncols;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+grow(void)
+{
+	int i;
+	maxsamples = maxsamples? maxsamples * 2: 4096;
+	times = realloc(times, maxsamples * sizeof(int64_t));
+	for (i = 0; i < MAXCOLS; i++)
+		values[i] = realloc(values[i], maxsamples * sizeof(double));
+}
+
+/* lines of "time value value ..." */
+static int
+load_trace(const char *path)
+{
+	char line[BUFSIZ], *ptr, *next;
+	FILE *fp = fopen(path, "r");
+	int col;
+
+	if (fp == NULL) return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (nsamples == maxsamples) grow();
+		times[nsamples] = llround(strtod(line, &ptr) * 1000);
+		for (col = 0; col < MAXCOLS; col++) {
+			values[col][nsamples] = strtod(ptr, &next);
+			if (next == ptr) break;
+			ptr = next;
+		}
+		if (col == 0) continue;
+		if (ncols == 0 || col < ncols) ncols = col;
+		nsamples++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* a day of 1Hz samples: 5 cp_time states and 16 ipstat counters */
+static void
+synth_trace(void)
+{
+	double cp[5] = { 0 }, ip[16] = { 0 };
+	int64_t t = 1700000000000LL;
+	size_t i;
+	int j;
+
+	srand(1);
+	ncols = 21;
+	for (i = 0; i < 86400; i++) {
+		if (nsamples == maxsamples) grow();
+		t += 1000 + rand() % 7 - 3;
+		times[nsamples] = t;
+		/* 128 ticks per second spread over states, mostly idle */
+		cp[0] += rand() % 20; cp[1] += rand() % 2; cp[2] += rand() % 10; cp[3] += rand() % 3;
+		cp[4] = cp[0] + cp[1] + cp[2] + cp[3] > 0? cp[4] + 128 - (rand() % 35): cp[4];
+		for (j = 0; j < 5; j++)
+			values[j][nsamples] = cp[j];
+		/* packet counters, bursty, some of them never move */
+		for (j = 0; j < 16; j++) {
+			if (j % 4 == 3) continue;
+			ip[j] += (rand() % 100 < 20)? rand() % 5000: rand() % 50;
+		}
+		for (j = 0; j < 16; j++)
+			values[5 + j][nsamples] = ip[j];
+		nsamples++;
+	}
+}
+
+int main (int argc, char* argv[]) {
+	int rounds = argc > 2? atoi(argv[2]): 10;
+	luaA_series_t *series;
+	luaA_series_iter_t it;
+	double start, enc, dec, sum = 0, value;
+	size_t bytes = 0, decoded = 0, i;
+	int64_t time;
+	int col, r;
+
+	if (argc > 1 && strcmp(argv[1], "-") != 0) {
+		if (load_trace(argv[1])) {
+			perror(argv[1]);
+			return 1;
+		}
+	} else {
+		synth_trace();
+	}
+	if (nsamples == 0) {
+		fprintf(stderr, "empty trace\n");
+		return 1;
+	}
+
+	series = calloc(ncols, sizeof(luaA_series_t));
+
+	start = now();
+	for (col = 0; col < ncols; col++) {
+		luaA_series_init(&series[col], LUAA_SERIES_BLOCKSIZE);
+		for (i = 0; i < nsamples; i++)
+			luaA_series_add(&series[col], times[i], values[col][i]);
+		bytes += luaA_series_usedbytes(&series[col]);
+	}
+	enc = now() - start;
+
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		for (col = 0; col < ncols; col++) {
+			memset(&it, 0, sizeof(it));
+			while (luaA_series_next(&series[col], &it, &time, &value)) {
+				sum += value;
+				decoded++;
+			}
+		}
+	}
+	dec = now() - start;
+
+	printf("%d series, %zu samples each\n", ncols, nsamples);
+	printf("raw:     %8.2f bytes/sample\n", (double)(sizeof(int64_t) + sizeof(double)));
+	printf("packed:  %8.2f bytes/sample (%.1fx)\n", (double)bytes / (ncols * nsamples),
+		16.0 * ncols * nsamples / bytes);
+	printf("encode:  %8.1f ns/sample\n", enc * 1e9 / (ncols * nsamples));
+	printf("decode:  %8.1f Msamples/s (checksum %g)\n", decoded / dec / 1e6, sum);
+
+	for (col = 0; col < ncols; col++)
+		luaA_series_free(&series[col]);
+	free(series);
+	return 0;
+}
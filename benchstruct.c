@@ -0,0 +1,79 @@
+/*
+ * Micro-benchmark of struct decoding into Lua tables:
+ * hand-written luaA_settable chains (lua_setfield per field)
+ * versus descriptor driven decoder with interned keys (luastruct.h).
+ *
+ * Synthetic struct has 127 u_int32_t counters, the size of sctpstat.
+ * Usage: ./benchstruct [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <lualib.h>
+
+#include "luastruct.h"
+
+#define NFIELDS 127
+
+static luaA_field_t fields[NFIELDS];
+static luaA_struct_t bench_struct = { "bench", NFIELDS * sizeof(u_int32_t), fields, NFIELDS };
+static char names[NFIELDS][16];
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* what luaA_settable chains do */
+static void
+decode_settable(lua_State *L, const u_int32_t *value)
+{
+	int i;
+	lua_createtable(L, 0, NFIELDS);
+	for (i = 0; i < NFIELDS; i++) {
+		luaA_settable(L, -2, names[i], number, value[i]);
+	}
+}
+
+int main (int argc, char* argv[]) {
+	int i, iters = argc > 1? atoi(argv[1]): 100000;
+	u_int32_t value[NFIELDS];
+	lua_State *L = luaL_newstate();
+	double start, before, after;
+
+	for (i = 0; i < NFIELDS; i++) {
+		snprintf(names[i], sizeof(names[i]), "counter%d", i);
+		fields[i].name = names[i];
+		fields[i].type = ft_unsigned;
+		fields[i].offset = i * sizeof(u_int32_t);
+		fields[i].size = sizeof(u_int32_t);
+		value[i] = i * 1000;
+	}
+
+	start = now();
+	for (i = 0; i < iters; i++) {
+		decode_settable(L, value);
+		lua_pop(L, 1);
+		if (i % 1000 == 0) lua_gc(L, LUA_GCSTEP, 0);
+	}
+	before = now() - start;
+
+	start = now();
+	for (i = 0; i < iters; i++) {
+		luaA_struct_push(L, &bench_struct, value);
+		lua_pop(L, 1);
+		if (i % 1000 == 0) lua_gc(L, LUA_GCSTEP, 0);
+	}
+	after = now() - start;
+
+	printf("%d fields, %d iterations\n", NFIELDS, iters);
+	printf("settable chain:     %8.1f ns/decode\n", before * 1e9 / iters);
+	printf("descriptor decoder: %8.1f ns/decode\n", after * 1e9 / iters);
+
+	lua_close(L);
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Benchmark of full tree enumeration with sysctl.each() over recorded
+ * snapshot (see sysctlrec.lua), reports heap allocations per node, both
+ * Lua allocator ones and malloc calls made by lsysctl itself.
+ * Usage: ./benchtree snapshot.lua [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+static unsigned long c_allocs = 0, lua_allocs = 0;
+
+static void *bench_malloc(size_t sz) { c_allocs++; return malloc(sz); }
+static void *bench_calloc(size_t n, size_t sz) { c_allocs++; return calloc(n, sz); }
+static void *bench_realloc(void *ptr, size_t sz) { c_allocs++; return realloc(ptr, sz); }
+
+#define SYSCTL_FAKE 1
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#include "lsysctl.c"
+#undef malloc
+#undef calloc
+#undef realloc
+
+static void*
+bench_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (nsize > osize) lua_allocs++;
+	return realloc(ptr, nsize);
+}
+
+static const char *walk =
+	"local n = 0\n"
+	"for node in sysctl.each() do n = n + 1 end\n"
+	"return n\n";
+
+int main (int argc, char* argv[]) {
+	lua_State *L = lua_newstate(bench_alloc, NULL);
+	int i, rounds = argc > 2? atoi(argv[2]): 10;
+	unsigned long nodes = 0;
+	struct timespec start, end;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s snapshot.lua [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	luaL_openlibs(L);
+	lua_pushcfunction(L, luaopen_sysctl);
+	lua_call(L, 0, 0);
+
+	lua_getglobal(L, "sysctl");
+	lua_getfield(L, -1, "fake");
+	if (luaL_dofile(L, argv[1])) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		return 1;
+	}
+	lua_call(L, 1, 0);
+	lua_pop(L, 1);
+
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	c_allocs = lua_allocs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < rounds; i++) {
+		if (luaL_dostring(L, walk)) {
+			fprintf(stderr, "%s\n", lua_tostring(L, -1));
+			return 1;
+		}
+		nodes += lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%lu nodes in %d rounds\n", nodes / rounds, rounds);
+	printf("malloc calls per node: %.2f\n", (double)c_allocs / nodes);
+	printf("lua allocations per node: %.2f\n", (double)lua_allocs / nodes);
+	printf("time per node: %.1f ns\n",
+		((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / nodes);
+
+	lua_close(L);
+	return 0;
+}
@@ -850,6 +850,7 @@ LUAA_FUNC(amixer_chan_close)
 static const luaL_reg amixer_methods[] = {
 	{"open", luaA_amixer_open},
 	{"close", luaA_amixer_close},
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
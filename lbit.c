@@ -152,6 +152,7 @@ static const luaL_reg bit_meta[] = {
 	{"__eq", luaA_bit_eq},
 	{"__tostring", luaA_bit_tostring},
 #endif
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
@@ -8,6 +8,8 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "luahelper.h"
+
 typedef struct {
 	struct ifaddrs *ifap;
 	struct ifaddrs *ifa;
@@ -35,7 +37,7 @@ static int luaA_ifaddr_totable(lua_State *L, struct ifaddrs *ifa) {
 	return 1;
 }
 
-static int luaA_ifaddr_next(lua_State *L) {
+LUAA_FUNC(ifaddr_next) {
 	lifaddrs_t *lifa = lua_touserdata(L, 1);
 	lifa->ifa = lifa->ifa->ifa_next;
 	//while ((lifa->ifa = lifa->ifa->ifa_next) && (lifa->ifa->ifa_addr->sa_family != AF_INET));
@@ -45,7 +47,7 @@ static int luaA_ifaddr_next(lua_State *L) {
 	return luaA_ifaddr_totable(L, lifa->ifa);
 }
 
-static int luaA_ifaddr_each(lua_State *L) {
+LUAA_FUNC(ifaddr_each) {
 	lifaddrs_t *lifa = luaL_checkudata(L, 1, "ifaddrs");
 
 	lifa->ifa = lifa->ifap;
@@ -56,7 +58,7 @@ static int luaA_ifaddr_each(lua_State *L) {
 	return 3;
 }
 
-static int luaA_ifaddr_index(lua_State *L) {
+LUAA_FUNC(ifaddr_index) {
 	lifaddrs_t *lifa = luaL_checkudata(L, 1, "ifaddrs");
 
 	luaL_getmetatable(L, "ifaddrs");
@@ -79,8 +81,9 @@ static int luaA_ifaddr_index(lua_State *L) {
 	return 0;
 }
 
-static int luaA_ifaddr_init(lua_State *L) {
+LUAA_FUNC(ifaddr_init) {
 	lifaddrs_t *ifaddr = lua_newuserdata(L, sizeof(lifaddrs_t));
+	luaA_stats_syscall(0);
 	if (getifaddrs(&(ifaddr->ifap))) {
 		lua_pop(L, 1);
 		return 0;
@@ -91,13 +94,13 @@ static int luaA_ifaddr_init(lua_State *L) {
 	return 1;
 }
 
-static int luaA_ifaddr_rewind(lua_State *L) {
+LUAA_FUNC(ifaddr_rewind) {
 	lifaddrs_t *lifa = luaL_checkudata(L, 1, "ifaddrs");
 	lifa->ifa = lifa->ifap;
 	return 0;
 }
 
-static int luaA_ifaddr_gc(lua_State *L) {
+LUAA_FUNC(ifaddr_gc) {
 	lifaddrs_t *lifa = luaL_checkudata(L, 1, "ifaddrs");
 	freeifaddrs(lifa->ifap);
 	return 0;
@@ -105,6 +108,7 @@ static int luaA_ifaddr_gc(lua_State *L) {
 
 static const luaL_reg ifaddr_methods[] = {
 	{"init", luaA_ifaddr_init},
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
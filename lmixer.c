@@ -5,6 +5,8 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#include "luahelper.h"
+
 #ifdef DEBUG
 #include <err.h>
 #else
@@ -49,14 +51,17 @@ static int open_mixer_dev(int mixerno) {
         }
 
 	int mixer = open(buf, O_RDWR);
+	luaA_stats_syscall(0);
 	return mixer;
 }
 static int read_mixer(int fh, int devno) {
 	int value;
+	luaA_stats_syscall(sizeof(value));
 	if (ioctl(fh, MIXER_READ(devno), &value) < 0) return -1;
 	return value;
 }
 static int write_mixer(int fh, int devno, int value) {
+	luaA_stats_syscall(sizeof(value));
 	if (ioctl(fh, MIXER_WRITE(devno), &value) < 0) return -1;
 	return 0;
 }
@@ -74,7 +79,7 @@ static inline int luaA_usemetatable(lua_State *L, int objidx, int methodidx) {
 	return 0;
 }
 
-static int luaA_mixer_device(lua_State *L) {
+LUAA_FUNC(mixer_device) {
 	mixer_t **mixer = luaL_checkudata(L, 1, "mixer");
         if ((*mixer)->num > 0) {
             lua_pushfstring(L, "/dev/mixer%d", (*mixer)->num);
@@ -83,13 +88,13 @@ static int luaA_mixer_device(lua_State *L) {
         }
 	return 1;
 }
-static int luaA_device_device(lua_State *L) {
+LUAA_FUNC(device_device) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	lua_pushstring(L, names[channel->devno]);
 	return 1;
 }
 
-static int luaA_mixer_get(lua_State *L) {
+LUAA_FUNC(mixer_get) {
 	mixer_t **mixer = luaL_checkudata(L, 1, "mixer");
 
 	const char* devname = luaL_checkstring(L, 2);
@@ -115,7 +120,7 @@ static int luaA_mixer_get(lua_State *L) {
 }
 
 
-static int luaA_mixer_set(lua_State *L) {
+LUAA_FUNC(mixer_set) {
 	mixer_t **mixer = luaL_checkudata(L, 1, "mixer");
 	const char* devname = luaL_checkstring(L, 2);
 	int type = lua_type(L, 3);
@@ -147,7 +152,7 @@ static int luaA_mixer_set(lua_State *L) {
 	if ((*mixer)->fh >= 0 && devno >= 0) write_mixer((*mixer)->fh, devno, value);
 }
 
-static int luaA_mixer_name(lua_State *L) {
+LUAA_FUNC(mixer_name) {
 	mixer_t **mixer = luaL_checkudata(L, 1, "mixer");
         if ((*mixer)->num > 0) {
             lua_pushfstring(L, "udata mixer /dev/mixer%d [fh:%d]", (*mixer)->num, (*mixer)->fh);
@@ -157,7 +162,7 @@ static int luaA_mixer_name(lua_State *L) {
 	return 1;
 }
 
-static int luaA_mixer_open(lua_State *L) {
+LUAA_FUNC(mixer_open) {
 	int mixernum = luaL_checknumber(L, 1);
 	int mixerdev = open_mixer_dev(mixernum);
 
@@ -180,7 +185,7 @@ static int luaA_mixer_open(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_table(lua_State *L) {
+LUAA_FUNC(device_table) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	int value = read_mixer(channel->mixer->fh, channel->devno);
 	if (value < 0) return 0;
@@ -194,7 +199,7 @@ static int luaA_device_table(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_string(lua_State *L) {
+LUAA_FUNC(device_string) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	int value = read_mixer(channel->mixer->fh, channel->devno);
 	if (value < 0) return 0;
@@ -204,7 +209,7 @@ static int luaA_device_string(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_mixer(lua_State *L) {
+LUAA_FUNC(device_mixer) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 
 	mixer_t **mixer = lua_newuserdata(L, sizeof(mixer_t *));
@@ -217,7 +222,7 @@ static int luaA_device_mixer(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_get(lua_State *L) {
+LUAA_FUNC(device_get) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 
 	if (luaA_usemetatable(L, 1, 2)) return 1;
@@ -243,7 +248,7 @@ static int luaA_device_get(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_set(lua_State *L) {
+LUAA_FUNC(device_set) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 
 	if (lua_isstring(L, 2)) {
@@ -278,7 +283,7 @@ static int luaA_device_set(lua_State *L) {
 	return 0;
 }
 
-static int luaA_device_both(lua_State *L) {
+LUAA_FUNC(device_both) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	int newvalue = luaL_checknumber(L, 2);
 	if (newvalue < 0) newvalue = 0;
@@ -288,7 +293,7 @@ static int luaA_device_both(lua_State *L) {
 	write_mixer(channel->mixer->fh, channel->devno, newvalue | (newvalue << 8));
 
 }
-static int luaA_device_name(lua_State *L) {
+LUAA_FUNC(device_name) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	int value = read_mixer(channel->mixer->fh, channel->devno);
 	char buf[40];
@@ -300,7 +305,7 @@ static int luaA_device_name(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_equal(lua_State *L) {
+LUAA_FUNC(device_equal) {
 	mixer_device_t *chan1 = luaL_checkudata(L, 1, "mixer_device");
 	mixer_device_t *chan2 = luaL_checkudata(L, 2, "mixer_device");
 	int value1 = read_mixer(chan1->mixer->fh, chan1->devno);
@@ -309,7 +314,7 @@ static int luaA_device_equal(lua_State *L) {
 	return 1;
 }
 
-static int luaA_device_less(lua_State *L) {
+LUAA_FUNC(device_less) {
 	mixer_device_t *chan1 = luaL_checkudata(L, 1, "mixer_device");
 	mixer_device_t *chan2 = luaL_checkudata(L, 2, "mixer_device");
 	
@@ -336,14 +341,14 @@ static int luaA_device_less(lua_State *L) {
 	return 1;
 }
 
-static int luaA_mixer_equal(lua_State *L) {
+LUAA_FUNC(mixer_equal) {
 	mixer_t **mixer1 = luaL_checkudata(L, 1, "mixer");
 	mixer_t **mixer2 = luaL_checkudata(L, 2, "mixer");
 	lua_pushboolean(L, (*mixer1)->num == (*mixer2)->num);
 	return 1;
 }
 
-static int luaA_mixer_close(lua_State *L) {
+LUAA_FUNC(mixer_close) {
 	mixer_t **mixer = luaL_checkudata(L, 1, "mixer");
 	(*mixer)->refcnt--;
 	warn("Mixer %p refcount decreased to %d", *mixer, (*mixer)->refcnt);
@@ -355,7 +360,7 @@ static int luaA_mixer_close(lua_State *L) {
 	return 0;
 }
 
-static int luaA_device_gc(lua_State *L) {
+LUAA_FUNC(device_gc) {
 	mixer_device_t *channel = luaL_checkudata(L, 1, "mixer_device");
 	channel->mixer->refcnt--;
 	warn("Mixer %p refcount decreased to %d", channel->mixer, channel->mixer->refcnt);
@@ -364,6 +369,7 @@ static int luaA_device_gc(lua_State *L) {
 static const luaL_reg mixer_methods[] = {
 	{"open", luaA_mixer_open},
 	{"close", luaA_mixer_close},
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
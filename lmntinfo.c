@@ -2,61 +2,54 @@
 #include <sys/ucred.h>
 #include <sys/mount.h>
 
-#include <lua.h>
-#include <lauxlib.h>
+#include "luastruct.h"
+#include "luahistfile.h"
 
-#define luaA_settable(L, tableidx, index, luatype, value) \
-	lua_push##luatype (L, value); \
-	lua_setfield(L, tableidx, index)
-
-#define luaA_isettable(L, tableidx, index, luatype, value) \
-	lua_push##luatype (L, value); \
-	lua_rawseti(L, tableidx, index)
-
-static int luaA_mntinfo_statfs(lua_State *L, struct statfs *stfs) {
-	lua_createtable(L, 0, 20);
-
-	luaA_settable(L, -2, "version", number, stfs->f_version);
-	luaA_settable(L, -2, "type", number, stfs->f_type);
-	luaA_settable(L, -2, "flags", number, stfs->f_flags);
-	luaA_settable(L, -2, "bsize", number, stfs->f_bsize);
-	luaA_settable(L, -2, "iosize", number, stfs->f_iosize);
-	luaA_settable(L, -2, "blocks", number, stfs->f_blocks);
-	luaA_settable(L, -2, "bfree", number, stfs->f_bfree);
-	luaA_settable(L, -2, "bavail", number, stfs->f_bavail);
-	luaA_settable(L, -2, "files", number, stfs->f_files);
-	luaA_settable(L, -2, "ffree", number, stfs->f_ffree);
-	luaA_settable(L, -2, "syncwrites", number, stfs->f_syncwrites);
-	luaA_settable(L, -2, "asyncwrites", number, stfs->f_asyncwrites);
-	luaA_settable(L, -2, "syncreads", number, stfs->f_syncreads);
-	luaA_settable(L, -2, "asyncreads", number, stfs->f_asyncreads);
-	//luaA_settable(L, -2, "spare", number, stfs->f_spare);
-	luaA_settable(L, -2, "namemax", number, stfs->f_namemax);
-	luaA_settable(L, -2, "owner", number, stfs->f_owner);
+static const luaA_field_t statfs_fsid[] = {
+	LUAA_IFIELD(struct statfs, NULL, f_fsid.val[0]),
+	LUAA_IFIELD(struct statfs, NULL, f_fsid.val[1]),
+};
 
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, stfs->f_fsid.val[0]);
-	luaA_isettable(L, -2, 2, number, stfs->f_fsid.val[1]);
-	lua_setfield(L, -2, "fsid");
+static const luaA_field_t statfs_fields[] = {
+	LUAA_UFIELD(struct statfs, "version", f_version),
+	LUAA_UFIELD(struct statfs, "type", f_type),
+	LUAA_UFIELD(struct statfs, "flags", f_flags),
+	LUAA_UFIELD(struct statfs, "bsize", f_bsize),
+	LUAA_UFIELD(struct statfs, "iosize", f_iosize),
+	LUAA_UFIELD(struct statfs, "blocks", f_blocks),
+	LUAA_UFIELD(struct statfs, "bfree", f_bfree),
+	LUAA_IFIELD(struct statfs, "bavail", f_bavail),
+	LUAA_UFIELD(struct statfs, "files", f_files),
+	LUAA_IFIELD(struct statfs, "ffree", f_ffree),
+	LUAA_UFIELD(struct statfs, "syncwrites", f_syncwrites),
+	LUAA_UFIELD(struct statfs, "asyncwrites", f_asyncwrites),
+	LUAA_UFIELD(struct statfs, "syncreads", f_syncreads),
+	LUAA_UFIELD(struct statfs, "asyncreads", f_asyncreads),
+	LUAA_UFIELD(struct statfs, "namemax", f_namemax),
+	LUAA_UFIELD(struct statfs, "owner", f_owner),
+	LUAA_SUBFIELD("fsid", ft_array, statfs_fsid),
+	LUAA_SFIELD(struct statfs, "fstypename", f_fstypename),
+	LUAA_SFIELD(struct statfs, "mntfromname", f_mntfromname),
+	LUAA_SFIELD(struct statfs, "mntonname", f_mntonname),
+};
 
-	//luaA_settable(L, -2, "charspare", string, stfs->f_charspare);
-	luaA_settable(L, -2, "fstypename", string, stfs->f_fstypename);
-	luaA_settable(L, -2, "mntfromname", string, stfs->f_mntfromname);
-	luaA_settable(L, -2, "mntonname", string, stfs->f_mntonname);
+static const luaA_struct_t statfs_struct = LUAA_STRUCT("statfs", struct statfs, statfs_fields);
 
-	return 1;
+static int luaA_mntinfo_statfs(lua_State *L, struct statfs *stfs) {
+	return luaA_struct_push(L, &statfs_struct, stfs);
 }
 
-static int luaA_mntinfo_getstatfs(lua_State *L) {
+LUAA_FUNC(mntinfo_getstatfs) {
 	const char* mntpname = luaL_checkstring(L, 1);
 	struct statfs stfs;
+	luaA_stats_syscall(sizeof(stfs));
 	if (statfs(mntpname, &stfs))
 		return 0;
 
 	return luaA_mntinfo_statfs(L, &stfs);
 }
 
-static int luaA_mntinfo_next(lua_State *L) {
+LUAA_FUNC(mntinfo_next) {
 	struct statfs *stfs = (struct statfs *)lua_touserdata(L, 1);
 	int index = luaL_checknumber(L, 2) - 1;
 	if (index < 1) return 0;
@@ -65,10 +58,11 @@ static int luaA_mntinfo_next(lua_State *L) {
 	return 2;
 }
 
-static int luaA_mntinfo_each(lua_State *L) {
+LUAA_FUNC(mntinfo_each) {
 	struct statfs *stfs = NULL;
 	int items;
 	items = getmntinfo(&stfs, MNT_NOWAIT);
+	luaA_stats_syscall(items > 0? items * sizeof(struct statfs): 0);
 	if (items < 1) return 0;
 
 	lua_pushcfunction(L, luaA_mntinfo_next);
@@ -81,11 +75,14 @@ static int luaA_mntinfo_each(lua_State *L) {
 static const luaL_reg mntinfo_methods[] = {
 	{"getstat", luaA_mntinfo_getstatfs},
 	{"each", luaA_mntinfo_each},
+	{"history_file", luaA_histfile_open},
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
 LUALIB_API int luaopen_mntinfo(lua_State *L) {
 
+	luaA_histfile_register(L);
 	luaL_register(L, "mntinfo", mntinfo_methods);
 	lua_pushliteral(L, "version");
 	lua_pushliteral(L, "mntinfo library for lua");
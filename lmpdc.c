@@ -4,58 +4,391 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 
 #include "luahelper.h"
 // }}}
 
 // macro definitions {{{
-#define MAXCNT 50
+#define MPDC_RINGSIZE 65536
 
 #define DO_SIMPLE_MPD_CMD(func, cmd) \
-	static int luaA_mpdc_##func (lua_State *L) { \
+	LUAA_FUNC(mpdc_##func) { \
 		mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client"); \
-		return luaA_mpdc_command(L, mpdc->sh, cmd "\n"); }
+		return luaA_mpdc_command(L, mpdc, cmd "\n"); }
 
 
 #define DO_SET_MPD_CMD(func, cmd) \
-	static int luaA_mpdc_##func (lua_State *L) { \
+	LUAA_FUNC(mpdc_##func) { \
 		mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client"); \
 		int value = luaL_checknumber(L, 2); \
-		return luaA_mpdc_command(L, mpdc->sh, cmd " %d\n", value); }
+		return luaA_mpdc_command(L, mpdc, cmd " %d\n", value); }
 // }}}
 
 // typedef {{{
+
+/*
+ * Input ring: bytes in [start, end) of free running counters, size is
+ * power of 2. Lines are handed out in place, only the ones wrapped
+ * around end of ring are copied to line buffer.
+ */
+typedef struct {
+	char *data;
+	size_t size;
+	size_t start, end, scan;
+	char *line;
+	size_t linesz;
+} mpdc_ring_t;
+
 typedef struct {
 	struct sockaddr_in addr;
 	int sh;
+	mpdc_ring_t in;
+	/* responses not read to their OK or ACK yet */
+	int pending;
+	/* commands sent, iterators stop once it's changed */
+	unsigned int sent;
+	/* idle is sent and its response isn't read yet */
+	int idle;
+	/* subsystems reported by idle cancelled with noidle, '\n' terminated */
+	char *changed;
+	size_t changedlen, changedsz;
 } mpdc_type;
 typedef mpdc_type* mpdc_type_t;
+
+/* kinds of response lines */
+typedef enum { mr_pair, mr_ok, mr_listok, mr_ack, mr_error } mpdc_reply_t;
 // }}
 
+// input ring {{{
+static void mpdc_ring_free(mpdc_ring_t *ring) {
+	free(ring->data);
+	free(ring->line);
+	memset(ring, 0, sizeof(mpdc_ring_t));
+}
+
+static int mpdc_ring_reset(mpdc_ring_t *ring) {
+	ring->start = ring->end = ring->scan = 0;
+	if (ring->data == NULL) {
+		if ((ring->data = malloc(MPDC_RINGSIZE)) == NULL) return -1;
+		ring->size = MPDC_RINGSIZE;
+	}
+	return 0;
+}
+
+/* copy n bytes starting at absolute position pos out of ring */
+static void mpdc_ring_copy(mpdc_ring_t *ring, char *dst, size_t pos, size_t n) {
+	size_t off = pos & (ring->size - 1);
+	size_t first = n < ring->size - off? n: ring->size - off;
+
+	memcpy(dst, ring->data + off, first);
+	memcpy(dst + first, ring->data, n - first);
+}
+
+/* double ring, so that line longer than ring fits */
+static int mpdc_ring_grow(mpdc_ring_t *ring) {
+	size_t len = ring->end - ring->start;
+	char *data = malloc(ring->size * 2);
+
+	if (data == NULL) return -1;
+	mpdc_ring_copy(ring, data, ring->start, len);
+	free(ring->data);
+	ring->data = data;
+	ring->scan -= ring->start;
+	ring->start = 0;
+	ring->end = len;
+	ring->size *= 2;
+	return 0;
+}
+
+/* recv into contiguous free part of ring */
+static ssize_t mpdc_ring_fill(mpdc_ring_t *ring, int sh, int flags) {
+	size_t off, room;
+	ssize_t n;
+
+	if (ring->end - ring->start == ring->size && mpdc_ring_grow(ring))
+		return -1;
+
+	off = ring->end & (ring->size - 1);
+	room = ring->size - (ring->end - ring->start);
+	if (room > ring->size - off) room = ring->size - off;
+
+	while ((n = recv(sh, ring->data + off, room, flags)) < 0 && errno == EINTR)
+		luaA_stats_syscall(0);
+	luaA_stats_syscall(n > 0? n: 0);
+	if (n > 0) ring->end += n;
+	return n;
+}
+
+/* find next '\n' among bytes not scanned yet */
+static int mpdc_ring_findeol(mpdc_ring_t *ring, size_t *eol) {
+	size_t off, len;
+	char *ptr;
+
+	while (ring->scan < ring->end) {
+		off = ring->scan & (ring->size - 1);
+		len = ring->end - ring->scan;
+		if (len > ring->size - off) len = ring->size - off;
+		if ((ptr = memchr(ring->data + off, '\n', len)) != NULL) {
+			*eol = ring->scan + (ptr - (ring->data + off));
+			return 1;
+		}
+		ring->scan += len;
+	}
+	return 0;
+}
+
+/* whether ring holds whole response, i.e. its OK or ACK line */
+static int mpdc_ring_hasreply(mpdc_ring_t *ring) {
+	size_t pos = ring->start, scan = ring->scan, eol, len;
+	char head[4];
+	int found = 0;
+
+	while (!found && mpdc_ring_findeol(ring, &eol)) {
+		len = eol - pos;
+		mpdc_ring_copy(ring, head, pos, len < 4? len: 4);
+		found = (len == 2 && memcmp(head, "OK", 2) == 0) || (len >= 4 && memcmp(head, "ACK ", 4) == 0);
+		pos = ring->scan = eol + 1;
+	}
+	ring->scan = scan;
+	return found;
+}
+
+/*
+ * next line without '\n', it's valid till next call; reads socket
+ * as much as needed, so it doesn't matter how lines are split between
+ * packets
+ */
+static int mpdc_readline(mpdc_type_t mpdc, const char **line, size_t *len) {
+	mpdc_ring_t *ring = &mpdc->in;
+	size_t eol, off;
+	char *buf;
+
+	while (!mpdc_ring_findeol(ring, &eol)) {
+		if (mpdc_ring_fill(ring, mpdc->sh, 0) <= 0)
+			return 0;
+	}
+
+	*len = eol - ring->start;
+	off = ring->start & (ring->size - 1);
+	if (off + *len <= ring->size) {
+		*line = ring->data + off;
+	} else {
+		if (*len > ring->linesz) {
+			if ((buf = realloc(ring->line, *len)) == NULL) return 0;
+			ring->line = buf;
+			ring->linesz = *len;
+		}
+		mpdc_ring_copy(ring, ring->line, ring->start, *len);
+		*line = ring->line;
+	}
+
+	ring->start = ring->scan = eol + 1;
+	return 1;
+}
+// }}}
+
+// response framing {{{
+
+/*
+ * Read next line of response: "key: value" pair, "list_OK" of command
+ * list, "OK" or "ACK [error@command] {name} message" ending response.
+ * ACK message (after "ACK ") is returned as key.
+ */
+static mpdc_reply_t mpdc_reply(mpdc_type_t mpdc, const char **key, size_t *klen, const char **value, size_t *vlen) {
+	const char *line, *sep;
+	size_t len;
+
+	if (!mpdc_readline(mpdc, &line, &len))
+		return mr_error;
+
+	if (len == 2 && memcmp(line, "OK", 2) == 0) {
+		mpdc->pending--;
+		return mr_ok;
+	}
+	if (len == 7 && memcmp(line, "list_OK", 7) == 0)
+		return mr_listok;
+	if (len >= 4 && memcmp(line, "ACK ", 4) == 0) {
+		mpdc->pending--;
+		*key = line + 4;
+		*klen = len - 4;
+		return mr_ack;
+	}
+
+	*key = line;
+	if ((sep = memchr(line, ':', len)) == NULL) {
+		*klen = len;
+		*value = line + len;
+		*vlen = 0;
+	} else {
+		*klen = sep - line;
+		*value = sep + (sep + 1 < line + len && sep[1] == ' '? 2: 1);
+		*vlen = line + len - *value;
+	}
+	return mr_pair;
+}
+
+/* connection is out of sync or dead, it needs reconnect */
+static void mpdc_fail(mpdc_type_t mpdc) {
+	if (mpdc->sh >= 0) close(mpdc->sh);
+	mpdc->sh = -1;
+	mpdc->pending = 0;
+	mpdc->idle = 0;
+}
+
+/* skip rest of responses left unread, e.g. by abandoned iterator */
+static int mpdc_drain(mpdc_type_t mpdc) {
+	const char *key, *value;
+	size_t klen, vlen;
+
+	while (mpdc->pending > 0) {
+		if (mpdc_reply(mpdc, &key, &klen, &value, &vlen) == mr_error) {
+			mpdc_fail(mpdc);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int mpdc_sendall(mpdc_type_t mpdc, const char *buf, size_t len) {
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(mpdc->sh, buf, len, 0);
+		luaA_stats_syscall(n > 0? n: 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			mpdc_fail(mpdc);
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* remember changed subsystem once, until idle_result() hands it out */
+static int mpdc_changed_add(mpdc_type_t mpdc, const char *name, size_t len) {
+	const char *p, *end = mpdc->changed + mpdc->changedlen;
+	char *buf;
+	size_t sz;
+
+	for (p = mpdc->changed; p < end; p = memchr(p, '\n', end - p) + 1)
+		if ((size_t)(end - p) > len && p[len] == '\n' && memcmp(p, name, len) == 0)
+			return 0;
+
+	if (mpdc->changedlen + len + 1 > mpdc->changedsz) {
+		sz = mpdc->changedsz? mpdc->changedsz * 2: 128;
+		while (sz < mpdc->changedlen + len + 1) sz *= 2;
+		if ((buf = realloc(mpdc->changed, sz)) == NULL) return -1;
+		mpdc->changed = buf;
+		mpdc->changedsz = sz;
+	}
+	memcpy(mpdc->changed + mpdc->changedlen, name, len);
+	mpdc->changedlen += len;
+	mpdc->changed[mpdc->changedlen++] = '\n';
+	return 0;
+}
+
+/* cancel idle, changes it has seen are kept for idle_result() */
+static int mpdc_noidle(mpdc_type_t mpdc) {
+	const char *key, *value;
+	size_t klen, vlen;
+
+	mpdc->idle = 0;
+	if (mpdc_sendall(mpdc, "noidle\n", 7)) return -1;
+
+	/* idle is sent on drained connection, so its response is the only one */
+	while (mpdc->pending > 0) {
+		switch (mpdc_reply(mpdc, &key, &klen, &value, &vlen)) {
+		case mr_error:
+			mpdc_fail(mpdc);
+			return -1;
+		case mr_pair:
+			if (klen == 7 && memcmp(key, "changed", 7) == 0 && mpdc_changed_add(mpdc, value, vlen)) {
+				mpdc_fail(mpdc);
+				return -1;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+/*
+ * send command text (or command list) in one write, it has one response;
+ * idle is cancelled first, subsystems changed meanwhile are kept
+ */
+static int mpdc_sendcmd(mpdc_type_t mpdc, const char *buf, size_t len) {
+	if (mpdc->sh < 0) return -1;
+	if (mpdc->idle && mpdc_noidle(mpdc)) return -1;
+	if (mpdc_drain(mpdc)) return -1;
+
+	if (mpdc_sendall(mpdc, buf, len)) return -1;
+	mpdc->pending++;
+	mpdc->sent++;
+	return 0;
+}
+
+/* send one command, its response is to be read with mpdc_reply */
+static int mpdc_vsend(mpdc_type_t mpdc, const char *cmd, va_list vargs) {
+	char buf[BUFSIZ];
+	int len;
+
+	len = vsnprintf(buf, BUFSIZ, cmd, vargs);
+	if (len < 0 || len >= BUFSIZ) return -1;
+	return mpdc_sendcmd(mpdc, buf, len);
+}
+
+static int mpdc_send(mpdc_type_t mpdc, const char *cmd, ...) {
+	va_list vargs;
+	int result;
+
+	va_start(vargs, cmd);
+	result = mpdc_vsend(mpdc, cmd, vargs);
+	va_end(vargs);
+	return result;
+}
+// }}}
+
 // open & close {{{
 
-static int luaA_mpdc_connect(struct sockaddr_in *addr) {
+static int luaA_mpdc_connect(mpdc_type_t mpdc) {
+	const char *line;
+	size_t len;
 	int sh;
 
+	/* responses of old connection are gone, so are iterators over them */
+	mpdc->pending = 0;
+	mpdc->sent++;
+	mpdc->idle = 0;
+	if (mpdc_ring_reset(&mpdc->in)) return -1;
+
 	sh = socket(PF_INET, SOCK_STREAM, 6);
+	luaA_stats_syscall(0);
 	if (sh < 0) return -1;
-	if (connect(sh, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0) {
+	luaA_stats_syscall(0);
+	if (connect(sh, (struct sockaddr *)&mpdc->addr, sizeof(struct sockaddr_in)) < 0) {
 		close(sh);
 		return -1;
 	}
 
-	char buf[BUFSIZ];
-	size_t recvsz;
-	if ((recvsz = recv(sh, buf, BUFSIZ, 0)) < 0 || recvsz < 8 || strncmp("OK MPD ", buf, 7) != 0) {
+	mpdc->sh = sh;
+	if (!mpdc_readline(mpdc, &line, &len) || len < 7 || strncmp("OK MPD ", line, 7) != 0) {
 		close(sh);
+		mpdc->sh = -1;
 		return -2;
 	}
 
 	return sh;
 }
 
-static int luaA_mpdc_open(lua_State *L) {
+LUAA_FUNC(mpdc_open) {
 	const char* host = luaL_checkstring(L, 1);
 	int port = luaL_checknumber(L, 2);
 
@@ -65,11 +398,12 @@ static int luaA_mpdc_open(lua_State *L) {
 		return 0; //luaL_error(L, "unknown host %s", host);
 
 	mpdc_type_t mpdc = lua_newuserdata(L, sizeof(mpdc_type));
+	memset(mpdc, 0, sizeof(mpdc_type));
 	mpdc->addr.sin_family = AF_INET;
 	mpdc->addr.sin_port = htons(port);
 	memcpy((char *)&(mpdc->addr).sin_addr.s_addr, (char *)peer->h_addr_list[0], peer->h_length);
 	
-	mpdc->sh = luaA_mpdc_connect(&(mpdc->addr));
+	mpdc->sh = luaA_mpdc_connect(mpdc);
 	/*if (mpdc->sh < 0) {
 		lua_pop(L, 1);
 		return 0; //luaL_error(L, (mpdc->sh == -1)? "unable to connect to host %s:%d": "unable to find MPD at host %s:%d", host, port);
@@ -79,171 +413,521 @@ static int luaA_mpdc_open(lua_State *L) {
 	return 1;
 }
 
-static int luaA_mpdc_close(lua_State *L) {
+LUAA_FUNC(mpdc_close) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
-	if (mpdc->sh >= 0) close(mpdc->sh);
+	mpdc_fail(mpdc);
+	mpdc_ring_free(&mpdc->in);
+	free(mpdc->changed);
+	mpdc->changed = NULL;
+	mpdc->changedlen = mpdc->changedsz = 0;
 	return 0;
 }
 
-static int luaA_mpdc_reconnect(lua_State *L) {
+LUAA_FUNC(mpdc_reconnect) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
-	if (mpdc->sh >= 0) close(mpdc->sh);
+	mpdc_fail(mpdc);
 
-	mpdc->sh = luaA_mpdc_connect(&(mpdc->addr));
+	mpdc->sh = luaA_mpdc_connect(mpdc);
 	lua_pushboolean(L, mpdc->sh >= 0);
 	return 1;
 }
 // }}}
 
 // conversion functions {{{
-static int luaA_mpdc_command(lua_State *L, int mpdc, const char *cmd, ...) {
-	char buf[BUFSIZ];
-	int cnt = 0;
-	ssize_t recvsz;
-	va_list vargs;
-	va_start(vargs, cmd);
-	recvsz = vsnprintf(buf, BUFSIZ, cmd, vargs);
-	va_end(vargs);
 
-	if (send(mpdc, buf, recvsz, 0) < 0) return 0;
-	while ((recvsz = recv(mpdc, buf, BUFSIZ, 0)) > 0) {
-		if (cnt++ > MAXCNT) {
-			lua_concat(L, cnt - 1);
-			cnt = 2;
-		}
+/* raise ACK message as lua error, like "[50@0] {play} No such song" */
+static int luaA_mpdc_ack(lua_State *L, const char *msg, size_t len) {
+	lua_pushlstring(L, msg, len);
+	return lua_error(L);
+}
 
-		if (strncmp(buf + recvsz - 3, "OK\n", 3) == 0) {
-			lua_pushlstring(L, buf, recvsz - 3);
+/* response as text without final OK, e.g. "Id: 12\n" */
+static int luaA_mpdc_reply_text(lua_State *L, mpdc_type_t mpdc) {
+	const char *key, *value;
+	size_t klen, vlen;
+	luaL_Buffer b;
+
+	luaL_buffinit(L, &b);
+	for (;;) {
+		switch (mpdc_reply(mpdc, &key, &klen, &value, &vlen)) {
+		case mr_pair:
+			luaL_addlstring(&b, key, klen);
+			luaL_addlstring(&b, ": ", 2);
+			luaL_addlstring(&b, value, vlen);
+			luaL_addchar(&b, '\n');
+			break;
+		case mr_listok:
 			break;
-		} else if (cnt == 1 && strncmp(buf, "ACK [", 5) == 0) {
-			lua_pushlstring(L, buf + 4, recvsz - 5);
-			return lua_error(L);
-		} else {
-			lua_pushlstring(L, buf, recvsz);
+		case mr_ok:
+			luaL_pushresult(&b);
+			return 1;
+		case mr_ack:
+			luaL_pushresult(&b);
+			return luaA_mpdc_ack(L, key, klen);
+		case mr_error:
+			luaL_pushresult(&b);
+			mpdc_fail(mpdc);
+			return 0;
 		}
-
-	}
-
-	if (cnt > 1) {
-		lua_concat(L, cnt);
-		cnt = 1;
 	}
-
-	return cnt;
 }
 
-static int luaA_mpdc_string_to_table(lua_State *L) {
-	size_t len;
-	const char* buf = lua_tolstring(L, -1, &len);
-	char *ptr = (char *)buf, *eol, *eon;
+/* send command, return its response as text */
+static int luaA_mpdc_command(lua_State *L, mpdc_type_t mpdc, const char *cmd, ...) {
+	va_list vargs;
+	int result;
 
-	lua_newtable(L);
+	va_start(vargs, cmd);
+	result = mpdc_vsend(mpdc, cmd, vargs);
+	va_end(vargs);
 
-	while (len > 0 && (eon = strchr(ptr, ':'))) {
-		eol = strchr(eon, '\n');
-		lua_pushlstring(L, ptr, eon - ptr);
-		lua_pushlstring(L, eon + 2, eol - eon - 2);
-		lua_settable(L, -3);
-		len -= eol - ptr + 1;
-		ptr = eol + 1;
-	}
-	lua_remove(L, -2);
-	return 1;
+	if (result) return 0;
+	return luaA_mpdc_reply_text(L, mpdc);
 }
 
-static int luaA_mpdc_string_to_list_of_tables(lua_State *L, const char *firstname) {
-	size_t len;
-	const char* buf = lua_tolstring(L, -1, &len);
-	char *ptr = (char *)buf, *eol, *eon;
+/*
+ * read response (or its part till list_OK) into table: all pairs, or
+ * list of records (new record starts with firstname key), or list of
+ * values of filter key; returns line which ended it, with ACK message
+ * in key
+ */
+typedef enum { mt_pairs, mt_records, mt_values } mpdc_table_t;
+
+static mpdc_reply_t luaA_mpdc_read_table(lua_State *L, mpdc_type_t mpdc, mpdc_table_t kind, const char *name, const char **key, size_t *klen) {
+	const char *value;
+	size_t vlen, namelen = name? strlen(name): 0;
+	mpdc_reply_t r;
 	int i = 0;
 
 	lua_newtable(L);
-
-	while (len > 0 && (eon = strchr(ptr, ':'))) {
-		if (strncmp(ptr, firstname, eon - ptr) == 0) {
-			if (i > 0)
-				lua_settable(L, -3);
-
-			lua_pushnumber(L, ++i);
+	while ((r = mpdc_reply(mpdc, key, klen, &value, &vlen)) == mr_pair) {
+		if (kind == mt_values) {
+			if (*klen != namelen || memcmp(*key, name, *klen) != 0) continue;
+			lua_pushlstring(L, value, vlen);
+			lua_rawseti(L, -2, ++i);
+			continue;
+		}
+		if (kind == mt_records && *klen == namelen && memcmp(*key, name, *klen) == 0) {
+			if (i > 0) lua_rawseti(L, -2, i);
 			lua_newtable(L);
+			i++;
+		}
+		if (kind == mt_pairs || i > 0) {
+			lua_pushlstring(L, *key, *klen);
+			lua_pushlstring(L, value, vlen);
+			lua_rawset(L, -3);
 		}
-
-		eol = strchr(eon, '\n');
-
-		lua_pushlstring(L, ptr, eon - ptr);
-		lua_pushlstring(L, eon + 2, eol - eon - 2);
-		lua_settable(L, -3);
-
-		len -= eol - ptr + 1;
-		ptr = eol + 1;
 	}
-	lua_settable(L, -3);
-	lua_remove(L, -2);
-	return 1;
-}
-
-static int luaA_mpdc_string_to_list(lua_State *L, const char *filter) {
-	size_t len;
-	const char* buf = lua_tolstring(L, -1, &len);
-	char *ptr = (char *)buf, *eol, *eon;
-	int i = 0;
 
-	lua_newtable(L);
+	if (kind == mt_records && i > 0) lua_rawseti(L, -2, i);
+	return r;
+}
 
-	while (len > 0 && (eon = strchr(ptr, ':'))) {
-		eol = strchr(eon, '\n');
-		if (strncmp(ptr, filter, eon - ptr) == 0) {
-			lua_pushnumber(L, ++i);
-			lua_pushlstring(L, eon + 2, eol - eon - 2);
-			lua_settable(L, -3);
-		}
-		len -= eol - ptr + 1;
-		ptr = eol + 1;
+static int luaA_mpdc_reply_table(lua_State *L, mpdc_type_t mpdc, mpdc_table_t kind, const char *name) {
+	const char *key;
+	size_t klen;
+	int top = lua_gettop(L);
+
+	switch (luaA_mpdc_read_table(L, mpdc, kind, name, &key, &klen)) {
+	case mr_ack:
+		return luaA_mpdc_ack(L, key, klen);
+	case mr_error:
+		lua_settop(L, top);
+		mpdc_fail(mpdc);
+		return 0;
+	default:
+		return 1;
 	}
-	lua_remove(L, -2);
-	return 1;
 }
 // }}}
 
 // get current status {{{
-static int luaA_mpdc_current_song(lua_State *L) {
+LUAA_FUNC(mpdc_current_song) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
-	if (luaA_mpdc_command(L, mpdc->sh, "currentsong\n"))
-		return luaA_mpdc_string_to_table(L);
+	if (mpdc_send(mpdc, "currentsong\n") == 0)
+		return luaA_mpdc_reply_table(L, mpdc, mt_pairs, NULL);
 	return 0;
 }
 
-static int luaA_mpdc_status(lua_State *L) {
+LUAA_FUNC(mpdc_status) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
-	if (luaA_mpdc_command(L, mpdc->sh, "status\n"))
-		return luaA_mpdc_string_to_table(L);
+	if (mpdc_send(mpdc, "status\n") == 0)
+		return luaA_mpdc_reply_table(L, mpdc, mt_pairs, NULL);
 	return 0;
 }
 // }}}
 
 // songs listing {{{
-static int luaA_mpdc_list_all_songs(lua_State *L) {
+LUAA_FUNC(mpdc_list_all_songs) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
 	const char* filter = lua_tostring(L, 2);
 
-	if (luaA_mpdc_command(L, mpdc->sh, "listall %s\n", filter == NULL? "": filter))
-		return luaA_mpdc_string_to_list(L, "file");
+	if (mpdc_send(mpdc, "listall %s\n", filter == NULL? "": filter) == 0)
+		return luaA_mpdc_reply_table(L, mpdc, mt_values, "file");
 	return 0;
 }
 
-static int luaA_mpdc_list_songs_by_id(lua_State *L) {
+LUAA_FUNC(mpdc_list_songs_by_id) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
 	int songid = lua_tonumber(L, 2);
 	int result = songid?
-				 luaA_mpdc_command(L, mpdc->sh, "playlistid %d\n", songid)
-				:luaA_mpdc_command(L, mpdc->sh, "playlistid\n");
+				 mpdc_send(mpdc, "playlistid %d\n", songid)
+				:mpdc_send(mpdc, "playlistid\n");
+
+	if (result == 0)
+		return luaA_mpdc_reply_table(L, mpdc, mt_records, "file");
+	return 0;
+}
+// }}}
+
+// songs iterators {{{
+
+/*
+ * Iterators read response from socket one item per call, so memory
+ * is bounded by single record whatever library size is. Upvalues are
+ * connection, number of command (nil when response is over) and read
+ * ahead record. Iterator stops if other command is sent meanwhile,
+ * the rest of its response is drained then, or if connection is lost.
+ */
+static mpdc_type_t luaA_mpdc_iter_state(lua_State *L) {
+	mpdc_type_t mpdc = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_isnil(L, lua_upvalueindex(2)) || mpdc->sh < 0 || mpdc->pending == 0
+		|| (unsigned int)lua_tonumber(L, lua_upvalueindex(2)) != mpdc->sent)
+		return NULL;
+	return mpdc;
+}
+
+static void luaA_mpdc_iter_done(lua_State *L) {
+	lua_pushnil(L);
+	lua_replace(L, lua_upvalueindex(2));
+	lua_pushnil(L);
+	lua_replace(L, lua_upvalueindex(3));
+}
+
+/* next file name */
+LUAA_FUNC(mpdc_iter_values) {
+	mpdc_type_t mpdc = luaA_mpdc_iter_state(L);
+	const char *key, *value;
+	size_t klen, vlen;
+
+	if (mpdc == NULL) return 0;
+	for (;;) {
+		switch (mpdc_reply(mpdc, &key, &klen, &value, &vlen)) {
+		case mr_pair:
+			if (klen == 4 && memcmp(key, "file", 4) == 0) {
+				lua_pushlstring(L, value, vlen);
+				return 1;
+			}
+			break;
+		case mr_listok:
+			break;
+		case mr_ok:
+			luaA_mpdc_iter_done(L);
+			return 0;
+		case mr_ack:
+			luaA_mpdc_iter_done(L);
+			return luaA_mpdc_ack(L, key, klen);
+		case mr_error:
+			luaA_mpdc_iter_done(L);
+			mpdc_fail(mpdc);
+			return 0;
+		}
+	}
+}
+
+/*
+ * next song table, it ends where "file" key of the next one starts,
+ * so that key goes into read ahead table
+ */
+LUAA_FUNC(mpdc_iter_records) {
+	mpdc_type_t mpdc = luaA_mpdc_iter_state(L);
+	const char *key, *value;
+	size_t klen, vlen;
+	int started;
+
+	if (mpdc == NULL) return 0;
+	lua_pushvalue(L, lua_upvalueindex(3));
+	if (!(started = !lua_isnil(L, -1))) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+	}
+
+	for (;;) {
+		switch (mpdc_reply(mpdc, &key, &klen, &value, &vlen)) {
+		case mr_pair:
+			if (started && klen == 4 && memcmp(key, "file", 4) == 0) {
+				lua_newtable(L);
+				lua_pushlstring(L, key, klen);
+				lua_pushlstring(L, value, vlen);
+				lua_rawset(L, -3);
+				lua_replace(L, lua_upvalueindex(3));
+				return 1;
+			}
+			lua_pushlstring(L, key, klen);
+			lua_pushlstring(L, value, vlen);
+			lua_rawset(L, -3);
+			started = 1;
+			break;
+		case mr_listok:
+			break;
+		case mr_ok:
+			luaA_mpdc_iter_done(L);
+			return started;
+		case mr_ack:
+			luaA_mpdc_iter_done(L);
+			return luaA_mpdc_ack(L, key, klen);
+		case mr_error:
+			luaA_mpdc_iter_done(L);
+			mpdc_fail(mpdc);
+			return 0;
+		}
+	}
+}
+
+static int luaA_mpdc_iter(lua_State *L, mpdc_type_t mpdc, lua_CFunction next) {
+	lua_pushvalue(L, 1);
+	lua_pushnumber(L, mpdc->sent);
+	lua_pushnil(L);
+	lua_pushcclosure(L, next, 3);
+	return 1;
+}
+
+/* for file in mpd:iter_listall([path]) do ... end */
+LUAA_FUNC(mpdc_iter_listall) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	const char *path = lua_tostring(L, 2);
+	int result = path?
+				 mpdc_send(mpdc, "listall \"%s\"\n", path)
+				:mpdc_send(mpdc, "listall\n");
+
+	if (result == 0)
+		return luaA_mpdc_iter(L, mpdc, luaA_mpdc_iter_values);
+	return 0;
+}
+
+/* for song in mpd:iter_playlistinfo() do ... end */
+LUAA_FUNC(mpdc_iter_playlistinfo) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
 
-	if (result)
-		return luaA_mpdc_string_to_list_of_tables(L, "file");
+	if (mpdc_send(mpdc, "playlistinfo\n") == 0)
+		return luaA_mpdc_iter(L, mpdc, luaA_mpdc_iter_records);
 	return 0;
 }
 // }}}
 
+// command lists {{{
+
+/* batch results are read like results of the same methods, pairs by default */
+static const struct {
+	const char *name;
+	mpdc_table_t kind;
+	const char *key;
+} mpdc_batch_kinds[] = {
+	{"listall", mt_values, "file"},
+	{"playlistid", mt_records, "file"},
+	{"playlistinfo", mt_records, "file"},
+	{NULL, mt_pairs, NULL}
+};
+
+/* push command line for batch item: "name" or {"name", args...} */
+static const char *luaA_mpdc_batch_command(lua_State *L, int item) {
+	const char *name;
+	int j, n = 1;
+
+	if (lua_istable(L, item)) {
+		n = lua_objlen(L, item);
+		lua_rawgeti(L, item, 1);
+	} else {
+		lua_pushvalue(L, item);
+	}
+	if (lua_type(L, -1) != LUA_TSTRING)
+		luaL_error(L, "batch command must be a string or {name, args...}");
+	name = lua_tostring(L, -1);
+
+	for (j = 2; j <= n; j++) {
+		lua_pushliteral(L, " ");
+		lua_rawgeti(L, item, j);
+		switch (lua_type(L, -1)) {
+		case LUA_TNUMBER:
+			break;
+		case LUA_TBOOLEAN:
+			lua_pushstring(L, lua_toboolean(L, -1)? "1": "0");
+			lua_remove(L, -2);
+			break;
+		case LUA_TSTRING:
+			/* quoted, with backslash & quote escaped */
+			luaL_gsub(L, lua_tostring(L, -1), "\\", "\\\\");
+			luaL_gsub(L, lua_tostring(L, -1), "\"", "\\\"");
+			lua_pushliteral(L, "\"");
+			lua_insert(L, -2);
+			lua_pushliteral(L, "\"");
+			lua_concat(L, 3);
+			lua_replace(L, -3);
+			lua_pop(L, 1);
+			break;
+		default:
+			luaL_error(L, "bad argument #%d of batch command %s", j - 1, name);
+		}
+		lua_concat(L, 3);
+	}
+	lua_pushliteral(L, "\n");
+	lua_concat(L, 2);
+	return name;
+}
+
+/*
+ * mpd:batch{"status", "currentsong", {"playlistid", 5}} sends commands
+ * as one command list in one write and returns list of their results
+ */
+LUAA_FUNC(mpdc_batch) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	int i, k, n, top;
+	const char *key, *text, *name;
+	size_t klen, len;
+	unsigned char *kinds;
+	mpdc_reply_t r;
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+	n = lua_objlen(L, 2);
+	kinds = lua_newuserdata(L, n + 1);
+
+	lua_pushliteral(L, "command_list_ok_begin\n");
+	for (i = 1; i <= n; i++) {
+		lua_rawgeti(L, 2, i);
+		name = luaA_mpdc_batch_command(L, lua_gettop(L));
+		for (k = 0; mpdc_batch_kinds[k].name && strcmp(mpdc_batch_kinds[k].name, name); k++);
+		kinds[i] = k;
+		lua_remove(L, -2);
+		lua_concat(L, 2);
+	}
+	lua_pushliteral(L, "command_list_end\n");
+	lua_concat(L, 2);
+
+	text = lua_tolstring(L, -1, &len);
+	if (mpdc_sendcmd(mpdc, text, len)) return 0;
+	lua_pop(L, 1);
+
+	/* one list_OK after each command, then OK or ACK of failed one */
+	top = lua_gettop(L);
+	lua_createtable(L, n, 0);
+	for (i = 1; i <= n + 1; i++) {
+		k = i <= n? kinds[i]: 0;
+		r = luaA_mpdc_read_table(L, mpdc, mpdc_batch_kinds[k].kind, mpdc_batch_kinds[k].key, &key, &klen);
+		switch (r) {
+		case mr_listok:
+			if (i <= n) {
+				lua_rawseti(L, -2, i);
+				break;
+			}
+			/* fall through */
+		case mr_error:
+			lua_settop(L, top);
+			mpdc_fail(mpdc);
+			return 0;
+		case mr_ack:
+			return luaA_mpdc_ack(L, key, klen);
+		case mr_ok:
+			lua_pop(L, 1);
+			return 1;
+		default:
+			break;
+		}
+	}
+	return 1;
+}
+// }}}
+
+// idle {{{
+
+/* list of changes kept from cancelled idle, they're handed out once */
+static int luaA_mpdc_push_changed(lua_State *L, mpdc_type_t mpdc) {
+	const char *p = mpdc->changed, *end = p + mpdc->changedlen, *eol;
+	int i = 0;
+
+	lua_newtable(L);
+	for (; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		lua_pushlstring(L, p, eol - p);
+		lua_rawseti(L, -2, ++i);
+	}
+	mpdc->changedlen = 0;
+	return 1;
+}
+
+/*
+ * mpd:idle{"player", "mixer"} subscribes to changes of subsystems (all
+ * of them without list) and returns true at once; wait for mpd:fd() to
+ * get readable in event loop, then collect changes with mpd:idle_result().
+ * Any other command cancels idle with noidle, changes reported to it are
+ * kept, so next idle returns their list at once instead of true.
+ */
+LUAA_FUNC(mpdc_idle) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	const char *text;
+	size_t len;
+	luaL_Buffer b;
+	int i, n;
+
+	if (mpdc->idle && mpdc_noidle(mpdc)) return 0;
+	if (mpdc->changedlen > 0)
+		return luaA_mpdc_push_changed(L, mpdc);
+
+	luaL_buffinit(L, &b);
+	luaL_addstring(&b, "idle");
+	if (lua_istable(L, 2)) {
+		n = lua_objlen(L, 2);
+		for (i = 1; i <= n; i++) {
+			luaL_addchar(&b, ' ');
+			lua_rawgeti(L, 2, i);
+			if (lua_type(L, -1) != LUA_TSTRING)
+				luaL_error(L, "subsystem name must be a string");
+			luaL_addvalue(&b);
+		}
+	}
+	luaL_addchar(&b, '\n');
+	luaL_pushresult(&b);
+
+	text = lua_tolstring(L, -1, &len);
+	if (mpdc_sendcmd(mpdc, text, len)) return 0;
+	mpdc->idle = 1;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+ * list of changed subsystems, nil if idle isn't over yet, never blocks;
+ * changes kept from cancelled idle come first, idle or not
+ */
+LUAA_FUNC(mpdc_idle_result) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	ssize_t n;
+
+	if (mpdc->changedlen > 0)
+		return luaA_mpdc_push_changed(L, mpdc);
+	if (!mpdc->idle || mpdc->sh < 0) return 0;
+	while (!mpdc_ring_hasreply(&mpdc->in)) {
+		if ((n = mpdc_ring_fill(&mpdc->in, mpdc->sh, MSG_DONTWAIT)) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0) {
+			mpdc_fail(mpdc);
+			return 0;
+		}
+	}
+
+	mpdc->idle = 0;
+	return luaA_mpdc_reply_table(L, mpdc, mt_values, "changed");
+}
+
+/* socket to wait on for idle result, nil if disconnected */
+LUAA_FUNC(mpdc_fd) {
+	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
+	if (mpdc->sh < 0) return 0;
+	lua_pushinteger(L, mpdc->sh);
+	return 1;
+}
+// }}}
+
 // playback control {{{
 DO_SIMPLE_MPD_CMD(shuffle, "shuffle")
 DO_SIMPLE_MPD_CMD(play, "play")
@@ -268,23 +952,21 @@ DO_SET_MPD_CMD(set_repeat, "repeat")
 
 DO_SET_MPD_CMD(delete_song_by_id, "deleteid")
 
-static int luaA_mpdc_add_song(lua_State *L) {
+LUAA_FUNC(mpdc_add_song) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
 	const char *filename = luaL_checkstring(L, 2);
-	if (luaA_mpdc_command(L, mpdc->sh, "addid \"%s\"\n", filename))
-		return 1;
-	return 0;
+	return luaA_mpdc_command(L, mpdc, "addid \"%s\"\n", filename);
 }
 
-static int luaA_mpdc_seek_song_by_id(lua_State *L) {
+LUAA_FUNC(mpdc_seek_song_by_id) {
 	mpdc_type_t mpdc = luaL_checkudata(L, 1, "mpd_client");
 	int songid = luaL_checknumber(L, 2);
 	int pos = luaL_checknumber(L, 3);
 
-	return luaA_mpdc_command(L, mpdc->sh, "seekid %d %+d\n", songid, pos);
+	return luaA_mpdc_command(L, mpdc, "seekid %d %+d\n", songid, pos);
 }
 
-static int luaA_mpdc_index(lua_State *L) {
+LUAA_FUNC(mpdc_index) {
 	luaL_getmetatable(L, "mpd_client");
 	lua_pushvalue(L, 2);
 	lua_rawget(L, -2);
@@ -301,6 +983,7 @@ static int luaA_mpdc_index(lua_State *L) {
 static const luaL_reg mpdc_methods[] = {
 	{"open", luaA_mpdc_open},
 	{"close", luaA_mpdc_close},
+	LUAA_STATS_REG
 	{NULL, NULL}
 };
 
@@ -312,6 +995,12 @@ static const luaL_reg mpdc_meta[] = {
 	{"status", luaA_mpdc_status},
 	{"listall", luaA_mpdc_list_all_songs},
 	{"playlistid", luaA_mpdc_list_songs_by_id},
+	{"iter_listall", luaA_mpdc_iter_listall},
+	{"iter_playlistinfo", luaA_mpdc_iter_playlistinfo},
+	{"batch", luaA_mpdc_batch},
+	{"idle", luaA_mpdc_idle},
+	{"idle_result", luaA_mpdc_idle_result},
+	{"fd", luaA_mpdc_fd},
 
 	{"next", luaA_mpdc_next_song},
 	{"prev", luaA_mpdc_prev_song},
@@ -0,0 +1,466 @@
+/* includes {{{ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#include <net/if_dl.h>
+#include <net/route.h>
+#else
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#endif
+
+#include "luahelper.h"
+#include "luastruct.h"
+
+/* }}} */
+
+/* type definitions {{{ */
+
+#define NETSTATS "netstats"
+
+/* one interface, counters of last sample and their rates per second */
+typedef struct netstats_if_t {
+	char name[IFNAMSIZ];
+	int index;
+	int up;
+	uint64_t rx_bytes, tx_bytes;
+	uint64_t rx_packets, tx_packets;
+	uint64_t rx_errors, tx_errors;
+	uint64_t rx_drops, tx_drops;
+	double rx_bytes_rate, tx_bytes_rate;
+	double rx_packets_rate, tx_packets_rate;
+	double rx_errors_rate, tx_errors_rate;
+	double rx_drops_rate, tx_drops_rate;
+} netstats_if_t;
+
+/*
+ * Collector is the array of interfaces of the last sample itself,
+ * previous sample is kept aside to compute rates, both arrays are
+ * reused by next samples.
+ */
+typedef struct netstats_t {
+	netstats_if_t *ifs, *prev;
+	size_t len, prevlen, cap;
+	struct timespec last;
+	double elapsed;
+	char *buf;
+	size_t bufsz;
+#ifndef __FreeBSD__
+	int sock;
+	uint32_t seq;
+#endif
+} netstats_t;
+
+static const luaA_field_t netstats_rate_fields[] = {
+	LUAA_FFIELD(netstats_if_t, "rx_bytes", rx_bytes_rate),
+	LUAA_FFIELD(netstats_if_t, "tx_bytes", tx_bytes_rate),
+	LUAA_FFIELD(netstats_if_t, "rx_packets", rx_packets_rate),
+	LUAA_FFIELD(netstats_if_t, "tx_packets", tx_packets_rate),
+	LUAA_FFIELD(netstats_if_t, "rx_errors", rx_errors_rate),
+	LUAA_FFIELD(netstats_if_t, "tx_errors", tx_errors_rate),
+	LUAA_FFIELD(netstats_if_t, "rx_drops", rx_drops_rate),
+	LUAA_FFIELD(netstats_if_t, "tx_drops", tx_drops_rate),
+};
+
+static const luaA_field_t netstats_fields[] = {
+	LUAA_SFIELD(netstats_if_t, "name", name),
+	LUAA_IFIELD(netstats_if_t, "index", index),
+	LUAA_IFIELD(netstats_if_t, "up", up),
+	LUAA_UFIELD(netstats_if_t, "rx_bytes", rx_bytes),
+	LUAA_UFIELD(netstats_if_t, "tx_bytes", tx_bytes),
+	LUAA_UFIELD(netstats_if_t, "rx_packets", rx_packets),
+	LUAA_UFIELD(netstats_if_t, "tx_packets", tx_packets),
+	LUAA_UFIELD(netstats_if_t, "rx_errors", rx_errors),
+	LUAA_UFIELD(netstats_if_t, "tx_errors", tx_errors),
+	LUAA_UFIELD(netstats_if_t, "rx_drops", rx_drops),
+	LUAA_UFIELD(netstats_if_t, "tx_drops", tx_drops),
+	LUAA_SUBFIELD("rate", ft_struct, netstats_rate_fields),
+};
+
+static const luaA_struct_t netstats_struct = LUAA_STRUCT("netstats", netstats_if_t, netstats_fields);
+
+/* }}} */
+
+/* interface list readers {{{ */
+
+static netstats_if_t *
+netstats_add(netstats_t *ns)
+{
+	netstats_if_t *ifs;
+	size_t cap;
+
+	if (ns->len == ns->cap) {
+		cap = ns->cap? ns->cap * 2: 16;
+		if ((ifs = realloc(ns->ifs, cap * sizeof(netstats_if_t))) == NULL) return NULL;
+		ns->ifs = ifs;
+		if ((ifs = realloc(ns->prev, cap * sizeof(netstats_if_t))) == NULL) return NULL;
+		ns->prev = ifs;
+		ns->cap = cap;
+	}
+	memset(&ns->ifs[ns->len], 0, sizeof(netstats_if_t));
+	return &ns->ifs[ns->len++];
+}
+
+#ifdef __FreeBSD__
+
+/* if_data of all interfaces in one routing socket sysctl */
+static int
+netstats_read(netstats_t *ns)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, AF_LINK, NET_RT_IFLIST, 0 };
+	struct if_msghdr *ifm;
+	struct sockaddr_dl *sdl;
+	netstats_if_t *ifp;
+	size_t sz;
+	char *ptr, *buf;
+
+	for (;;) {
+		luaA_stats_syscall(0);
+		if (sysctl(mib, 6, NULL, &sz, NULL, 0)) return (-1);
+		sz += sz >> 3;
+		if (sz > ns->bufsz) {
+			if ((buf = realloc(ns->buf, sz)) == NULL) return (-1);
+			ns->buf = buf;
+			ns->bufsz = sz;
+		}
+		sz = ns->bufsz;
+		if (sysctl(mib, 6, ns->buf, &sz, NULL, 0) == 0) break;
+		if (errno != ENOMEM) return (-1);
+	}
+	luaA_stats_syscall(sz);
+
+	for (ptr = ns->buf; ptr < ns->buf + sz; ptr += ifm->ifm_msglen) {
+		ifm = (struct if_msghdr *)ptr;
+		if (ifm->ifm_msglen == 0) break;
+		if (ifm->ifm_type != RTM_IFINFO || !(ifm->ifm_addrs & RTA_IFP)) continue;
+
+		if ((ifp = netstats_add(ns)) == NULL) return (-1);
+		sdl = (struct sockaddr_dl *)(ifm + 1);
+		memcpy(ifp->name, sdl->sdl_data, sdl->sdl_nlen < IFNAMSIZ? sdl->sdl_nlen: IFNAMSIZ - 1);
+		ifp->index = ifm->ifm_index;
+		ifp->up = (ifm->ifm_flags & IFF_UP) != 0;
+		ifp->rx_bytes = ifm->ifm_data.ifi_ibytes;
+		ifp->tx_bytes = ifm->ifm_data.ifi_obytes;
+		ifp->rx_packets = ifm->ifm_data.ifi_ipackets;
+		ifp->tx_packets = ifm->ifm_data.ifi_opackets;
+		ifp->rx_errors = ifm->ifm_data.ifi_ierrors;
+		ifp->tx_errors = ifm->ifm_data.ifi_oerrors;
+		ifp->rx_drops = ifm->ifm_data.ifi_iqdrops;
+		ifp->tx_drops = ifm->ifm_data.ifi_oqdrops;
+	}
+	return (0);
+}
+
+#else
+
+/* one RTM_GETLINK dump over netlink socket kept open between samples */
+static int
+netstats_read(netstats_t *ns)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+	} req;
+	struct sockaddr_nl sa;
+	struct rtnl_link_stats64 st;
+	struct ifinfomsg *ifi;
+	struct nlmsghdr *nh;
+	struct rtattr *rta;
+	netstats_if_t *ifp;
+	ssize_t len;
+	int attrlen;
+
+	if (ns->sock < 0 && (ns->sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+		return (-1);
+	if (ns->buf == NULL) {
+		ns->bufsz = 32768;
+		if ((ns->buf = malloc(ns->bufsz)) == NULL) return (-1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = ++ns->seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	luaA_stats_syscall(sizeof(req));
+	if (sendto(ns->sock, &req, sizeof(req), 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		return (-1);
+
+	for (;;) {
+		len = recv(ns->sock, ns->buf, ns->bufsz, 0);
+		luaA_stats_syscall(len > 0? len: 0);
+		if (len <= 0) return (-1);
+
+		for (nh = (struct nlmsghdr *)ns->buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != ns->seq) continue;
+			if (nh->nlmsg_type == NLMSG_DONE) return (0);
+			if (nh->nlmsg_type == NLMSG_ERROR) return (-1);
+			if (nh->nlmsg_type != RTM_NEWLINK) continue;
+
+			if ((ifp = netstats_add(ns)) == NULL) return (-1);
+			ifi = NLMSG_DATA(nh);
+			ifp->index = ifi->ifi_index;
+			ifp->up = (ifi->ifi_flags & IFF_UP) != 0;
+
+			attrlen = IFLA_PAYLOAD(nh);
+			for (rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+				switch (rta->rta_type) {
+				case IFLA_IFNAME:
+					strncpy(ifp->name, RTA_DATA(rta), IFNAMSIZ - 1);
+					break;
+				case IFLA_STATS64:
+					if (RTA_PAYLOAD(rta) < sizeof(struct rtnl_link_stats64)) break;
+					/* attributes are only 4 bytes aligned */
+					memcpy(&st, RTA_DATA(rta), sizeof(st));
+					ifp->rx_bytes = st.rx_bytes;
+					ifp->tx_bytes = st.tx_bytes;
+					ifp->rx_packets = st.rx_packets;
+					ifp->tx_packets = st.tx_packets;
+					ifp->rx_errors = st.rx_errors;
+					ifp->tx_errors = st.tx_errors;
+					ifp->rx_drops = st.rx_dropped;
+					ifp->tx_drops = st.tx_dropped;
+					break;
+				}
+			}
+		}
+	}
+}
+
+#endif
+
+/* }}} */
+
+/* sampling {{{ */
+
+#define netstats_rate(cur, prev, field, scale) \
+	(cur)->field##_rate = (cur)->field >= (prev)->field? ((cur)->field - (prev)->field) * (scale): 0
+
+static int
+netstats_sample(netstats_t *ns)
+{
+	netstats_if_t *tmp, *cur, *prev;
+	struct timespec now;
+	size_t i, j = 0;
+	double scale;
+
+	/* last sample becomes previous one, its array is refilled */
+	tmp = ns->prev; ns->prev = ns->ifs; ns->ifs = tmp;
+	ns->prevlen = ns->len;
+	ns->len = 0;
+	if (netstats_read(ns)) {
+		ns->len = 0;
+		return (-1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns->elapsed = ns->last.tv_sec? (now.tv_sec - ns->last.tv_sec) + (now.tv_nsec - ns->last.tv_nsec) / 1e9: 0;
+	ns->last = now;
+	scale = ns->elapsed > 0? 1 / ns->elapsed: 0;
+
+	/* both lists come in kernel order, so matching is mostly a merge */
+	for (i = 0; i < ns->len; i++) {
+		cur = &ns->ifs[i];
+		if (j >= ns->prevlen || ns->prev[j].index != cur->index)
+			for (j = 0; j < ns->prevlen && ns->prev[j].index != cur->index; j++);
+		if (j >= ns->prevlen) {
+			j = 0;
+			continue;
+		}
+		prev = &ns->prev[j++];
+		netstats_rate(cur, prev, rx_bytes, scale);
+		netstats_rate(cur, prev, tx_bytes, scale);
+		netstats_rate(cur, prev, rx_packets, scale);
+		netstats_rate(cur, prev, tx_packets, scale);
+		netstats_rate(cur, prev, rx_errors, scale);
+		netstats_rate(cur, prev, tx_errors, scale);
+		netstats_rate(cur, prev, rx_drops, scale);
+		netstats_rate(cur, prev, tx_drops, scale);
+	}
+	return (0);
+}
+
+static netstats_if_t *
+netstats_find(netstats_t *ns, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < ns->len; i++)
+		if (strncmp(ns->ifs[i].name, name, IFNAMSIZ) == 0)
+			return &ns->ifs[i];
+	return NULL;
+}
+
+/* }}} */
+
+/* lua interface {{{ */
+
+static netstats_t *
+netstats_push(lua_State *L)
+{
+	netstats_t *ns = lua_newuserdata(L, sizeof(netstats_t));
+
+	memset(ns, 0, sizeof(netstats_t));
+#ifndef __FreeBSD__
+	ns->sock = -1;
+#endif
+	luaA_settype(L, -2, NETSTATS);
+	return ns;
+}
+
+/* netstats.new() makes collector of its own, first sample is taken at once */
+LUAA_FUNC(netstats_new)
+{
+	netstats_t *ns = netstats_push(L);
+
+	if (netstats_sample(ns))
+		return 0;
+	return 1;
+}
+
+/*
+ * netstats.sample() samples module's own collector and returns it,
+ * so every call refills the same array
+ */
+LUAA_FUNC(netstats_sample)
+{
+	netstats_t *ns;
+
+	if (lua_isnoneornil(L, lua_upvalueindex(1))) {
+		netstats_push(L);
+		lua_replace(L, lua_upvalueindex(1));
+	}
+	ns = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (netstats_sample(ns))
+		return 0;
+	lua_pushvalue(L, lua_upvalueindex(1));
+	return 1;
+}
+
+/* stats:sample() refills stats in place, returns seconds since last sample */
+LUAA_FUNC(netstats_resample)
+{
+	netstats_t *ns = luaL_checkudata(L, 1, NETSTATS);
+
+	if (netstats_sample(ns))
+		return 0;
+	lua_pushnumber(L, ns->elapsed);
+	return 1;
+}
+
+/* stats:totable() returns array of all interfaces rows */
+LUAA_FUNC(netstats_totable)
+{
+	netstats_t *ns = luaL_checkudata(L, 1, NETSTATS);
+	size_t i;
+
+	lua_createtable(L, ns->len, 0);
+	for (i = 0; i < ns->len; i++) {
+		luaA_struct_push(L, &netstats_struct, &ns->ifs[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+/* stats[i] or stats[ifname] returns row of one interface, it's decoded on demand */
+LUAA_FUNC(netstats_index)
+{
+	netstats_t *ns;
+	netstats_if_t *ifp;
+	lua_Integer i;
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		ns = luaL_checkudata(L, 1, NETSTATS);
+		i = lua_tointeger(L, 2);
+		if (i < 1 || (size_t)i > ns->len)
+			return 0;
+		return luaA_struct_push(L, &netstats_struct, &ns->ifs[i - 1]);
+	}
+
+	luaA_checkmetaindex(L, NETSTATS);
+
+	ns = luaL_checkudata(L, 1, NETSTATS);
+	if ((ifp = netstats_find(ns, luaL_checkstring(L, 2))) == NULL)
+		return 0;
+	return luaA_struct_push(L, &netstats_struct, ifp);
+}
+
+LUAA_FUNC(netstats_len)
+{
+	netstats_t *ns = luaL_checkudata(L, 1, NETSTATS);
+	lua_pushinteger(L, ns->len);
+	return 1;
+}
+
+LUAA_FUNC(netstats_tostring)
+{
+	netstats_t *ns = luaL_checkudata(L, 1, NETSTATS);
+	lua_pushfstring(L, NETSTATS ": %d interfaces", (int)ns->len);
+	return 1;
+}
+
+LUAA_FUNC(netstats_gc)
+{
+	netstats_t *ns = luaL_checkudata(L, 1, NETSTATS);
+
+	free(ns->ifs);
+	free(ns->prev);
+	free(ns->buf);
+#ifndef __FreeBSD__
+	if (ns->sock >= 0) close(ns->sock);
+#endif
+	return 0;
+}
+
+/* }}} */
+
+/* lua register structs {{{ */
+
+LUAA_SREG(netstats_methods)
+LUAA_REG(netstats, new)
+LUAA_STATS_REG
+LUAA_EREG
+
+LUAA_SREG(netstats_meta)
+LUAA_MREG(netstats, index)
+LUAA_MREG(netstats, len)
+LUAA_MREG(netstats, tostring)
+LUAA_MREG(netstats, gc)
+{ "sample", luaA_netstats_resample },
+LUAA_REG(netstats, totable)
+LUAA_EREG
+
+LUALIB_API int luaopen_netstats (lua_State *L) {
+	luaL_newmetatable(L, NETSTATS);
+	luaL_register(L, NULL, netstats_meta);
+	lua_pop(L, 1);
+
+	luaL_register(L, "netstats", netstats_methods);
+	lua_pushnil(L);
+	lua_pushcclosure(L, luaA_netstats_sample, 1);
+	lua_setfield(L, -2, "sample");
+	lua_pushliteral(L, "version");
+	lua_pushliteral(L, "netstats library for lua 0.1");
+	lua_rawset(L, -3);
+	return 1;
+}
+
+/* }}} */
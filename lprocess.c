@@ -0,0 +1,567 @@
+/* includes {{{ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#else
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "luahelper.h"
+#include "luastruct.h"
+
+/* }}} */
+
+/* type definitions {{{ */
+
+#define PROCESS "process_sampler"
+
+/* processes with /proc/[pid]/stat kept open between samples */
+#define PROCESS_MAXFDS 512
+
+/* row visible from lua */
+typedef struct process_info_t {
+	int pid;
+	int ppid;
+	int uid;
+	int threads;
+	char name[20];
+	char state[2];
+	double cpu;
+	double time;
+	uint64_t rss;
+	uint64_t vsize;
+} process_info_t;
+
+typedef struct process_entry_t {
+	process_info_t info;
+	uint64_t cputime;
+	int fd;
+} process_entry_t;
+
+/* pid keyed open addressing hash, pid -1 marks empty entry */
+typedef struct process_table_t {
+	process_entry_t *entries;
+	size_t mask;
+	size_t count;
+} process_table_t;
+
+typedef enum { pk_cpu, pk_rss, pk_time } process_key_t;
+
+/*
+ * Sampler keeps two tables, processes of the last sample and of the
+ * one before it, so CPU usage is a delta of CPU time between them.
+ */
+typedef struct process_sampler_t {
+	process_table_t tables[2];
+	int cur;
+	struct timespec last;
+	double elapsed;
+	process_entry_t **order;
+	size_t ordercap;
+	long pagesize;
+#ifdef __FreeBSD__
+	struct kinfo_proc *kp;
+	size_t kpsz;
+#else
+	DIR *dir;
+	long hz;
+	int nfds;
+	char buf[1024];
+#endif
+} process_sampler_t;
+
+static const luaA_field_t process_fields[] = {
+	LUAA_IFIELD(process_info_t, "pid", pid),
+	LUAA_IFIELD(process_info_t, "ppid", ppid),
+	LUAA_IFIELD(process_info_t, "uid", uid),
+	LUAA_IFIELD(process_info_t, "threads", threads),
+	LUAA_SFIELD(process_info_t, "name", name),
+	LUAA_SFIELD(process_info_t, "state", state),
+	LUAA_FFIELD(process_info_t, "cpu", cpu),
+	LUAA_FFIELD(process_info_t, "time", time),
+	LUAA_UFIELD(process_info_t, "rss", rss),
+	LUAA_UFIELD(process_info_t, "vsize", vsize),
+};
+
+static const luaA_struct_t process_struct = LUAA_STRUCT("process", process_info_t, process_fields);
+
+/* }}} */
+
+/* pid hash {{{ */
+
+#define process_hash(pid) (((uint32_t)(pid) * 2654435761u))
+
+static int
+process_table_reset(process_table_t *t, size_t n)
+{
+	size_t i, size = 256;
+
+	while (size < n * 2) size <<= 1;
+	if (size != t->mask + 1 || t->entries == NULL) {
+		process_entry_t *entries = realloc(t->entries, size * sizeof(process_entry_t));
+		if (entries == NULL) return (-1);
+		t->entries = entries;
+		t->mask = size - 1;
+	}
+	for (i = 0; i <= t->mask; i++) {
+		t->entries[i].info.pid = -1;
+		t->entries[i].fd = -1;
+	}
+	t->count = 0;
+	return (0);
+}
+
+static process_entry_t *
+process_table_find(const process_table_t *t, int pid)
+{
+	size_t i;
+
+	if (t->entries == NULL) return NULL;
+	for (i = process_hash(pid) & t->mask; t->entries[i].info.pid != -1; i = (i + 1) & t->mask)
+		if (t->entries[i].info.pid == pid)
+			return &t->entries[i];
+	return NULL;
+}
+
+/* new entry for pid, table grows twice once it's half full */
+static process_entry_t *
+process_table_insert(process_table_t *t, int pid)
+{
+	process_table_t grown = { NULL, 0, 0 };
+	process_entry_t *e;
+	size_t i;
+
+	if ((t->count + 1) * 2 > t->mask + 1) {
+		if (process_table_reset(&grown, t->count + 1)) return NULL;
+		for (i = 0; i <= t->mask; i++) {
+			if (t->entries[i].info.pid == -1) continue;
+			*process_table_insert(&grown, t->entries[i].info.pid) = t->entries[i];
+		}
+		free(t->entries);
+		*t = grown;
+	}
+
+	for (i = process_hash(pid) & t->mask; t->entries[i].info.pid != -1; i = (i + 1) & t->mask);
+	e = &t->entries[i];
+	memset(e, 0, sizeof(process_entry_t));
+	e->info.pid = pid;
+	e->fd = -1;
+	t->count++;
+	return e;
+}
+
+/* }}} */
+
+/* process table readers {{{ */
+
+#ifdef __FreeBSD__
+
+static const char process_states[] = " IRSTZWL";
+
+/* whole process table in one sysctl, one entry per process */
+static int
+process_read(process_sampler_t *s, process_table_t *prev, process_table_t *cur)
+{
+	int mib[3] = { CTL_KERN, KERN_PROC, KERN_PROC_PROC };
+	struct kinfo_proc *kp;
+	process_entry_t *e;
+	size_t i, sz;
+
+	(void)prev;
+	for (;;) {
+		luaA_stats_syscall(0);
+		if (sysctl(mib, 3, NULL, &sz, NULL, 0)) return (-1);
+		sz += sz >> 3;
+		if (sz > s->kpsz) {
+			if ((kp = realloc(s->kp, sz)) == NULL) return (-1);
+			s->kp = kp;
+			s->kpsz = sz;
+		}
+		sz = s->kpsz;
+		if (sysctl(mib, 3, s->kp, &sz, NULL, 0) == 0) break;
+		if (errno != ENOMEM) return (-1);
+	}
+	luaA_stats_syscall(sz);
+
+	if (process_table_reset(cur, sz / sizeof(struct kinfo_proc))) return (-1);
+	for (i = 0; i < sz / sizeof(struct kinfo_proc); i++) {
+		kp = &s->kp[i];
+		if ((e = process_table_insert(cur, kp->ki_pid)) == NULL) return (-1);
+		e->info.ppid = kp->ki_ppid;
+		e->info.uid = kp->ki_uid;
+		e->info.threads = kp->ki_numthreads;
+		strlcpy(e->info.name, kp->ki_comm, sizeof(e->info.name));
+		e->info.state[0] = kp->ki_stat > 0 && kp->ki_stat < sizeof(process_states) - 1? process_states[(int)kp->ki_stat]: '?';
+		e->info.rss = (uint64_t)kp->ki_rssize * s->pagesize;
+		e->info.vsize = kp->ki_size;
+		e->cputime = kp->ki_runtime;
+	}
+	return (0);
+}
+
+#else
+
+/* parse /proc/[pid]/stat, name is in parens and may have anything in it */
+static int
+process_parse(process_sampler_t *s, process_entry_t *e, char *buf)
+{
+	unsigned long long utime, stime, vsize;
+	long long rss;
+	char *name, *end;
+	long threads;
+
+	if ((name = strchr(buf, '(')) == NULL || (end = strrchr(name, ')')) == NULL)
+		return (-1);
+	*end = 0;
+	strncpy(e->info.name, name + 1, sizeof(e->info.name) - 1);
+	e->info.name[sizeof(e->info.name) - 1] = 0;
+
+	if (sscanf(end + 2, "%c %d %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu %*s %*s %*s %*s %ld %*s %*s %llu %lld",
+		&e->info.state[0], &e->info.ppid, &utime, &stime, &threads, &vsize, &rss) != 7)
+		return (-1);
+
+	e->info.threads = threads;
+	e->info.vsize = vsize;
+	e->info.rss = rss * s->pagesize;
+	e->cputime = (utime + stime) * 1000000ULL / s->hz;
+	return (0);
+}
+
+/*
+ * scan /proc, stat files of processes seen before are read
+ * through fds kept open since then
+ */
+static int
+process_read(process_sampler_t *s, process_table_t *prev, process_table_t *cur)
+{
+	process_entry_t parsed, *e, *old;
+	struct dirent *de;
+	char path[32];
+	struct stat st;
+	ssize_t len;
+	size_t i;
+	int pid, fd, uid;
+
+	if (s->dir == NULL && (s->dir = opendir("/proc")) == NULL) return (-1);
+	rewinddir(s->dir);
+	if (process_table_reset(cur, prev->count)) return (-1);
+
+	while ((de = readdir(s->dir))) {
+		if (de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+		pid = atoi(de->d_name);
+
+		fd = -1;
+		uid = -1;
+		if ((old = process_table_find(prev, pid))) {
+			fd = old->fd;
+			uid = old->info.uid;
+			old->fd = -1;
+		}
+		len = fd < 0? -1: pread(fd, s->buf, sizeof(s->buf) - 1, 0);
+		if (fd >= 0) luaA_stats_syscall(len > 0? len: 0);
+		if (len <= 0 && fd >= 0) {
+			/* pid was reused since last sample */
+			close(fd);
+			s->nfds--;
+			fd = -1;
+		}
+		if (fd < 0) {
+			snprintf(path, sizeof(path), "%d/stat", pid);
+			luaA_stats_syscall(0);
+			if ((fd = openat(dirfd(s->dir), path, O_RDONLY | O_CLOEXEC)) < 0) continue;
+			s->nfds++;
+			uid = fstat(fd, &st)? -1: (int)st.st_uid;
+			len = pread(fd, s->buf, sizeof(s->buf) - 1, 0);
+			luaA_stats_syscall(sizeof(st) + (len > 0? len: 0));
+		}
+
+		/* parsed aside, emptying inserted entry would break probe chains */
+		if (len > 0) {
+			s->buf[len] = 0;
+			memset(&parsed, 0, sizeof(parsed));
+			parsed.info.pid = pid;
+			parsed.info.uid = uid;
+		}
+		if (len <= 0 || process_parse(s, &parsed, s->buf) || (e = process_table_insert(cur, pid)) == NULL) {
+			close(fd);
+			s->nfds--;
+			continue;
+		}
+		*e = parsed;
+		e->fd = -1;
+
+		if (s->nfds > PROCESS_MAXFDS) {
+			close(fd);
+			s->nfds--;
+		} else {
+			e->fd = fd;
+		}
+	}
+
+	/* whatever left open belongs to exited processes */
+	for (i = 0; prev->entries && i <= prev->mask; i++) {
+		if (prev->entries[i].fd < 0) continue;
+		close(prev->entries[i].fd);
+		prev->entries[i].fd = -1;
+		s->nfds--;
+	}
+	return (0);
+}
+
+#endif
+
+/* }}} */
+
+/* sampler {{{ */
+
+static int
+process_sample(process_sampler_t *s)
+{
+	process_table_t *prev = &s->tables[s->cur], *cur = &s->tables[s->cur ^ 1];
+	process_entry_t *e, *old;
+	struct timespec now;
+	size_t i;
+
+	if (process_read(s, prev, cur)) return (-1);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s->elapsed = s->last.tv_sec? (now.tv_sec - s->last.tv_sec) + (now.tv_nsec - s->last.tv_nsec) / 1e9: 0;
+	s->last = now;
+
+	for (i = 0; i <= cur->mask; i++) {
+		e = &cur->entries[i];
+		if (e->info.pid == -1) continue;
+		e->info.time = e->cputime / 1e6;
+		old = process_table_find(prev, e->info.pid);
+		if (old && s->elapsed > 0 && old->cputime <= e->cputime)
+			e->info.cpu = (e->cputime - old->cputime) / 1e4 / s->elapsed;
+	}
+
+	s->cur ^= 1;
+	return (0);
+}
+
+static double
+process_key(const process_entry_t *e, process_key_t key)
+{
+	switch (key) {
+	case pk_rss: return e->info.rss;
+	case pk_time: return e->info.time;
+	default: return e->info.cpu;
+	}
+}
+
+/* sift heap root down, heap is min-ordered by key */
+static void
+process_heap_down(process_entry_t **heap, size_t n, size_t i, process_key_t key)
+{
+	process_entry_t *tmp;
+	size_t child;
+
+	while ((child = i * 2 + 1) < n) {
+		if (child + 1 < n && process_key(heap[child + 1], key) < process_key(heap[child], key))
+			child++;
+		if (process_key(heap[i], key) <= process_key(heap[child], key))
+			break;
+		tmp = heap[i]; heap[i] = heap[child]; heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*
+ * top n processes by key in s->order, largest first: bounded min-heap
+ * over all processes, then the heap itself is sorted in place
+ */
+static size_t
+process_top(process_sampler_t *s, size_t n, process_key_t key)
+{
+	const process_table_t *t = &s->tables[s->cur];
+	process_entry_t **heap, *tmp;
+	size_t i, len = 0;
+
+	if (n > t->count) n = t->count;
+	if (n > s->ordercap) {
+		if ((heap = realloc(s->order, n * sizeof(process_entry_t *))) == NULL) return 0;
+		s->order = heap;
+		s->ordercap = n;
+	}
+	heap = s->order;
+	if (n == 0) return 0;
+
+	for (i = 0; i <= t->mask; i++) {
+		if (t->entries[i].info.pid == -1) continue;
+		if (len < n) {
+			heap[len++] = &t->entries[i];
+			if (len == n) {
+				for (len = n / 2; len-- > 0;)
+					process_heap_down(heap, n, len, key);
+				len = n;
+			}
+		} else if (process_key(&t->entries[i], key) > process_key(heap[0], key)) {
+			heap[0] = &t->entries[i];
+			process_heap_down(heap, n, 0, key);
+		}
+	}
+
+	/* pop minimums to the end, so array ends up in descending order */
+	for (len = n; len > 1; len--) {
+		tmp = heap[0]; heap[0] = heap[len - 1]; heap[len - 1] = tmp;
+		process_heap_down(heap, len - 1, 0, key);
+	}
+	return n;
+}
+
+static void
+process_free(process_sampler_t *s)
+{
+	size_t i;
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		for (i = 0; s->tables[k].entries && i <= s->tables[k].mask; i++)
+			if (s->tables[k].entries[i].fd >= 0)
+				close(s->tables[k].entries[i].fd);
+		free(s->tables[k].entries);
+		s->tables[k].entries = NULL;
+	}
+	free(s->order);
+	s->order = NULL;
+#ifdef __FreeBSD__
+	free(s->kp);
+	s->kp = NULL;
+#else
+	if (s->dir) closedir(s->dir);
+	s->dir = NULL;
+#endif
+}
+
+/* }}} */
+
+/* lua interface {{{ */
+
+/* process.sampler() makes sampler, first sample is taken at once */
+LUAA_FUNC(process_sampler)
+{
+	process_sampler_t *s = lua_newuserdata(L, sizeof(process_sampler_t));
+
+	memset(s, 0, sizeof(process_sampler_t));
+	luaA_settype(L, -2, PROCESS);
+	s->pagesize = getpagesize();
+#ifndef __FreeBSD__
+	s->hz = sysconf(_SC_CLK_TCK);
+#endif
+	if (process_sample(s))
+		return 0;
+	return 1;
+}
+
+/* sampler:sample() reads process table, returns number of processes and seconds since last sample */
+LUAA_FUNC(process_sample)
+{
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+
+	if (process_sample(s))
+		return 0;
+	lua_pushinteger(L, s->tables[s->cur].count);
+	lua_pushnumber(L, s->elapsed);
+	return 2;
+}
+
+/*
+ * sampler:top([n [, by]]) returns array of n (10) rows of processes
+ * with the most "cpu" (default), "rss" or "time", cpu is percents
+ * of one CPU during last interval
+ */
+LUAA_FUNC(process_top)
+{
+	static const char *keys[] = { "cpu", "rss", "time", NULL };
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+	int n = luaL_optinteger(L, 2, 10);
+	process_key_t key = luaL_checkoption(L, 3, "cpu", keys);
+	size_t i;
+
+	luaL_argcheck(L, n >= 0, 2, "negative number of rows");
+	n = process_top(s, n, key);
+	lua_createtable(L, n, 0);
+	for (i = 0; i < (size_t)n; i++) {
+		luaA_struct_push(L, &process_struct, &s->order[i]->info);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+/* sampler:get(pid) returns row of process */
+LUAA_FUNC(process_get)
+{
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+	process_entry_t *e = process_table_find(&s->tables[s->cur], luaL_checkinteger(L, 2));
+
+	if (e == NULL)
+		return 0;
+	return luaA_struct_push(L, &process_struct, &e->info);
+}
+
+LUAA_FUNC(process_len)
+{
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+	lua_pushinteger(L, s->tables[s->cur].count);
+	return 1;
+}
+
+LUAA_FUNC(process_index)
+{
+	luaA_checkmetaindex(L, PROCESS);
+	return 0;
+}
+
+LUAA_FUNC(process_tostring)
+{
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+	lua_pushfstring(L, PROCESS ": %d processes", (int)s->tables[s->cur].count);
+	return 1;
+}
+
+LUAA_FUNC(process_gc)
+{
+	process_sampler_t *s = luaL_checkudata(L, 1, PROCESS);
+	process_free(s);
+	return 0;
+}
+
+/* }}} */
+
+/* lua register structs {{{ */
+
+LUAA_SREG(process_methods)
+LUAA_REG(process, sampler)
+LUAA_STATS_REG
+LUAA_EREG
+
+LUAA_SREG(process_meta)
+LUAA_MREG(process, index)
+LUAA_MREG(process, len)
+LUAA_MREG(process, tostring)
+LUAA_MREG(process, gc)
+LUAA_REG(process, sample)
+LUAA_REG(process, top)
+LUAA_REG(process, get)
+LUAA_EREG
+
+LUAA_OPEN(process, PROCESS, "0.1")
+
+/* }}} */
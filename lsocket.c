@@ -28,6 +28,7 @@ LUAA_FUNC(socket_open)
 
 	sock = lua_newuserdata(L, sizeof(int));
 	*sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+	luaA_stats_syscall(0);
 
 	if ((*sock < 0) || (connect(*sock, addr->ai_addr, addr->ai_addrlen) < 0)) {
 		lua_pop(L, 1);
@@ -59,6 +60,7 @@ LUAA_FUNC(socket_send)
 	const char *buf = luaL_checklstring(L, 2, &len);
 
 	len = send(*sockh, (void *)buf, len, 0);
+	luaA_stats_syscall(len > 0? len: 0);
 	if (len < 0) return 0;
 
 	lua_pushnumber(L, len);
@@ -73,6 +75,7 @@ LUAA_FUNC(socket_recv)
 	int num = 0;//, snum;
 
 	while ((len = recv(*sockh, buf, BUFSIZ, 0)) > 0) {
+		luaA_stats_syscall(len);
 		//if (len < 1) { if (++snum > 0) break; else continue; }
 		//snum = 0;
 		lua_pushlstring(L, buf, len);
@@ -105,6 +108,7 @@ LUAA_FUNC(socket_index)
 
 LUAA_SREG(socket_methods)
 LUAA_REG(socket, open)
+LUAA_STATS_REG
 LUAA_EREG
 
 LUAA_SREG(socket_meta)
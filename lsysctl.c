@@ -5,7 +5,11 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 
 #undef STRICT_WARNS
 #define USE_FMT_ONLY 1
@@ -17,19 +21,80 @@
 #endif
 
 #include <sys/types.h>
-#include <sys/sysctl.h>
-
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <math.h>
+
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>
 #include <sys/vmmeter.h>
 #include <vm/vm_param.h>
 
+#include <sys/mbuf.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_var.h>
+#include <netinet/udp.h>
+#include <netinet/udp_var.h>
 #include <netinet/sctp_uio.h>
 #include <netinet/ip_var.h>
 #include <net/if.h>
 #include <net/if_mib.h>
+#else
+#if !defined(SYSCTL_FAKE) && defined(__linux__)
+#define SYSCTL_PROCFS 1
+#endif
+#if !defined(SYSCTL_FAKE) && !defined(SYSCTL_PROCFS)
+#error "lsysctl needs FreeBSD sysctl(3) or Linux /proc/sys, build with -DSYSCTL_FAKE elsewhere"
+#endif
+#include <sys/sysmacros.h>
+#ifdef SYSCTL_PROCFS
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#endif
+
+/* just enough of FreeBSD's <sys/sysctl.h> to run against fake or procfs backend */
+#define CTL_MAXNAME 24
+#define CTL_VM 2
+
+#define CTLTYPE 0xf
+#define CTLTYPE_NODE 1
+#define CTLTYPE_INT 2
+#define CTLTYPE_STRING 3
+#define CTLTYPE_QUAD 4
+#define CTLTYPE_OPAQUE 5
+#define CTLTYPE_UINT 6
+#define CTLTYPE_LONG 7
+#define CTLTYPE_ULONG 8
+
+#define CTLFLAG_RD 0x80000000
+#define CTLFLAG_WR 0x40000000
+
+struct clockinfo { int hz; int tick; int spare; int stathz; int profhz; };
+struct loadavg { uint32_t ldavg[3]; long fscale; };
+#endif
 
 #include "luahelper.h"
+#include "luastruct.h"
+#include "luaarray.h"
+#include "luahistory.h"
+#include "luahistfile.h"
+#include "luaseries.h"
 
 /* }}} */
 
@@ -41,8 +106,9 @@
 
 typedef enum { sm_name = 1, sm_type = 4, sm_desc = 5 } sysctl_meta_t;
 
-typedef enum { st_none, st_clockinfo, st_timeval, st_loadavg, st_vmtotal, st_dev, st_sctpstat, st_ipstat, st_unknown } st_type_t;
-static const char* st_names[9] = {
+typedef enum { st_none, st_clockinfo, st_timeval, st_loadavg, st_vmtotal, st_dev, st_sctpstat, st_ipstat,
+	st_tcpstat, st_udpstat, st_mbstat, st_unknown } st_type_t;
+static const char* st_names[12] = {
 	"",
 	"clockinfo",
 	"timeval",
@@ -51,11 +117,14 @@ static const char* st_names[9] = {
 	"device",
 	"sctpstat",
 	"ipstat",
+	"tcpstat",
+	"udpstat",
+	"mbstat",
 	"unknown"
 };
 
 typedef struct sysctl_node_t {
-	int* mib;
+	int mib[CTL_MAXNAME];
 	size_t mlen;
 	size_t sz;
 	int type;
@@ -69,6 +138,618 @@ typedef int (*sysctl_node_setter_t) (lua_State *, sysctl_node_t *, int);
 
 /* }}} */
 
+/* fake mib tree backend {{{ */
+
+#if defined(SYSCTL_FAKE) || defined(SYSCTL_PROCFS)
+
+/*
+ * In-memory MIB tree answering the same queries as sysctl(3), including
+ * {0,1} name, {0,2} next, {0,3} name2oid, {0,4} oidfmt and {0,5} desc,
+ * so the module can be exercised on hosts without FreeBSD sysctl.
+ * Entries are kept sorted by OID, the tree is populated via sysctl.fake{}
+ * or mirrors /proc/sys on Linux (see procfs backend below).
+ */
+typedef struct fake_oid_t {
+	int mib[CTL_MAXNAME];
+	size_t mlen;
+	u_int kind;
+	char *name;
+	char *desc;
+	char *fmt;
+	void *value;
+	size_t sz, cap;
+	int fd;
+	/* errno writes fail with, to exercise error paths */
+	int wrerr;
+} fake_oid_t;
+
+static fake_oid_t *fake_oids = NULL;
+static size_t fake_noids = 0, fake_maxoids = 0;
+/* sampler queries tree from its thread, while sysctl.set & sysctl.fake change it */
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+fake_mibcmp(const int *mib1, size_t mlen1, const int *mib2, size_t mlen2)
+{
+	size_t i;
+	for (i = 0; i < mlen1 && i < mlen2; i++)
+		if (mib1[i] != mib2[i])
+			return mib1[i] < mib2[i]? -1: 1;
+	return mlen1 == mlen2? 0: (mlen1 < mlen2? -1: 1);
+}
+
+/* index of first entry not less than mib */
+static size_t
+fake_lower_bound(const int *mib, size_t mlen)
+{
+	size_t lo = 0, hi = fake_noids, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (fake_mibcmp(fake_oids[mid].mib, fake_oids[mid].mlen, mib, mlen) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static fake_oid_t*
+fake_find(const int *mib, size_t mlen)
+{
+	size_t i = fake_lower_bound(mib, mlen);
+	if (i < fake_noids && fake_mibcmp(fake_oids[i].mib, fake_oids[i].mlen, mib, mlen) == 0)
+		return &fake_oids[i];
+	return NULL;
+}
+
+static fake_oid_t*
+fake_find_name(const char *name, size_t len)
+{
+	size_t i;
+	for (i = 0; i < fake_noids; i++)
+		if (strncmp(fake_oids[i].name, name, len) == 0 && fake_oids[i].name[len] == '\0')
+			return &fake_oids[i];
+	return NULL;
+}
+
+/* next leaf after mib, nodes themselves are skipped just like kernel does */
+static fake_oid_t*
+fake_next(const int *mib, size_t mlen)
+{
+	size_t i = fake_lower_bound(mib, mlen);
+	for (; i < fake_noids; i++)
+		if (fake_mibcmp(fake_oids[i].mib, fake_oids[i].mlen, mib, mlen) > 0
+			&& (fake_oids[i].kind & CTLTYPE) != CTLTYPE_NODE)
+			return &fake_oids[i];
+	return NULL;
+}
+
+static void
+fake_clear(void)
+{
+	size_t i;
+	for (i = 0; i < fake_noids; i++) {
+		free(fake_oids[i].name);
+		free(fake_oids[i].desc);
+		free(fake_oids[i].fmt);
+		free(fake_oids[i].value);
+		if (fake_oids[i].fd >= 0) close(fake_oids[i].fd);
+	}
+	free(fake_oids);
+	fake_oids = NULL;
+	fake_noids = fake_maxoids = 0;
+}
+
+/* find or create node by dotted name, creating missing parents as nodes */
+static fake_oid_t*
+fake_add(const char *name)
+{
+	fake_oid_t *oid, *parent = NULL;
+	const char *dot = name;
+	size_t i, pos, len;
+	int num;
+
+	do {
+		dot = strchr(dot, '.');
+		len = dot? (size_t)(dot - name): strlen(name);
+		if ((oid = fake_find_name(name, len)) == NULL) {
+			if (parent && parent->mlen == CTL_MAXNAME) return NULL;
+
+			/* new child gets next free number under its parent */
+			num = 1;
+			for (i = 0; i < fake_noids; i++)
+				if (fake_oids[i].mlen == (parent? parent->mlen + 1: 1)
+					&& (!parent || fake_mibcmp(fake_oids[i].mib, parent->mlen, parent->mib, parent->mlen) == 0)
+					&& fake_oids[i].mib[fake_oids[i].mlen - 1] >= num)
+					num = fake_oids[i].mib[fake_oids[i].mlen - 1] + 1;
+
+			if (fake_noids == fake_maxoids) {
+				size_t maxoids = fake_maxoids? fake_maxoids * 2: 64;
+				fake_oid_t *oids = realloc(fake_oids, maxoids * sizeof(fake_oid_t));
+				if (oids == NULL) return NULL;
+				if (parent) parent = oids + (parent - fake_oids);
+				fake_oids = oids;
+				fake_maxoids = maxoids;
+			}
+
+			memset(&fake_oids[fake_noids], 0, sizeof(fake_oid_t));
+			oid = &fake_oids[fake_noids];
+			if (parent) memcpy(oid->mib, parent->mib, parent->mlen * sizeof(int));
+			oid->mlen = parent? parent->mlen + 1: 1;
+			oid->mib[oid->mlen - 1] = num;
+			oid->kind = CTLTYPE_NODE | CTLFLAG_RD;
+			oid->name = strndup(name, len);
+			oid->fmt = strdup("N");
+			oid->fd = -1;
+
+			/* keep entries ordered by oid */
+			pos = fake_lower_bound(oid->mib, oid->mlen);
+			if (pos < fake_noids) {
+				fake_oid_t tmp = *oid;
+				memmove(&fake_oids[pos + 1], &fake_oids[pos], (fake_noids - pos) * sizeof(fake_oid_t));
+				fake_oids[pos] = tmp;
+			}
+			oid = &fake_oids[pos];
+			fake_noids++;
+		}
+		parent = oid;
+	} while (dot++);
+
+	return oid;
+}
+
+static int
+fake_copyout(void *old, size_t *oldlenp, const void *data, size_t sz)
+{
+	if (oldlenp == NULL) return (0);
+	if (old == NULL) {
+		*oldlenp = sz;
+		return (0);
+	}
+	if (*oldlenp < sz) {
+		memcpy(old, data, *oldlenp);
+		errno = ENOMEM;
+		return (-1);
+	}
+	memcpy(old, data, sz);
+	*oldlenp = sz;
+	return (0);
+}
+
+#ifdef SYSCTL_PROCFS
+static fake_oid_t* procfs_lookup(const char *name, size_t len);
+static int procfs_scan(void);
+static int procfs_infer(fake_oid_t *oid);
+static int procfs_read(fake_oid_t *oid);
+static int procfs_write(fake_oid_t *oid, const void *new, size_t newlen);
+#else
+#define procfs_lookup(name, len) NULL
+#define procfs_scan() (0)
+#define procfs_infer(oid) (0)
+#define procfs_read(oid) (0)
+#define procfs_write(oid, new, newlen) (0)
+#endif
+
+static int
+fake_sysctl(const int *name, u_int namelen, void *old, size_t *oldlenp, const void *new, size_t newlen)
+{
+	fake_oid_t *oid;
+
+	if (namelen >= 2 && name[0] == 0) {
+		switch (name[1]) {
+		case 1:
+			if ((oid = fake_find(name + 2, namelen - 2)) == NULL) break;
+			return fake_copyout(old, oldlenp, oid->name, strlen(oid->name) + 1);
+		case 2:
+			if (procfs_scan()) return (-1);
+			if ((oid = fake_next(name + 2, namelen - 2)) == NULL) break;
+			return fake_copyout(old, oldlenp, oid->mib, oid->mlen * sizeof(int));
+		case 3:
+			if ((oid = fake_find_name(new, newlen)) == NULL
+				&& (oid = procfs_lookup(new, newlen)) == NULL) break;
+			return fake_copyout(old, oldlenp, oid->mib, oid->mlen * sizeof(int));
+		case 4: {
+			u_char buf[BUFSIZ];
+			size_t sz;
+			if ((oid = fake_find(name + 2, namelen - 2)) == NULL || procfs_infer(oid)) break;
+			sz = strlen(oid->fmt) + 1;
+			if (sz > sizeof(buf) - sizeof(u_int)) sz = sizeof(buf) - sizeof(u_int);
+			memcpy(buf, &oid->kind, sizeof(u_int));
+			memcpy(buf + sizeof(u_int), oid->fmt, sz);
+			return fake_copyout(old, oldlenp, buf, sizeof(u_int) + sz);
+		}
+		case 5:
+			if ((oid = fake_find(name + 2, namelen - 2)) == NULL) break;
+			return fake_copyout(old, oldlenp, oid->desc? oid->desc: "", oid->desc? strlen(oid->desc) + 1: 1);
+		}
+		errno = ENOENT;
+		return (-1);
+	}
+
+	if ((oid = fake_find(name, namelen)) == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	if (new) {
+		if (!(oid->kind & CTLFLAG_WR)) {
+			errno = EPERM;
+			return (-1);
+		}
+		if (oid->wrerr) {
+			errno = oid->wrerr;
+			return (-1);
+		}
+#ifdef SYSCTL_PROCFS
+		if (procfs_write(oid, new, newlen)) return (-1);
+		if (oldlenp == NULL) return (0);
+#else
+		void *value;
+		if ((value = malloc(newlen? newlen: 1)) == NULL) return (-1);
+		memcpy(value, new, newlen);
+		free(oid->value);
+		oid->value = value;
+		oid->sz = newlen;
+#endif
+	}
+
+	if (oldlenp && procfs_read(oid)) return (-1);
+	if (oid->value == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	return fake_copyout(old, oldlenp, oid->value, oid->sz);
+}
+
+/* sysctl(3) look-alike, serialized as sampler may call it from its thread */
+static int
+fake_locked_sysctl(const int *name, u_int namelen, void *old, size_t *oldlenp, const void *new, size_t newlen)
+{
+	int result, error;
+
+	pthread_mutex_lock(&fake_lock);
+	result = fake_sysctl(name, namelen, old, oldlenp, new, newlen);
+	error = errno;
+	pthread_mutex_unlock(&fake_lock);
+	errno = error;
+
+	return result;
+}
+
+#define sysctl_backend fake_locked_sysctl
+
+#else
+
+#define sysctl_backend sysctl
+
+#endif
+
+#ifdef LUAA_STATS
+/* count every backend call as a syscall moving old & new values */
+static int
+sysctl_call(const int *name, u_int namelen, void *old, size_t *oldlenp, const void *new, size_t newlen)
+{
+	int result = sysctl_backend(name, namelen, old, oldlenp, new, newlen);
+	luaA_stats_syscall((result == 0 && old && oldlenp? *oldlenp: 0) + (new? newlen: 0));
+	return result;
+}
+#else
+#define sysctl_call sysctl_backend
+#endif
+
+/* }}} */
+
+/* procfs backend {{{ */
+
+#ifdef SYSCTL_PROCFS
+
+/*
+ * Linux /proc/sys mirrored into fake MIB tree: dotted names map to paths
+ * under /proc/sys ('.' in file names is spelled as '/', like sysctl(8)
+ * does), entries are added on name lookups and the whole tree is walked
+ * with getdents64 on first sysctl.each(). Type of every file is inferred
+ * from its first read: whitespace separated integers become longs, the
+ * rest is string. Files being read stay open and are re-read with pread
+ * at offset 0, up to PROCFS_MAXFDS of them.
+ */
+#define PROCFS_ROOT "/proc/sys"
+#define PROCFS_MAXFDS 256
+
+struct procfs_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static int procfs_dir = -1;
+static int procfs_scanned = 0;
+static int procfs_nfds = 0;
+static char *procfs_text = NULL;
+static size_t procfs_textsz = 0;
+
+static int
+procfs_root(void)
+{
+	if (procfs_dir < 0)
+		procfs_dir = open(PROCFS_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	return procfs_dir;
+}
+
+/* dotted name to path relative to /proc/sys */
+static int
+procfs_path(const char *name, size_t len, char *path, size_t pathsz)
+{
+	size_t i;
+
+	if (len >= pathsz) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	for (i = 0; i < len; i++)
+		path[i] = name[i] == '.'? '/': (name[i] == '/'? '.': name[i]);
+	path[len] = '\0';
+	return (0);
+}
+
+static fake_oid_t*
+procfs_add(const char *name, int isdir)
+{
+	fake_oid_t *oid = fake_add(name);
+
+	/* leaves get their type on first read */
+	if (oid && !isdir && (oid->kind & CTLTYPE) == CTLTYPE_NODE) {
+		oid->kind = CTLTYPE_NONE;
+		free(oid->fmt);
+		oid->fmt = NULL;
+	}
+	return oid;
+}
+
+static fake_oid_t*
+procfs_lookup(const char *name, size_t len)
+{
+	char path[PATH_MAX], dotted[PATH_MAX];
+	struct stat st;
+
+	if (procfs_root() < 0 || procfs_path(name, len, path, sizeof(path)))
+		return NULL;
+	if (fstatat(procfs_dir, path, &st, 0))
+		return NULL;
+
+	memcpy(dotted, name, len);
+	dotted[len] = '\0';
+	return procfs_add(dotted, S_ISDIR(st.st_mode));
+}
+
+/* add all entries of directory, name holds dotted name of directory itself */
+static int
+procfs_scandir(int dirfd, char *name, size_t len)
+{
+	char buf[4096];
+	struct procfs_dirent64 *ent;
+	struct stat st;
+	size_t i, namelen;
+	long n, pos;
+	int isdir, subfd;
+
+	while ((n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < n; pos += ent->d_reclen) {
+			ent = (struct procfs_dirent64 *)(buf + pos);
+			if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+				continue;
+
+			namelen = strlen(ent->d_name);
+			if (len + namelen + 2 > PATH_MAX)
+				continue;
+			if (len) name[len] = '.';
+			for (i = 0; i <= namelen; i++)
+				name[len + !!len + i] = ent->d_name[i] == '.'? '/': ent->d_name[i];
+
+			if (ent->d_type == DT_UNKNOWN) {
+				if (fstatat(dirfd, ent->d_name, &st, 0)) continue;
+				isdir = S_ISDIR(st.st_mode);
+			} else {
+				isdir = ent->d_type == DT_DIR;
+			}
+
+			if (procfs_add(name, isdir) == NULL)
+				continue;
+			if (isdir && (subfd = openat(dirfd, ent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+				procfs_scandir(subfd, name, len + !!len + namelen);
+				close(subfd);
+			}
+		}
+	}
+	name[len] = '\0';
+
+	return n < 0? -1: 0;
+}
+
+static int
+procfs_scan(void)
+{
+	char name[PATH_MAX];
+	int fd, result;
+
+	if (procfs_scanned) return (0);
+	if (procfs_root() < 0) return (-1);
+	if ((fd = openat(procfs_dir, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return (-1);
+
+	name[0] = '\0';
+	result = procfs_scandir(fd, name, 0);
+	close(fd);
+	procfs_scanned = result == 0;
+	return result;
+}
+
+/* read whole file into shared text buffer, returns its length */
+static ssize_t
+procfs_pread(fake_oid_t *oid)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	char *text;
+	int fd = oid->fd;
+
+	if (fd < 0) {
+		if (procfs_root() < 0 || procfs_path(oid->name, strlen(oid->name), path, sizeof(path)))
+			return (-1);
+		if ((fd = openat(procfs_dir, path, O_RDONLY | O_CLOEXEC)) < 0)
+			return (-1);
+		/* keep it open for next reads unless there're too many of them */
+		if (procfs_nfds < PROCFS_MAXFDS) {
+			oid->fd = fd;
+			procfs_nfds++;
+		}
+	}
+
+	if (procfs_text == NULL && (procfs_text = malloc(procfs_textsz = BUFSIZ)) == NULL)
+		return (-1);
+	/* text is kept nul terminated for strtol */
+	while ((n = pread(fd, procfs_text, procfs_textsz - 1, 0)) == (ssize_t)procfs_textsz - 1) {
+		if ((text = realloc(procfs_text, procfs_textsz * 2)) == NULL) break;
+		procfs_text = text;
+		procfs_textsz *= 2;
+	}
+	procfs_text[n > 0? n: 0] = '\0';
+
+	if (fd != oid->fd) close(fd);
+	return n;
+}
+
+/* whitespace separated integers only */
+static int
+procfs_isnumeric(const char *text, size_t len)
+{
+	const char *ptr = text, *end = text + len;
+	char *next;
+	int n = 0;
+
+	while (ptr < end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n')) ptr++;
+		if (ptr == end) break;
+		strtol(ptr, &next, 10);
+		if (next == ptr || (next < end && *next != ' ' && *next != '\t' && *next != '\n'))
+			return 0;
+		ptr = next;
+		n++;
+	}
+	return n > 0;
+}
+
+static int
+procfs_infer(fake_oid_t *oid)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int numeric = 0;
+
+	if (oid->fmt) return (0);
+	if (procfs_root() < 0 || procfs_path(oid->name, strlen(oid->name), path, sizeof(path)))
+		return (-1);
+
+	oid->kind = 0;
+	if (faccessat(procfs_dir, path, R_OK, AT_EACCESS) == 0) {
+		oid->kind |= CTLFLAG_RD;
+		if ((n = procfs_pread(oid)) > 0)
+			numeric = procfs_isnumeric(procfs_text, n);
+	}
+	if (faccessat(procfs_dir, path, W_OK, AT_EACCESS) == 0)
+		oid->kind |= CTLFLAG_WR;
+
+	oid->kind |= numeric? CTLTYPE_LONG: CTLTYPE_STRING;
+	oid->fmt = strdup(numeric? "L": "A");
+	return oid->fmt? 0: -1;
+}
+
+/* make sure oid value can hold sz bytes */
+static int
+procfs_reserve(fake_oid_t *oid, size_t sz)
+{
+	void *value;
+
+	if (sz <= oid->cap) return (0);
+	if ((value = realloc(oid->value, sz)) == NULL) return (-1);
+	oid->value = value;
+	oid->cap = sz;
+	return (0);
+}
+
+/* re-read file and convert it into binary value */
+static int
+procfs_read(fake_oid_t *oid)
+{
+	ssize_t n;
+	char *ptr, *end, *next;
+	long *values;
+	size_t count;
+
+	if ((oid->kind & CTLTYPE) == CTLTYPE_NODE) return (0);
+	if (procfs_infer(oid) || (n = procfs_pread(oid)) < 0) return (-1);
+
+	if (oid->fmt[0] != 'L') {
+		if (n > 0 && procfs_text[n - 1] == '\n') n--;
+		if (procfs_reserve(oid, n + 1)) return (-1);
+		memcpy(oid->value, procfs_text, n);
+		((char *)oid->value)[n] = '\0';
+		oid->sz = n;
+		return (0);
+	}
+
+	/* at most one number per two chars */
+	if (procfs_reserve(oid, (n / 2 + 1) * sizeof(long))) return (-1);
+	values = oid->value;
+	ptr = procfs_text;
+	end = procfs_text + n;
+	for (count = 0; ptr < end; count++) {
+		values[count] = strtol(ptr, &next, 10);
+		if (next == ptr) break;
+		ptr = next;
+	}
+	oid->sz = count * sizeof(long);
+	return (0);
+}
+
+static int
+procfs_write(fake_oid_t *oid, const void *new, size_t newlen)
+{
+	char path[PATH_MAX], *text;
+	size_t i, len = 0;
+	ssize_t n;
+	int fd;
+
+	if (procfs_infer(oid) || procfs_path(oid->name, strlen(oid->name), path, sizeof(path)))
+		return (-1);
+
+	if (oid->fmt[0] == 'L') {
+		/* 21 chars per long with separator */
+		if ((text = malloc(newlen / sizeof(long) * 21 + 1)) == NULL) return (-1);
+		for (i = 0; i < newlen / sizeof(long); i++)
+			len += sprintf(text + len, i? "\t%ld": "%ld", ((const long *)new)[i]);
+	} else {
+		if ((text = malloc(newlen + 1)) == NULL) return (-1);
+		memcpy(text, new, newlen);
+		len = strnlen(text, newlen);
+	}
+
+	if ((fd = openat(procfs_dir, path, O_WRONLY | O_CLOEXEC)) < 0) {
+		free(text);
+		return (-1);
+	}
+	n = write(fd, text, len);
+	close(fd);
+	free(text);
+
+	return n < 0? -1: 0;
+}
+
+#endif
+
+/* }}} */
+
 /* sysctl helper function {{{ */
 
 /* get mib of node by its symbolic name */
@@ -84,15 +765,11 @@ sysctl_mib(sysctl_node_t *node, const char* name)
 
 	oid[0] = 0;
 	oid[1] = 3;
-	if (sysctl(oid, 2, mib, &sz, (void *)name, strlen(name))) {
+	if (sysctl_call(oid, 2, mib, &sz, (void *)name, strlen(name))) {
 		warn("sysctl call failed in sysctl_mib(%s)", name);
 		return (-1);
 	}
 
-	if ((node->mib = (int*)malloc(sz)) == NULL) {
-		warn("malloc failed in sysctl_mib(%s)", name);
-		return (-1);
-	}
 	node->mlen = sz / sizeof(int);
 	memcpy(node->mib, mib, sz);
 	return (0);
@@ -102,21 +779,17 @@ sysctl_mib(sysctl_node_t *node, const char* name)
 static int
 sysctl_first(sysctl_node_t *node)
 {
-	int name[3], newname[22];
+	int name[3], newname[CTL_MAXNAME];
 	size_t nlen;
 	name[0] = 0;
 	name[1] = 2;
 	name[2] = 1;
 	nlen = sizeof(newname);
-	if (sysctl(name, 3, newname, &nlen, NULL, 0)) {
+	if (sysctl_call(name, 3, newname, &nlen, NULL, 0)) {
 		warn("sysctl call failed in sysctl_first");
 		return (-1);
 	}
 	node->mlen = nlen / sizeof(int);
-	if ((node->mib = malloc(nlen)) == NULL) {
-		warn("malloc failed in sysctl_first");
-		return (-1);
-	}
 	memcpy(node->mib, newname, nlen);
 
 	return (0);
@@ -126,7 +799,7 @@ sysctl_first(sysctl_node_t *node)
 static int
 sysctl_next(sysctl_node_t *node)
 {
-	int name[22], newname[22], *newmib;
+	int name[CTL_MAXNAME+2], newname[CTL_MAXNAME];
 	size_t nlen, len;
 	name[0] = 0;
 	name[1] = 2;
@@ -135,20 +808,11 @@ sysctl_next(sysctl_node_t *node)
 	len = node->mlen + 2;
 	nlen = sizeof(newname);
 
-	if (sysctl(name, len, newname, &nlen, NULL, 0)) {
+	if (sysctl_call(name, len, newname, &nlen, NULL, 0)) {
 		warn("sysctl call failed in sysctl_next");
 		return (-1);
 	}
-	len = nlen / sizeof(int);
-
-	if (len != node->mlen) {
-		if ((newmib = realloc(node->mib, nlen)) == NULL) {
-			warn("realloc failed in sysctl_next");
-			return (-1);
-		}
-		node->mlen = len;
-		node->mib = newmib;
-	}
+	node->mlen = nlen / sizeof(int);
 	memcpy(node->mib, newname, nlen);
 	return (0);
 }
@@ -168,7 +832,7 @@ sysctl_type(sysctl_node_t *node, u_int *flags)
 	memcpy(qoid + 2, node->mib, node->mlen * sizeof(int));
 
 	sz = sizeof(buf);
-	if (sysctl(qoid, node->mlen + 2, buf, &sz, 0, 0)) {
+	if (sysctl_call(qoid, node->mlen + 2, buf, &sz, 0, 0)) {
 		warn("sysctl call failed in sysctl_type");
 		return (-1);
 	}
@@ -197,6 +861,12 @@ sysctl_type(sysctl_node_t *node, u_int *flags)
 			node->stype = st_sctpstat;
 		else if (strcmp(str_type, "S,ipstat") == 0)
 			node->stype = st_ipstat;
+		else if (strcmp(str_type, "S,tcpstat") == 0)
+			node->stype = st_tcpstat;
+		else if (strcmp(str_type, "S,udpstat") == 0)
+			node->stype = st_udpstat;
+		else if (strcmp(str_type, "S,mbstat") == 0)
+			node->stype = st_mbstat;
 		else
 			node->stype = st_unknown;
 	} else {
@@ -220,7 +890,7 @@ sysctl_info(sysctl_node_t *node, sysctl_meta_t meta)
 	memcpy(qoid + 2, node->mib, node->mlen * sizeof(int));
 
 	sz = sizeof(buf);
-	if (sysctl(qoid, node->mlen + 2, buf, &sz, 0, 0)) {
+	if (sysctl_call(qoid, node->mlen + 2, buf, &sz, 0, 0)) {
 		warn("sysctl call failed in sysctl_info");
 		return NULL;
 	}
@@ -234,317 +904,508 @@ sysctl_info(sysctl_node_t *node, sysctl_meta_t meta)
 	return result;
 }
 
-/* get node value */
+/* grow-only scratch buffer shared by name based reads */
+static void *sysctl_scratch = NULL;
+static size_t sysctl_scratch_sz = 0;
+
+/* get node value into scratch buffer, valid until next read */
 static void*
-sysctl_get(sysctl_node_t *node)
+sysctl_get_scratch(sysctl_node_t *node)
 {
-	size_t sz;
+	size_t sz = node->sz;
 	void *ptr;
-	if (node->sz) {
-		sz = node->sz;
-	} else {
-		if (sysctl(node->mib, node->mlen, NULL, &sz, NULL, 0)) {
-			warn("malloc failed in sysctl_get");
+
+	if (sz == 0 && sysctl_call(node->mib, node->mlen, NULL, &sz, NULL, 0)) {
+		warn("sysctl call failed in sysctl_get_scratch");
+		return NULL;
+	}
+	sz += sz >> 2;
+	if (sz > sysctl_scratch_sz) {
+		if ((ptr = realloc(sysctl_scratch, sz)) == NULL) {
+			warn("realloc failed in sysctl_get_scratch");
 			return NULL;
 		}
+		sysctl_scratch = ptr;
+		sysctl_scratch_sz = sz;
 	}
-	sz += sz >> 2;
-	if ((ptr = malloc(sz)) == NULL) return NULL;
-	if (sysctl(node->mib, node->mlen, ptr, &sz, NULL, 0)) {
-		warn("sysctl call failed in sysctl_get");
-		free(ptr);
-		warn("buffer freed in sysctl_get\n");
+
+	sz = sysctl_scratch_sz;
+	if (sysctl_call(node->mib, node->mlen, sysctl_scratch, &sz, NULL, 0)) {
+		/* value outgrew its last known size, probe it again once */
+		if (errno == ENOMEM && node->sz) {
+			node->sz = 0;
+			return sysctl_get_scratch(node);
+		}
+		warn("sysctl call failed in sysctl_get_scratch");
 		return NULL;
 	}
 	node->sz = sz;
-	return ptr;
+	return sysctl_scratch;
 }
 
 /* }}} */
 
-/* general purpose getters {{{ */
+/* struct descriptors {{{ */
+
+/*
+ * Struct values are decoded by descriptors from luastruct.h, to support
+ * new struct add its fields array & luaA_struct_t here, st_type_t for
+ * its format and a case in sysctl_struct_by_node.
+ */
+
+#ifdef __FreeBSD__
+
+static const luaA_field_t ipstat_fields[] = {
+	LUAA_UFIELD(struct ipstat, "total", ips_total),
+	LUAA_UFIELD(struct ipstat, "badsum", ips_badsum),
+	LUAA_UFIELD(struct ipstat, "tooshort", ips_tooshort),
+	LUAA_UFIELD(struct ipstat, "toosmall", ips_toosmall),
+	LUAA_UFIELD(struct ipstat, "badhlen", ips_badhlen),
+	LUAA_UFIELD(struct ipstat, "badlen", ips_badlen),
+	LUAA_UFIELD(struct ipstat, "fragments", ips_fragments),
+	LUAA_UFIELD(struct ipstat, "fragdropped", ips_fragdropped),
+	LUAA_UFIELD(struct ipstat, "fragtimeout", ips_fragtimeout),
+	LUAA_UFIELD(struct ipstat, "forward", ips_forward),
+	LUAA_UFIELD(struct ipstat, "fastforward", ips_fastforward),
+	LUAA_UFIELD(struct ipstat, "cantforward", ips_cantforward),
+	LUAA_UFIELD(struct ipstat, "redirectsent", ips_redirectsent),
+	LUAA_UFIELD(struct ipstat, "noproto", ips_noproto),
+	LUAA_UFIELD(struct ipstat, "delivered", ips_delivered),
+	LUAA_UFIELD(struct ipstat, "localout", ips_localout),
+	LUAA_UFIELD(struct ipstat, "odropped", ips_odropped),
+	LUAA_UFIELD(struct ipstat, "reassembled", ips_reassembled),
+	LUAA_UFIELD(struct ipstat, "fragmented", ips_fragmented),
+	LUAA_UFIELD(struct ipstat, "ofragments", ips_ofragments),
+	LUAA_UFIELD(struct ipstat, "cantfrag", ips_cantfrag),
+	LUAA_UFIELD(struct ipstat, "badoptions", ips_badoptions),
+	LUAA_UFIELD(struct ipstat, "noroute", ips_noroute),
+	LUAA_UFIELD(struct ipstat, "badvers", ips_badvers),
+	LUAA_UFIELD(struct ipstat, "rawout", ips_rawout),
+	LUAA_UFIELD(struct ipstat, "toolong", ips_toolong),
+	LUAA_UFIELD(struct ipstat, "notmember", ips_notmember),
+	LUAA_UFIELD(struct ipstat, "nogif", ips_nogif),
+	LUAA_UFIELD(struct ipstat, "badaddr", ips_badaddr),
+};
 
-#define LUA_SYSCTL_GETTER(suffx) \
-	static int luaA_sysctl_get##suffx (lua_State *L, void *buf, size_t sz)
+static const luaA_field_t sctpstat_discontinuitytime[] = {
+	LUAA_IFIELD(struct sctpstat, NULL, sctps_discontinuitytime.tv_sec),
+	LUAA_IFIELD(struct sctpstat, NULL, sctps_discontinuitytime.tv_usec),
+};
 
-#define NUMERIC_GETTER(suffx, type) \
-	LUA_SYSCTL_GETTER(suffx) { \
-		int i, n; \
-		type *value = (type *)buf; \
-		n = sz / sizeof(type); \
-		for (i = 0; i < n; i++) \
-			lua_pushnumber(L, value[i]); \
-		return n; \
-	}
+static const luaA_field_t sctpstat_fields[] = {
+	LUAA_UFIELD(struct sctpstat, "currestab", sctps_currestab),
+	LUAA_UFIELD(struct sctpstat, "activeestab", sctps_activeestab),
+	LUAA_UFIELD(struct sctpstat, "restartestab", sctps_restartestab),
+	LUAA_UFIELD(struct sctpstat, "collisionestab", sctps_collisionestab),
+	LUAA_UFIELD(struct sctpstat, "passiveestab", sctps_passiveestab),
+	LUAA_UFIELD(struct sctpstat, "aborted", sctps_aborted),
+	LUAA_UFIELD(struct sctpstat, "shutdown", sctps_shutdown),
+	LUAA_UFIELD(struct sctpstat, "outoftheblue", sctps_outoftheblue),
+	LUAA_UFIELD(struct sctpstat, "checksumerrors", sctps_checksumerrors),
+	LUAA_UFIELD(struct sctpstat, "outcontrolchunks", sctps_outcontrolchunks),
+	LUAA_UFIELD(struct sctpstat, "outorderchunks", sctps_outorderchunks),
+	LUAA_UFIELD(struct sctpstat, "outunorderchunks", sctps_outunorderchunks),
+	LUAA_UFIELD(struct sctpstat, "incontrolchunks", sctps_incontrolchunks),
+	LUAA_UFIELD(struct sctpstat, "inorderchunks", sctps_inorderchunks),
+	LUAA_UFIELD(struct sctpstat, "inunorderchunks", sctps_inunorderchunks),
+	LUAA_UFIELD(struct sctpstat, "fragusrmsgs", sctps_fragusrmsgs),
+	LUAA_UFIELD(struct sctpstat, "reasmusrmsgs", sctps_reasmusrmsgs),
+	LUAA_UFIELD(struct sctpstat, "outpackets", sctps_outpackets),
+	LUAA_UFIELD(struct sctpstat, "inpackets", sctps_inpackets),
+	LUAA_UFIELD(struct sctpstat, "recvpackets", sctps_recvpackets),
+	LUAA_UFIELD(struct sctpstat, "recvdatagrams", sctps_recvdatagrams),
+	LUAA_UFIELD(struct sctpstat, "recvpktwithdata", sctps_recvpktwithdata),
+	LUAA_UFIELD(struct sctpstat, "recvsacks", sctps_recvsacks),
+	LUAA_UFIELD(struct sctpstat, "recvdata", sctps_recvdata),
+	LUAA_UFIELD(struct sctpstat, "recvdupdata", sctps_recvdupdata),
+	LUAA_UFIELD(struct sctpstat, "recvheartbeat", sctps_recvheartbeat),
+	LUAA_UFIELD(struct sctpstat, "recvheartbeatack", sctps_recvheartbeatack),
+	LUAA_UFIELD(struct sctpstat, "recvecne", sctps_recvecne),
+	LUAA_UFIELD(struct sctpstat, "recvauth", sctps_recvauth),
+	LUAA_UFIELD(struct sctpstat, "recvauthmissing", sctps_recvauthmissing),
+	LUAA_UFIELD(struct sctpstat, "recvivalhmacid", sctps_recvivalhmacid),
+	LUAA_UFIELD(struct sctpstat, "recvivalkeyid", sctps_recvivalkeyid),
+	LUAA_UFIELD(struct sctpstat, "recvauthfailed", sctps_recvauthfailed),
+	LUAA_UFIELD(struct sctpstat, "recvexpress", sctps_recvexpress),
+	LUAA_UFIELD(struct sctpstat, "recvexpressm", sctps_recvexpressm),
+	LUAA_UFIELD(struct sctpstat, "sendpackets", sctps_sendpackets),
+	LUAA_UFIELD(struct sctpstat, "sendsacks", sctps_sendsacks),
+	LUAA_UFIELD(struct sctpstat, "senddata", sctps_senddata),
+	LUAA_UFIELD(struct sctpstat, "sendretransdata", sctps_sendretransdata),
+	LUAA_UFIELD(struct sctpstat, "sendfastretrans", sctps_sendfastretrans),
+	LUAA_UFIELD(struct sctpstat, "sendmultfastretrans", sctps_sendmultfastretrans),
+	LUAA_UFIELD(struct sctpstat, "sendheartbeat", sctps_sendheartbeat),
+	LUAA_UFIELD(struct sctpstat, "sendecne", sctps_sendecne),
+	LUAA_UFIELD(struct sctpstat, "sendauth", sctps_sendauth),
+	LUAA_UFIELD(struct sctpstat, "senderrors", sctps_senderrors),
+	LUAA_UFIELD(struct sctpstat, "pdrpfmbox", sctps_pdrpfmbox),
+	LUAA_UFIELD(struct sctpstat, "pdrpfehos", sctps_pdrpfehos),
+	LUAA_UFIELD(struct sctpstat, "pdrpmbda", sctps_pdrpmbda),
+	LUAA_UFIELD(struct sctpstat, "pdrpmbct", sctps_pdrpmbct),
+	LUAA_UFIELD(struct sctpstat, "pdrpbwrpt", sctps_pdrpbwrpt),
+	LUAA_UFIELD(struct sctpstat, "pdrpcrupt", sctps_pdrpcrupt),
+	LUAA_UFIELD(struct sctpstat, "pdrpnedat", sctps_pdrpnedat),
+	LUAA_UFIELD(struct sctpstat, "pdrppdbrk", sctps_pdrppdbrk),
+	LUAA_UFIELD(struct sctpstat, "pdrptsnnf", sctps_pdrptsnnf),
+	LUAA_UFIELD(struct sctpstat, "pdrpdnfnd", sctps_pdrpdnfnd),
+	LUAA_UFIELD(struct sctpstat, "pdrpdiwnp", sctps_pdrpdiwnp),
+	LUAA_UFIELD(struct sctpstat, "pdrpdizrw", sctps_pdrpdizrw),
+	LUAA_UFIELD(struct sctpstat, "pdrpbadd", sctps_pdrpbadd),
+	LUAA_UFIELD(struct sctpstat, "pdrpmark", sctps_pdrpmark),
+	LUAA_UFIELD(struct sctpstat, "timoiterator", sctps_timoiterator),
+	LUAA_UFIELD(struct sctpstat, "timodata", sctps_timodata),
+	LUAA_UFIELD(struct sctpstat, "timowindowprobe", sctps_timowindowprobe),
+	LUAA_UFIELD(struct sctpstat, "timoinit", sctps_timoinit),
+	LUAA_UFIELD(struct sctpstat, "timosack", sctps_timosack),
+	LUAA_UFIELD(struct sctpstat, "timoshutdown", sctps_timoshutdown),
+	LUAA_UFIELD(struct sctpstat, "timoheartbeat", sctps_timoheartbeat),
+	LUAA_UFIELD(struct sctpstat, "timocookie", sctps_timocookie),
+	LUAA_UFIELD(struct sctpstat, "timosecret", sctps_timosecret),
+	LUAA_UFIELD(struct sctpstat, "timopathmtu", sctps_timopathmtu),
+	LUAA_UFIELD(struct sctpstat, "timoshutdownack", sctps_timoshutdownack),
+	LUAA_UFIELD(struct sctpstat, "timoshutdownguard", sctps_timoshutdownguard),
+	LUAA_UFIELD(struct sctpstat, "timostrmrst", sctps_timostrmrst),
+	LUAA_UFIELD(struct sctpstat, "timoearlyfr", sctps_timoearlyfr),
+	LUAA_UFIELD(struct sctpstat, "timoasconf", sctps_timoasconf),
+	LUAA_UFIELD(struct sctpstat, "timodelprim", sctps_timodelprim),
+	LUAA_UFIELD(struct sctpstat, "timoautoclose", sctps_timoautoclose),
+	LUAA_UFIELD(struct sctpstat, "timoassockill", sctps_timoassockill),
+	LUAA_UFIELD(struct sctpstat, "timoinpkill", sctps_timoinpkill),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstart", sctps_earlyfrstart),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstop", sctps_earlyfrstop),
+	LUAA_UFIELD(struct sctpstat, "earlyfrmrkretrans", sctps_earlyfrmrkretrans),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstpout", sctps_earlyfrstpout),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstpidsck1", sctps_earlyfrstpidsck1),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstpidsck2", sctps_earlyfrstpidsck2),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstpidsck3", sctps_earlyfrstpidsck3),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstpidsck4", sctps_earlyfrstpidsck4),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstrid", sctps_earlyfrstrid),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstrout", sctps_earlyfrstrout),
+	LUAA_UFIELD(struct sctpstat, "earlyfrstrtmr", sctps_earlyfrstrtmr),
+	LUAA_UFIELD(struct sctpstat, "hdrops", sctps_hdrops),
+	LUAA_UFIELD(struct sctpstat, "badsum", sctps_badsum),
+	LUAA_UFIELD(struct sctpstat, "noport", sctps_noport),
+	LUAA_UFIELD(struct sctpstat, "badvtag", sctps_badvtag),
+	LUAA_UFIELD(struct sctpstat, "badsid", sctps_badsid),
+	LUAA_UFIELD(struct sctpstat, "nomem", sctps_nomem),
+	LUAA_UFIELD(struct sctpstat, "fastretransinrtt", sctps_fastretransinrtt),
+	LUAA_UFIELD(struct sctpstat, "markedretrans", sctps_markedretrans),
+	LUAA_UFIELD(struct sctpstat, "naglesent", sctps_naglesent),
+	LUAA_UFIELD(struct sctpstat, "naglequeued", sctps_naglequeued),
+	LUAA_UFIELD(struct sctpstat, "maxburstqueued", sctps_maxburstqueued),
+	LUAA_UFIELD(struct sctpstat, "ifnomemqueued", sctps_ifnomemqueued),
+	LUAA_UFIELD(struct sctpstat, "windowprobed", sctps_windowprobed),
+	LUAA_UFIELD(struct sctpstat, "lowlevelerr", sctps_lowlevelerr),
+	LUAA_UFIELD(struct sctpstat, "lowlevelerrusr", sctps_lowlevelerrusr),
+	LUAA_UFIELD(struct sctpstat, "datadropchklmt", sctps_datadropchklmt),
+	LUAA_UFIELD(struct sctpstat, "datadroprwnd", sctps_datadroprwnd),
+	LUAA_UFIELD(struct sctpstat, "ecnereducedcwnd", sctps_ecnereducedcwnd),
+	LUAA_UFIELD(struct sctpstat, "vtagexpress", sctps_vtagexpress),
+	LUAA_UFIELD(struct sctpstat, "vtagbogus", sctps_vtagbogus),
+	LUAA_UFIELD(struct sctpstat, "primary_randry", sctps_primary_randry),
+	LUAA_UFIELD(struct sctpstat, "cmt_randry", sctps_cmt_randry),
+	LUAA_UFIELD(struct sctpstat, "slowpath_sack", sctps_slowpath_sack),
+	LUAA_UFIELD(struct sctpstat, "wu_sacks_sent", sctps_wu_sacks_sent),
+	LUAA_UFIELD(struct sctpstat, "sends_with_flags", sctps_sends_with_flags),
+	LUAA_UFIELD(struct sctpstat, "sends_with_unord", sctps_sends_with_unord),
+	LUAA_UFIELD(struct sctpstat, "sends_with_eof", sctps_sends_with_eof),
+	LUAA_UFIELD(struct sctpstat, "sends_with_abort", sctps_sends_with_abort),
+	LUAA_UFIELD(struct sctpstat, "protocol_drain_calls", sctps_protocol_drain_calls),
+	LUAA_UFIELD(struct sctpstat, "protocol_drains_done", sctps_protocol_drains_done),
+	LUAA_UFIELD(struct sctpstat, "read_peeks", sctps_read_peeks),
+	LUAA_UFIELD(struct sctpstat, "cached_chk", sctps_cached_chk),
+	LUAA_UFIELD(struct sctpstat, "cached_strmoq", sctps_cached_strmoq),
+	LUAA_UFIELD(struct sctpstat, "left_abandon", sctps_left_abandon),
+	LUAA_UFIELD(struct sctpstat, "send_burst_avoid", sctps_send_burst_avoid),
+	LUAA_UFIELD(struct sctpstat, "send_cwnd_avoid", sctps_send_cwnd_avoid),
+	LUAA_UFIELD(struct sctpstat, "fwdtsn_map_over", sctps_fwdtsn_map_over),
+	LUAA_SUBFIELD("discontinuitytime", ft_array, sctpstat_discontinuitytime),
+};
 
-#define NIL_GETTER(suffx) \
-	LUA_SYSCTL_GETTER(suffx) { \
-		return 0; }
+static const luaA_field_t vmtotal_vmem[] = {
+	LUAA_IFIELD(struct vmtotal, NULL, t_vm),
+	LUAA_IFIELD(struct vmtotal, NULL, t_avm),
+};
 
-NUMERIC_GETTER(int, int)
-NUMERIC_GETTER(uint, unsigned int)
-NUMERIC_GETTER(long, long)
-NUMERIC_GETTER(ulong, unsigned long)
-NUMERIC_GETTER(quad, quad_t)
+static const luaA_field_t vmtotal_rmem[] = {
+	LUAA_IFIELD(struct vmtotal, NULL, t_rm),
+	LUAA_IFIELD(struct vmtotal, NULL, t_arm),
+};
 
-NIL_GETTER(struct)
+static const luaA_field_t vmtotal_vsmem[] = {
+	LUAA_IFIELD(struct vmtotal, NULL, t_vmshr),
+	LUAA_IFIELD(struct vmtotal, NULL, t_avmshr),
+};
 
-LUA_SYSCTL_GETTER(node)
-{
-	sysctl_node_t *node = lua_touserdata(L, 1);
-	/* do some heuristics */
-	if (node->mib[0] == CTL_NET && node->mib[1] == PF_LINK
-		&& node->mib[2] == NETLINK_GENERIC && node->mib[3] == IFMIB_IFDATA
-		&& sz == sizeof(struct ifmibdata)) {
-
-		struct ifmibdata *ifmbd = (struct ifmibdata *)buf;
-		lua_createtable(L, 0, 6);
-
-		luaA_settable(L, -2, "name", string, ifmbd->ifmd_name);
-		luaA_settable(L, -2, "pcount", number, ifmbd->ifmd_pcount);
-		luaA_settable(L, -2, "flags", number, ifmbd->ifmd_flags);
-		luaA_settable(L, -2, "snd_len", number, ifmbd->ifmd_snd_len);
-		luaA_settable(L, -2, "snd_drops", number, ifmbd->ifmd_snd_drops);
-
-		lua_createtable(L, 0, 25);
-
-		luaA_settable(L, -2, "type", number, ifmbd->ifmd_data.ifi_type);
-		luaA_settable(L, -2, "physical", number, ifmbd->ifmd_data.ifi_physical);
-		luaA_settable(L, -2, "addrlen", number, ifmbd->ifmd_data.ifi_addrlen);
-		luaA_settable(L, -2, "hdrlen", number, ifmbd->ifmd_data.ifi_hdrlen);
-		luaA_settable(L, -2, "link_state", number, ifmbd->ifmd_data.ifi_link_state);
-		luaA_settable(L, -2, "spare_char1", number, ifmbd->ifmd_data.ifi_spare_char1);
-		luaA_settable(L, -2, "spare_char2", number, ifmbd->ifmd_data.ifi_spare_char2);
-		luaA_settable(L, -2, "datalen", number, ifmbd->ifmd_data.ifi_datalen);
-		luaA_settable(L, -2, "mtu", number, ifmbd->ifmd_data.ifi_mtu);
-		luaA_settable(L, -2, "metric", number, ifmbd->ifmd_data.ifi_metric);
-		luaA_settable(L, -2, "baudrate", number, ifmbd->ifmd_data.ifi_baudrate);
-		luaA_settable(L, -2, "ipackets", number, ifmbd->ifmd_data.ifi_ipackets);
-		luaA_settable(L, -2, "ierrors", number, ifmbd->ifmd_data.ifi_ierrors);
-		luaA_settable(L, -2, "opackets", number, ifmbd->ifmd_data.ifi_opackets);
-		luaA_settable(L, -2, "oerrors", number, ifmbd->ifmd_data.ifi_oerrors);
-		luaA_settable(L, -2, "collisions", number, ifmbd->ifmd_data.ifi_collisions);
-		luaA_settable(L, -2, "ibytes", number, ifmbd->ifmd_data.ifi_ibytes);
-		luaA_settable(L, -2, "obytes", number, ifmbd->ifmd_data.ifi_obytes);
-		luaA_settable(L, -2, "imcasts", number, ifmbd->ifmd_data.ifi_imcasts);
-		luaA_settable(L, -2, "omcasts", number, ifmbd->ifmd_data.ifi_omcasts);
-		luaA_settable(L, -2, "iqdrops", number, ifmbd->ifmd_data.ifi_iqdrops);
-		luaA_settable(L, -2, "noproto", number, ifmbd->ifmd_data.ifi_noproto);
-		luaA_settable(L, -2, "hwassist", number, ifmbd->ifmd_data.ifi_hwassist);
-		luaA_settable(L, -2, "epoch", number, ifmbd->ifmd_data.ifi_epoch);
-
-		lua_createtable(L, 2, 0);
-		luaA_isettable(L, -2, 1, number, ifmbd->ifmd_data.ifi_lastchange.tv_sec);
-		luaA_isettable(L, -2, 2, number, ifmbd->ifmd_data.ifi_lastchange.tv_usec);
-		lua_setfield(L, -2, "lastchange");
-
-		lua_setfield(L, -2, "data");
-
-	} else if (node->mib[0] == CTL_VM && node->mlen == 3 && sz == sizeof(struct xswdev)) {
-
-		struct xswdev *xswd = (struct xswdev *)buf;
-		lua_createtable(L, 0, 5);
-
-		luaA_settable(L, -2, "version", number, xswd->xsw_version);
-		luaA_settable(L, -2, "flags", number, xswd->xsw_flags);
-		luaA_settable(L, -2, "nblks", number, xswd->xsw_nblks);
-		luaA_settable(L, -2, "used", number, xswd->xsw_used);
-
-		lua_createtable(L, 2, 0);
-
-		luaA_isettable(L, -2, 1, number, major(xswd->xsw_dev));
-		luaA_isettable(L, -2, 2, number, minor(xswd->xsw_dev));
-
-		lua_setfield(L, -2, "dev");
+static const luaA_field_t vmtotal_rsmem[] = {
+	LUAA_IFIELD(struct vmtotal, NULL, t_rmshr),
+	LUAA_IFIELD(struct vmtotal, NULL, t_armshr),
+};
 
-	} else {
-		lua_pushlstring(L, (char *)buf, sz - 1);
+static const luaA_field_t vmtotal_fields[] = {
+	LUAA_IFIELD(struct vmtotal, "runq", t_rq),
+	LUAA_IFIELD(struct vmtotal, "diskw", t_dw),
+	LUAA_IFIELD(struct vmtotal, "pagew", t_pw),
+	LUAA_IFIELD(struct vmtotal, "sleep", t_sl),
+	LUAA_SUBFIELD("vmem", ft_array, vmtotal_vmem),
+	LUAA_SUBFIELD("rmem", ft_array, vmtotal_rmem),
+	LUAA_SUBFIELD("vsmem", ft_array, vmtotal_vsmem),
+	LUAA_SUBFIELD("rsmem", ft_array, vmtotal_rsmem),
+	LUAA_IFIELD(struct vmtotal, "free", t_free),
+	{ "pagesz", ft_pagesize, 0, 0, NULL, 0 },
+};
+
+static const luaA_field_t ifmibdata_lastchange[] = {
+	LUAA_IFIELD(struct ifmibdata, NULL, ifmd_data.ifi_lastchange.tv_sec),
+	LUAA_IFIELD(struct ifmibdata, NULL, ifmd_data.ifi_lastchange.tv_usec),
+};
+
+static const luaA_field_t ifmibdata_data[] = {
+	LUAA_UFIELD(struct ifmibdata, "type", ifmd_data.ifi_type),
+	LUAA_UFIELD(struct ifmibdata, "physical", ifmd_data.ifi_physical),
+	LUAA_UFIELD(struct ifmibdata, "addrlen", ifmd_data.ifi_addrlen),
+	LUAA_UFIELD(struct ifmibdata, "hdrlen", ifmd_data.ifi_hdrlen),
+	LUAA_UFIELD(struct ifmibdata, "link_state", ifmd_data.ifi_link_state),
+	LUAA_UFIELD(struct ifmibdata, "spare_char1", ifmd_data.ifi_spare_char1),
+	LUAA_UFIELD(struct ifmibdata, "spare_char2", ifmd_data.ifi_spare_char2),
+	LUAA_UFIELD(struct ifmibdata, "datalen", ifmd_data.ifi_datalen),
+	LUAA_UFIELD(struct ifmibdata, "mtu", ifmd_data.ifi_mtu),
+	LUAA_UFIELD(struct ifmibdata, "metric", ifmd_data.ifi_metric),
+	LUAA_UFIELD(struct ifmibdata, "baudrate", ifmd_data.ifi_baudrate),
+	LUAA_UFIELD(struct ifmibdata, "ipackets", ifmd_data.ifi_ipackets),
+	LUAA_UFIELD(struct ifmibdata, "ierrors", ifmd_data.ifi_ierrors),
+	LUAA_UFIELD(struct ifmibdata, "opackets", ifmd_data.ifi_opackets),
+	LUAA_UFIELD(struct ifmibdata, "oerrors", ifmd_data.ifi_oerrors),
+	LUAA_UFIELD(struct ifmibdata, "collisions", ifmd_data.ifi_collisions),
+	LUAA_UFIELD(struct ifmibdata, "ibytes", ifmd_data.ifi_ibytes),
+	LUAA_UFIELD(struct ifmibdata, "obytes", ifmd_data.ifi_obytes),
+	LUAA_UFIELD(struct ifmibdata, "imcasts", ifmd_data.ifi_imcasts),
+	LUAA_UFIELD(struct ifmibdata, "omcasts", ifmd_data.ifi_omcasts),
+	LUAA_UFIELD(struct ifmibdata, "iqdrops", ifmd_data.ifi_iqdrops),
+	LUAA_UFIELD(struct ifmibdata, "noproto", ifmd_data.ifi_noproto),
+	LUAA_UFIELD(struct ifmibdata, "hwassist", ifmd_data.ifi_hwassist),
+	LUAA_IFIELD(struct ifmibdata, "epoch", ifmd_data.ifi_epoch),
+	LUAA_SUBFIELD("lastchange", ft_array, ifmibdata_lastchange),
+};
+
+static const luaA_field_t ifmibdata_fields[] = {
+	LUAA_SFIELD(struct ifmibdata, "name", ifmd_name),
+	LUAA_IFIELD(struct ifmibdata, "pcount", ifmd_pcount),
+	LUAA_IFIELD(struct ifmibdata, "flags", ifmd_flags),
+	LUAA_IFIELD(struct ifmibdata, "snd_len", ifmd_snd_len),
+	LUAA_IFIELD(struct ifmibdata, "snd_drops", ifmd_snd_drops),
+	LUAA_SUBFIELD("data", ft_struct, ifmibdata_data),
+};
+
+static const luaA_field_t xswdev_fields[] = {
+	LUAA_UFIELD(struct xswdev, "version", xsw_version),
+	LUAA_IFIELD(struct xswdev, "flags", xsw_flags),
+	LUAA_IFIELD(struct xswdev, "nblks", xsw_nblks),
+	LUAA_IFIELD(struct xswdev, "used", xsw_used),
+	LUAA_DFIELD(struct xswdev, "dev", xsw_dev),
+};
+
+static const luaA_field_t tcpstat_fields[] = {
+	LUAA_UFIELD(struct tcpstat, "connattempt", tcps_connattempt),
+	LUAA_UFIELD(struct tcpstat, "accepts", tcps_accepts),
+	LUAA_UFIELD(struct tcpstat, "connects", tcps_connects),
+	LUAA_UFIELD(struct tcpstat, "drops", tcps_drops),
+	LUAA_UFIELD(struct tcpstat, "conndrops", tcps_conndrops),
+	LUAA_UFIELD(struct tcpstat, "closed", tcps_closed),
+	LUAA_UFIELD(struct tcpstat, "segstimed", tcps_segstimed),
+	LUAA_UFIELD(struct tcpstat, "rttupdated", tcps_rttupdated),
+	LUAA_UFIELD(struct tcpstat, "delack", tcps_delack),
+	LUAA_UFIELD(struct tcpstat, "timeoutdrop", tcps_timeoutdrop),
+	LUAA_UFIELD(struct tcpstat, "rexmttimeo", tcps_rexmttimeo),
+	LUAA_UFIELD(struct tcpstat, "persisttimeo", tcps_persisttimeo),
+	LUAA_UFIELD(struct tcpstat, "keeptimeo", tcps_keeptimeo),
+	LUAA_UFIELD(struct tcpstat, "keepprobe", tcps_keepprobe),
+	LUAA_UFIELD(struct tcpstat, "keepdrops", tcps_keepdrops),
+	LUAA_UFIELD(struct tcpstat, "sndtotal", tcps_sndtotal),
+	LUAA_UFIELD(struct tcpstat, "sndpack", tcps_sndpack),
+	LUAA_UFIELD(struct tcpstat, "sndbyte", tcps_sndbyte),
+	LUAA_UFIELD(struct tcpstat, "sndrexmitpack", tcps_sndrexmitpack),
+	LUAA_UFIELD(struct tcpstat, "sndrexmitbyte", tcps_sndrexmitbyte),
+	LUAA_UFIELD(struct tcpstat, "sndacks", tcps_sndacks),
+	LUAA_UFIELD(struct tcpstat, "sndprobe", tcps_sndprobe),
+	LUAA_UFIELD(struct tcpstat, "sndurg", tcps_sndurg),
+	LUAA_UFIELD(struct tcpstat, "sndwinup", tcps_sndwinup),
+	LUAA_UFIELD(struct tcpstat, "sndctrl", tcps_sndctrl),
+	LUAA_UFIELD(struct tcpstat, "rcvtotal", tcps_rcvtotal),
+	LUAA_UFIELD(struct tcpstat, "rcvpack", tcps_rcvpack),
+	LUAA_UFIELD(struct tcpstat, "rcvbyte", tcps_rcvbyte),
+	LUAA_UFIELD(struct tcpstat, "rcvbadsum", tcps_rcvbadsum),
+	LUAA_UFIELD(struct tcpstat, "rcvbadoff", tcps_rcvbadoff),
+	LUAA_UFIELD(struct tcpstat, "rcvmemdrop", tcps_rcvmemdrop),
+	LUAA_UFIELD(struct tcpstat, "rcvshort", tcps_rcvshort),
+	LUAA_UFIELD(struct tcpstat, "rcvduppack", tcps_rcvduppack),
+	LUAA_UFIELD(struct tcpstat, "rcvdupbyte", tcps_rcvdupbyte),
+	LUAA_UFIELD(struct tcpstat, "rcvpartduppack", tcps_rcvpartduppack),
+	LUAA_UFIELD(struct tcpstat, "rcvpartdupbyte", tcps_rcvpartdupbyte),
+	LUAA_UFIELD(struct tcpstat, "rcvoopack", tcps_rcvoopack),
+	LUAA_UFIELD(struct tcpstat, "rcvoobyte", tcps_rcvoobyte),
+	LUAA_UFIELD(struct tcpstat, "rcvpackafterwin", tcps_rcvpackafterwin),
+	LUAA_UFIELD(struct tcpstat, "rcvbyteafterwin", tcps_rcvbyteafterwin),
+	LUAA_UFIELD(struct tcpstat, "rcvafterclose", tcps_rcvafterclose),
+	LUAA_UFIELD(struct tcpstat, "rcvwinprobe", tcps_rcvwinprobe),
+	LUAA_UFIELD(struct tcpstat, "rcvdupack", tcps_rcvdupack),
+	LUAA_UFIELD(struct tcpstat, "rcvacktoomuch", tcps_rcvacktoomuch),
+	LUAA_UFIELD(struct tcpstat, "rcvackpack", tcps_rcvackpack),
+	LUAA_UFIELD(struct tcpstat, "rcvackbyte", tcps_rcvackbyte),
+	LUAA_UFIELD(struct tcpstat, "rcvwinupd", tcps_rcvwinupd),
+	LUAA_UFIELD(struct tcpstat, "pawsdrop", tcps_pawsdrop),
+	LUAA_UFIELD(struct tcpstat, "predack", tcps_predack),
+	LUAA_UFIELD(struct tcpstat, "preddat", tcps_preddat),
+};
+
+static const luaA_field_t udpstat_fields[] = {
+	LUAA_UFIELD(struct udpstat, "ipackets", udps_ipackets),
+	LUAA_UFIELD(struct udpstat, "hdrops", udps_hdrops),
+	LUAA_UFIELD(struct udpstat, "badsum", udps_badsum),
+	LUAA_UFIELD(struct udpstat, "nosum", udps_nosum),
+	LUAA_UFIELD(struct udpstat, "badlen", udps_badlen),
+	LUAA_UFIELD(struct udpstat, "noport", udps_noport),
+	LUAA_UFIELD(struct udpstat, "noportbcast", udps_noportbcast),
+	LUAA_UFIELD(struct udpstat, "fullsock", udps_fullsock),
+	LUAA_UFIELD(struct udpstat, "pcbcachemiss", udpps_pcbcachemiss),
+	LUAA_UFIELD(struct udpstat, "pcbhashmiss", udpps_pcbhashmiss),
+	LUAA_UFIELD(struct udpstat, "opackets", udps_opackets),
+	LUAA_UFIELD(struct udpstat, "fastout", udps_fastout),
+	LUAA_UFIELD(struct udpstat, "noportmcast", udps_noportmcast),
+	LUAA_UFIELD(struct udpstat, "filtermcast", udps_filtermcast),
+};
+
+static const luaA_field_t mbstat_fields[] = {
+	LUAA_UFIELD(struct mbstat, "mbufs", m_mbufs),
+	LUAA_UFIELD(struct mbstat, "mclusts", m_mclusts),
+	LUAA_UFIELD(struct mbstat, "drain", m_drain),
+	LUAA_UFIELD(struct mbstat, "mcfail", m_mcfail),
+	LUAA_UFIELD(struct mbstat, "mpfail", m_mpfail),
+	LUAA_UFIELD(struct mbstat, "msize", m_msize),
+	LUAA_UFIELD(struct mbstat, "mclbytes", m_mclbytes),
+	LUAA_UFIELD(struct mbstat, "minclsize", m_minclsize),
+	LUAA_UFIELD(struct mbstat, "mlen", m_mlen),
+	LUAA_UFIELD(struct mbstat, "mhlen", m_mhlen),
+	LUAA_IFIELD(struct mbstat, "numtypes", m_numtypes),
+	LUAA_UFIELD(struct mbstat, "sf_iocnt", sf_iocnt),
+	LUAA_UFIELD(struct mbstat, "sf_allocfail", sf_allocfail),
+	LUAA_UFIELD(struct mbstat, "sf_allocwait", sf_allocwait),
+};
+
+static const luaA_struct_t ipstat_struct = LUAA_STRUCT("ipstat", struct ipstat, ipstat_fields);
+static const luaA_struct_t sctpstat_struct = LUAA_STRUCT("sctpstat", struct sctpstat, sctpstat_fields);
+static const luaA_struct_t vmtotal_struct = LUAA_STRUCT("vmtotal", struct vmtotal, vmtotal_fields);
+static const luaA_struct_t ifmibdata_struct = LUAA_STRUCT("ifmibdata", struct ifmibdata, ifmibdata_fields);
+static const luaA_struct_t xswdev_struct = LUAA_STRUCT("xswdev", struct xswdev, xswdev_fields);
+static const luaA_struct_t tcpstat_struct = LUAA_STRUCT("tcpstat", struct tcpstat, tcpstat_fields);
+static const luaA_struct_t udpstat_struct = LUAA_STRUCT("udpstat", struct udpstat, udpstat_fields);
+static const luaA_struct_t mbstat_struct = LUAA_STRUCT("mbstat", struct mbstat, mbstat_fields);
+
+#endif
+
+/* find descriptor of struct node value, if there's one */
+static const luaA_struct_t*
+sysctl_struct_by_node(sysctl_node_t *node)
+{
+#ifdef __FreeBSD__
+	switch (node->stype) {
+	case st_ipstat:
+		return &ipstat_struct;
+	case st_sctpstat:
+		return &sctpstat_struct;
+	case st_vmtotal:
+		return &vmtotal_struct;
+	case st_tcpstat:
+		return &tcpstat_struct;
+	case st_udpstat:
+		return &udpstat_struct;
+	case st_mbstat:
+		return &mbstat_struct;
+	default:
+		break;
 	}
-	return 1;
+
+	/* opaque nodes are recognized by their oid & size */
+	if (node->mlen > 3 && node->mib[0] == CTL_NET && node->mib[1] == PF_LINK
+		&& node->mib[2] == NETLINK_GENERIC && node->mib[3] == IFMIB_IFDATA
+		&& node->sz == sizeof(struct ifmibdata))
+		return &ifmibdata_struct;
+	if (node->mlen == 3 && node->mib[0] == CTL_VM && node->sz == sizeof(struct xswdev))
+		return &xswdev_struct;
+#endif
+	return NULL;
 }
 
-LUA_SYSCTL_GETTER(ipstat)
-{
-	struct ipstat *value = (struct ipstat*)buf;
-
-	lua_createtable(L, 0, 29);
-
-	luaA_settable(L, -2, "total", number, value->ips_total);
-	luaA_settable(L, -2, "badsum", number, value->ips_badsum);
-	luaA_settable(L, -2, "tooshort", number, value->ips_tooshort);
-	luaA_settable(L, -2, "toosmall", number, value->ips_toosmall);
-	luaA_settable(L, -2, "badhlen", number, value->ips_badhlen);
-	luaA_settable(L, -2, "badlen", number, value->ips_badlen);
-	luaA_settable(L, -2, "fragments", number, value->ips_fragments);
-	luaA_settable(L, -2, "fragdropped", number, value->ips_fragdropped);
-	luaA_settable(L, -2, "fragtimeout", number, value->ips_fragtimeout);
-	luaA_settable(L, -2, "forward", number, value->ips_forward);
-	luaA_settable(L, -2, "fastforward", number, value->ips_fastforward);
-	luaA_settable(L, -2, "cantforward", number, value->ips_cantforward);
-	luaA_settable(L, -2, "redirectsent", number, value->ips_redirectsent);
-	luaA_settable(L, -2, "noproto", number, value->ips_noproto);
-	luaA_settable(L, -2, "delivered", number, value->ips_delivered);
-	luaA_settable(L, -2, "localout", number, value->ips_localout);
-	luaA_settable(L, -2, "odropped", number, value->ips_odropped);
-	luaA_settable(L, -2, "reassembled", number, value->ips_reassembled);
-	luaA_settable(L, -2, "fragmented", number, value->ips_fragmented);
-	luaA_settable(L, -2, "ofragments", number, value->ips_ofragments);
-	luaA_settable(L, -2, "cantfrag", number, value->ips_cantfrag);
-	luaA_settable(L, -2, "badoptions", number, value->ips_badoptions);
-	luaA_settable(L, -2, "noroute", number, value->ips_noroute);
-	luaA_settable(L, -2, "badvers", number, value->ips_badvers);
-	luaA_settable(L, -2, "rawout", number, value->ips_rawout);
-	luaA_settable(L, -2, "toolong", number, value->ips_toolong);
-	luaA_settable(L, -2, "notmember", number, value->ips_notmember);
-	luaA_settable(L, -2, "nogif", number, value->ips_nogif);
-	luaA_settable(L, -2, "badaddr", number, value->ips_badaddr);
+/* }}} */
 
-	return 1;
-}
+/* general purpose getters {{{ */
 
-LUA_SYSCTL_GETTER(sctp)
-{
-
-	struct sctpstat *value = (struct sctpstat*)buf;
-
-	lua_createtable(L, 0, 127);
-
-	luaA_settable(L, -2, "currestab", number, value->sctps_currestab);
-	luaA_settable(L, -2, "activeestab", number, value->sctps_activeestab);
-	luaA_settable(L, -2, "restartestab", number, value->sctps_restartestab);
-	luaA_settable(L, -2, "collisionestab", number, value->sctps_collisionestab);
-	luaA_settable(L, -2, "passiveestab", number, value->sctps_passiveestab);
-	luaA_settable(L, -2, "aborted", number, value->sctps_aborted);
-	luaA_settable(L, -2, "shutdown", number, value->sctps_shutdown);
-	luaA_settable(L, -2, "outoftheblue", number, value->sctps_outoftheblue);
-	luaA_settable(L, -2, "checksumerrors", number, value->sctps_checksumerrors);
-	luaA_settable(L, -2, "outcontrolchunks", number, value->sctps_outcontrolchunks);
-	luaA_settable(L, -2, "outorderchunks", number, value->sctps_outorderchunks);
-	luaA_settable(L, -2, "outunorderchunks", number, value->sctps_outunorderchunks);
-	luaA_settable(L, -2, "incontrolchunks", number, value->sctps_incontrolchunks);
-	luaA_settable(L, -2, "inorderchunks", number, value->sctps_inorderchunks);
-	luaA_settable(L, -2, "inunorderchunks", number, value->sctps_inunorderchunks);
-	luaA_settable(L, -2, "fragusrmsgs", number, value->sctps_fragusrmsgs);
-	luaA_settable(L, -2, "reasmusrmsgs", number, value->sctps_reasmusrmsgs);
-	luaA_settable(L, -2, "outpackets", number, value->sctps_outpackets);
-	luaA_settable(L, -2, "inpackets", number, value->sctps_inpackets);
-	luaA_settable(L, -2, "recvpackets", number, value->sctps_recvpackets);
-	luaA_settable(L, -2, "recvdatagrams", number, value->sctps_recvdatagrams);
-	luaA_settable(L, -2, "recvpktwithdata", number, value->sctps_recvpktwithdata);
-	luaA_settable(L, -2, "recvsacks", number, value->sctps_recvsacks);
-	luaA_settable(L, -2, "recvdata", number, value->sctps_recvdata);
-	luaA_settable(L, -2, "recvdupdata", number, value->sctps_recvdupdata);
-	luaA_settable(L, -2, "recvheartbeat", number, value->sctps_recvheartbeat);
-	luaA_settable(L, -2, "recvheartbeatack", number, value->sctps_recvheartbeatack);
-	luaA_settable(L, -2, "recvecne", number, value->sctps_recvecne);
-	luaA_settable(L, -2, "recvauth", number, value->sctps_recvauth);
-	luaA_settable(L, -2, "recvauthmissing", number, value->sctps_recvauthmissing);
-	luaA_settable(L, -2, "recvivalhmacid", number, value->sctps_recvivalhmacid);
-	luaA_settable(L, -2, "recvivalkeyid", number, value->sctps_recvivalkeyid);
-	luaA_settable(L, -2, "recvauthfailed", number, value->sctps_recvauthfailed);
-	luaA_settable(L, -2, "recvexpress", number, value->sctps_recvexpress);
-	luaA_settable(L, -2, "recvexpressm", number, value->sctps_recvexpressm);
-	luaA_settable(L, -2, "sendpackets", number, value->sctps_sendpackets);
-	luaA_settable(L, -2, "sendsacks", number, value->sctps_sendsacks);
-	luaA_settable(L, -2, "senddata", number, value->sctps_senddata);
-	luaA_settable(L, -2, "sendretransdata", number, value->sctps_sendretransdata);
-	luaA_settable(L, -2, "sendfastretrans", number, value->sctps_sendfastretrans);
-	luaA_settable(L, -2, "sendmultfastretrans", number, value->sctps_sendmultfastretrans);
-	luaA_settable(L, -2, "sendheartbeat", number, value->sctps_sendheartbeat);
-	luaA_settable(L, -2, "sendecne", number, value->sctps_sendecne);
-	luaA_settable(L, -2, "sendauth", number, value->sctps_sendauth);
-	luaA_settable(L, -2, "senderrors", number, value->sctps_senderrors);
-	luaA_settable(L, -2, "pdrpfmbox", number, value->sctps_pdrpfmbox);
-	luaA_settable(L, -2, "pdrpfehos", number, value->sctps_pdrpfehos);
-	luaA_settable(L, -2, "pdrpmbda", number, value->sctps_pdrpmbda);
-	luaA_settable(L, -2, "pdrpmbct", number, value->sctps_pdrpmbct);
-	luaA_settable(L, -2, "pdrpbwrpt", number, value->sctps_pdrpbwrpt);
-	luaA_settable(L, -2, "pdrpcrupt", number, value->sctps_pdrpcrupt);
-	luaA_settable(L, -2, "pdrpnedat", number, value->sctps_pdrpnedat);
-	luaA_settable(L, -2, "pdrppdbrk", number, value->sctps_pdrppdbrk);
-	luaA_settable(L, -2, "pdrptsnnf", number, value->sctps_pdrptsnnf);
-	luaA_settable(L, -2, "pdrpdnfnd", number, value->sctps_pdrpdnfnd);
-	luaA_settable(L, -2, "pdrpdiwnp", number, value->sctps_pdrpdiwnp);
-	luaA_settable(L, -2, "pdrpdizrw", number, value->sctps_pdrpdizrw);
-	luaA_settable(L, -2, "pdrpbadd", number, value->sctps_pdrpbadd);
-	luaA_settable(L, -2, "pdrpmark", number, value->sctps_pdrpmark);
-	luaA_settable(L, -2, "timoiterator", number, value->sctps_timoiterator);
-	luaA_settable(L, -2, "timodata", number, value->sctps_timodata);
-	luaA_settable(L, -2, "timowindowprobe", number, value->sctps_timowindowprobe);
-	luaA_settable(L, -2, "timoinit", number, value->sctps_timoinit);
-	luaA_settable(L, -2, "timosack", number, value->sctps_timosack);
-	luaA_settable(L, -2, "timoshutdown", number, value->sctps_timoshutdown);
-	luaA_settable(L, -2, "timoheartbeat", number, value->sctps_timoheartbeat);
-	luaA_settable(L, -2, "timocookie", number, value->sctps_timocookie);
-	luaA_settable(L, -2, "timosecret", number, value->sctps_timosecret);
-	luaA_settable(L, -2, "timopathmtu", number, value->sctps_timopathmtu);
-	luaA_settable(L, -2, "timoshutdownack", number, value->sctps_timoshutdownack);
-	luaA_settable(L, -2, "timoshutdownguard", number, value->sctps_timoshutdownguard);
-	luaA_settable(L, -2, "timostrmrst", number, value->sctps_timostrmrst);
-	luaA_settable(L, -2, "timoearlyfr", number, value->sctps_timoearlyfr);
-	luaA_settable(L, -2, "timoasconf", number, value->sctps_timoasconf);
-	luaA_settable(L, -2, "timodelprim", number, value->sctps_timodelprim);
-	luaA_settable(L, -2, "timoautoclose", number, value->sctps_timoautoclose);
-	luaA_settable(L, -2, "timoassockill", number, value->sctps_timoassockill);
-	luaA_settable(L, -2, "timoinpkill", number, value->sctps_timoinpkill);
-	luaA_settable(L, -2, "earlyfrstart", number, value->sctps_earlyfrstart);
-	luaA_settable(L, -2, "earlyfrstop", number, value->sctps_earlyfrstop);
-	luaA_settable(L, -2, "earlyfrmrkretrans", number, value->sctps_earlyfrmrkretrans);
-	luaA_settable(L, -2, "earlyfrstpout", number, value->sctps_earlyfrstpout);
-	luaA_settable(L, -2, "earlyfrstpidsck1", number, value->sctps_earlyfrstpidsck1);
-	luaA_settable(L, -2, "earlyfrstpidsck2", number, value->sctps_earlyfrstpidsck2);
-	luaA_settable(L, -2, "earlyfrstpidsck3", number, value->sctps_earlyfrstpidsck3);
-	luaA_settable(L, -2, "earlyfrstpidsck4", number, value->sctps_earlyfrstpidsck4);
-	luaA_settable(L, -2, "earlyfrstrid", number, value->sctps_earlyfrstrid);
-	luaA_settable(L, -2, "earlyfrstrout", number, value->sctps_earlyfrstrout);
-	luaA_settable(L, -2, "earlyfrstrtmr", number, value->sctps_earlyfrstrtmr);
-	luaA_settable(L, -2, "hdrops", number, value->sctps_hdrops);
-	luaA_settable(L, -2, "badsum", number, value->sctps_badsum);
-	luaA_settable(L, -2, "noport", number, value->sctps_noport);
-	luaA_settable(L, -2, "badvtag", number, value->sctps_badvtag);
-	luaA_settable(L, -2, "badsid", number, value->sctps_badsid);
-	luaA_settable(L, -2, "nomem", number, value->sctps_nomem);
-	luaA_settable(L, -2, "fastretransinrtt", number, value->sctps_fastretransinrtt);
-	luaA_settable(L, -2, "markedretrans", number, value->sctps_markedretrans);
-	luaA_settable(L, -2, "naglesent", number, value->sctps_naglesent);
-	luaA_settable(L, -2, "naglequeued", number, value->sctps_naglequeued);
-	luaA_settable(L, -2, "maxburstqueued", number, value->sctps_maxburstqueued);
-	luaA_settable(L, -2, "ifnomemqueued", number, value->sctps_ifnomemqueued);
-	luaA_settable(L, -2, "windowprobed", number, value->sctps_windowprobed);
-	luaA_settable(L, -2, "lowlevelerr", number, value->sctps_lowlevelerr);
-	luaA_settable(L, -2, "lowlevelerrusr", number, value->sctps_lowlevelerrusr);
-	luaA_settable(L, -2, "datadropchklmt", number, value->sctps_datadropchklmt);
-	luaA_settable(L, -2, "datadroprwnd", number, value->sctps_datadroprwnd);
-	luaA_settable(L, -2, "ecnereducedcwnd", number, value->sctps_ecnereducedcwnd);
-	luaA_settable(L, -2, "vtagexpress", number, value->sctps_vtagexpress);
-	luaA_settable(L, -2, "vtagbogus", number, value->sctps_vtagbogus);
-	luaA_settable(L, -2, "primary_randry", number, value->sctps_primary_randry);
-	luaA_settable(L, -2, "cmt_randry", number, value->sctps_cmt_randry);
-	luaA_settable(L, -2, "slowpath_sack", number, value->sctps_slowpath_sack);
-	luaA_settable(L, -2, "wu_sacks_sent", number, value->sctps_wu_sacks_sent);
-	luaA_settable(L, -2, "sends_with_flags", number, value->sctps_sends_with_flags);
-	luaA_settable(L, -2, "sends_with_unord", number, value->sctps_sends_with_unord);
-	luaA_settable(L, -2, "sends_with_eof", number, value->sctps_sends_with_eof);
-	luaA_settable(L, -2, "sends_with_abort", number, value->sctps_sends_with_abort);
-	luaA_settable(L, -2, "protocol_drain_calls", number, value->sctps_protocol_drain_calls);
-	luaA_settable(L, -2, "protocol_drains_done", number, value->sctps_protocol_drains_done);
-	luaA_settable(L, -2, "read_peeks", number, value->sctps_read_peeks);
-	luaA_settable(L, -2, "cached_chk", number, value->sctps_cached_chk);
-	luaA_settable(L, -2, "cached_strmoq", number, value->sctps_cached_strmoq);
-	luaA_settable(L, -2, "left_abandon", number, value->sctps_left_abandon);
-	luaA_settable(L, -2, "send_burst_avoid", number, value->sctps_send_burst_avoid);
-	luaA_settable(L, -2, "send_cwnd_avoid", number, value->sctps_send_cwnd_avoid);
-	luaA_settable(L, -2, "fwdtsn_map_over", number, value->sctps_fwdtsn_map_over);
-
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, value->sctps_discontinuitytime.tv_sec);
-	luaA_isettable(L, -2, 2, number, value->sctps_discontinuitytime.tv_usec);
-
-	lua_setfield(L, -2, "discontinuitytime");
+#define LUA_SYSCTL_GETTER(suffx) \
+	static int luaA_sysctl_get##suffx (lua_State *L, void *buf, size_t sz)
+
+#define NUMERIC_GETTER(suffx, type) \
+	LUA_SYSCTL_GETTER(suffx) { \
+		int i, n; \
+		type *value = (type *)buf; \
+		n = sz / sizeof(type); \
+		for (i = 0; i < n; i++) \
+			lua_pushnumber(L, value[i]); \
+		return n; \
+	}
+
+#define NIL_GETTER(suffx) \
+	LUA_SYSCTL_GETTER(suffx) { \
+		return 0; }
 
+NUMERIC_GETTER(int, int)
+NUMERIC_GETTER(uint, unsigned int)
+NUMERIC_GETTER(long, long)
+NUMERIC_GETTER(ulong, unsigned long)
+NUMERIC_GETTER(quad, quad_t)
+
+NIL_GETTER(struct)
+
+/* node userdata at idx, NULL if it's anything else (e.g. sampler calling getter) */
+static sysctl_node_t*
+luaA_sysctl_tonode(lua_State *L, int idx)
+{
+	void *node = lua_touserdata(L, idx);
+
+	if (node == NULL || !lua_getmetatable(L, idx))
+		return NULL;
+	luaL_getmetatable(L, "sysctl_node");
+	if (!lua_rawequal(L, -1, -2))
+		node = NULL;
+	lua_pop(L, 2);
+	return node;
+}
+
+LUA_SYSCTL_GETTER(node)
+{
+#ifdef __FreeBSD__
+	sysctl_node_t *node = luaA_sysctl_tonode(L, 1);
+	const luaA_struct_t *st;
+	/* do some heuristics */
+	if (node && (st = sysctl_struct_by_node(node)) && sz == st->size)
+		return luaA_struct_push(L, st, buf);
+#endif
+	lua_pushlstring(L, (char *)buf, sz - 1);
 	return 1;
 }
 
+#define STRUCT_GETTER(suffx, st) \
+	LUA_SYSCTL_GETTER(suffx) { \
+		return luaA_struct_push(L, &st, buf); }
+
+#ifdef __FreeBSD__
+STRUCT_GETTER(ipstat, ipstat_struct)
+STRUCT_GETTER(sctp, sctpstat_struct)
+STRUCT_GETTER(vmtotal, vmtotal_struct)
+STRUCT_GETTER(tcpstat, tcpstat_struct)
+STRUCT_GETTER(udpstat, udpstat_struct)
+STRUCT_GETTER(mbstat, mbstat_struct)
+#endif
+
 LUA_SYSCTL_GETTER(string)
 {
 	/*char *value = (char*)buf;*/
@@ -587,44 +1448,6 @@ LUA_SYSCTL_GETTER(loadavg)
 	return 3;
 }
 
-LUA_SYSCTL_GETTER(vmtotal)
-{
-	struct vmtotal *value = (struct vmtotal*)buf;
-	int pagesize = getpagesize();
-
-	lua_createtable(L, 0, 12);
-
-	luaA_settable(L, -2, "runq", number, value->t_rq);
-	luaA_settable(L, -2, "diskw", number, value->t_dw);
-	luaA_settable(L, -2, "pagew", number, value->t_pw);
-	luaA_settable(L, -2, "sleep", number, value->t_sl);
-
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, value->t_vm);
-	luaA_isettable(L, -2, 2, number, value->t_avm);
-	lua_setfield(L, -2, "vmem");
-
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, value->t_rm);
-	luaA_isettable(L, -2, 2, number, value->t_arm);
-	lua_setfield(L, -2, "rmem");
-
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, value->t_vmshr);
-	luaA_isettable(L, -2, 2, number, value->t_avmshr);
-	lua_setfield(L, -2, "vsmem");
-
-	lua_createtable(L, 2, 0);
-	luaA_isettable(L, -2, 1, number, value->t_rmshr);
-	luaA_isettable(L, -2, 2, number, value->t_armshr);
-	lua_setfield(L, -2, "rsmem");
-
-	luaA_settable(L, -2, "free", number, value->t_free);
-
-	luaA_settable(L, -2, "pagesz", number, pagesize);
-	return 1;
-}
-
 LUA_SYSCTL_GETTER(dev)
 {
 	dev_t *value = (dev_t*)buf;
@@ -633,6 +1456,55 @@ LUA_SYSCTL_GETTER(dev)
 	return 2;
 }
 
+/* pack n values on top of stack into array table */
+static void
+luaA_sysctl_packvalues(lua_State *L, int n)
+{
+	int i;
+	lua_createtable(L, n, 0);
+	lua_insert(L, -(n + 1));
+	for (i = n; i > 0; i--)
+		lua_rawseti(L, -(i + 1), i);
+}
+
+/*
+ * fill packed array at idx (or new one) with numeric values
+ * from raw buffer according to format, array is left on top
+ */
+static int
+luaA_sysctl_pusharray(lua_State *L, const char *fmt, void *buf, size_t sz, int idx)
+{
+	luaA_array_t *arr;
+	int unsign = fmt[1] == 'U';
+
+	switch (fmt[0]) {
+	case 'I':
+		if (fmt[1] == 'K') return 0;
+		arr = luaA_array_reuse(L, idx, sz / sizeof(int));
+		if (unsign)
+			luaA_array_filluint(arr, buf, sz / sizeof(int));
+		else
+			luaA_array_fillint(arr, buf, sz / sizeof(int));
+		return 1;
+	case 'L':
+		arr = luaA_array_reuse(L, idx, sz / sizeof(long));
+		if (unsign)
+			luaA_array_fillulong(arr, buf, sz / sizeof(long));
+		else
+			luaA_array_filllong(arr, buf, sz / sizeof(long));
+		return 1;
+	case 'Q':
+		arr = luaA_array_reuse(L, idx, sz / sizeof(int64_t));
+		if (unsign)
+			luaA_array_filluint64(arr, buf, sz / sizeof(int64_t));
+		else
+			luaA_array_fillint64(arr, buf, sz / sizeof(int64_t));
+		return 1;
+	}
+
+	return 0;
+}
+
 /* }}} */
 
 /* general purpose setters {{{ */
@@ -643,7 +1515,7 @@ LUA_SYSCTL_GETTER(dev)
 #define NUMERIC_SETTER(suffx, type) \
 	LUA_SYSCTL_SETTER(suffx) { \
 		type value = luaL_checknumber(L, validx); \
-		if (sysctl(node->mib, node->mlen, NULL, 0, &value, sizeof(type))) return 0; \
+		if (sysctl_call(node->mib, node->mlen, NULL, 0, &value, sizeof(type))) return 0; \
 		lua_pushboolean(L, 1); \
 		return 1; \
 	}
@@ -665,7 +1537,7 @@ LUA_SYSCTL_SETTER(string)
 {
 	size_t strsz;
 	const char *value = luaL_checklstring(L, validx, &strsz);
-	if (sysctl(node->mib, node->mlen, NULL, 0, (void *)value, strsz)) return 0;
+	if (sysctl_call(node->mib, node->mlen, NULL, 0, (void *)value, strsz)) return 0;
 	lua_pushboolean(L, 1);
 	return 1;
 }
@@ -711,17 +1583,28 @@ get_getter_by_type(int type, char* fmt, st_type_t stype)
 				return luaA_sysctl_getclock;
 			case st_timeval:
 				return luaA_sysctl_gettime;
-			case st_vmtotal:
-				return luaA_sysctl_getvmtotal;
 			case st_dev:
 				return luaA_sysctl_getdev;
+#ifdef __FreeBSD__
+			case st_vmtotal:
+				return luaA_sysctl_getvmtotal;
 			case st_sctpstat:
 				return luaA_sysctl_getsctp;
 			case st_ipstat:
 				return luaA_sysctl_getipstat;
+			case st_tcpstat:
+				return luaA_sysctl_gettcpstat;
+			case st_udpstat:
+				return luaA_sysctl_getudpstat;
+			case st_mbstat:
+				return luaA_sysctl_getmbstat;
+#endif
 			case st_loadavg:
 				return luaA_sysctl_getloadavg;
+			default:
+				break;
 			}
+			/* FALLTHROUGH */
 		default:
 			return luaA_sysctl_getstruct;
 		}
@@ -771,6 +1654,20 @@ get_setter_by_type(int type, char* fmt, st_type_t stype)
 	return NULL;
 }
 
+/* ctl type for format string, for nodes which don't come from kernel */
+static u_int
+sysctl_kind_by_fmt(const char *fmt)
+{
+	switch (*fmt) {
+	case 'N': return CTLTYPE_NODE;
+	case 'A': return CTLTYPE_STRING;
+	case 'I': return fmt[1] == 'U'? CTLTYPE_UINT: CTLTYPE_INT;
+	case 'L': return fmt[1] == 'U'? CTLTYPE_ULONG: CTLTYPE_LONG;
+	case 'Q': return CTLTYPE_QUAD;
+	default: return CTLTYPE_OPAQUE;
+	}
+}
+
 static int
 sysctl_newnode(sysctl_node_t **node, const char* nodename)
 {
@@ -785,35 +1682,2668 @@ sysctl_newnode(sysctl_node_t **node, const char* nodename)
 		freeonerr = 1;
 	}
 
-	if (nodename && sysctl_mib(*node, nodename) || sysctl_type(*node, &flags)) {
-		warn("node population failed in sysctl_newnode(%s)", nodename);
-		if (freeonerr) {
-			free(*node);
-		 	*node = NULL;
-			warn("buffer freed in sysctl_newnode(%s)", nodename);
-		}
-		return (-1);
+	if (nodename && sysctl_mib(*node, nodename) || sysctl_type(*node, &flags)) {
+		warn("node population failed in sysctl_newnode(%s)", nodename);
+		if (freeonerr) {
+			free(*node);
+		 	*node = NULL;
+			warn("buffer freed in sysctl_newnode(%s)", nodename);
+		}
+		return (-1);
+	}
+
+	(*node)->sz = 0;
+	sysctl_call((*node)->mib, (*node)->mlen, NULL, &((*node)->sz), NULL, 0); /* prefetch size */
+	(*node)->getter = (flags & CTLFLAG_RD)? get_getter_by_type((*node)->type, (*node)->fmt, (*node)->stype): NULL;
+	(*node)->setter = (flags & CTLFLAG_WR)? get_setter_by_type((*node)->type, (*node)->fmt, (*node)->stype): NULL;
+
+	return (0);
+}
+/* }}} */
+
+/* name resolution cache {{{ */
+
+/*
+ * Process-wide cache of resolved nodes keyed by symbolic name, so
+ * sysctl.get/set with a name skips name2oid, oidfmt and size probe
+ * syscalls after the first call. Cached size is the last known one,
+ * it's updated by every sysctl_get.
+ */
+#define SYSCTL_CACHE_BUCKETS 256
+
+typedef struct sysctl_cache_entry_t {
+	struct sysctl_cache_entry_t *next;
+	sysctl_node_t node;
+	char name[1];
+} sysctl_cache_entry_t;
+
+static sysctl_cache_entry_t *sysctl_cache[SYSCTL_CACHE_BUCKETS];
+static unsigned long sysctl_cache_hits = 0, sysctl_cache_misses = 0;
+static size_t sysctl_cache_size = 0;
+
+static unsigned int
+sysctl_cache_hash(const char *name)
+{
+	unsigned int h = 5381;
+	while (*name)
+		h = h * 33 + (u_char)*name++;
+	return h % SYSCTL_CACHE_BUCKETS;
+}
+
+/* get node by name, resolving and caching it on miss */
+static sysctl_node_t*
+sysctl_cache_lookup(const char *name)
+{
+	unsigned int h = sysctl_cache_hash(name);
+	sysctl_cache_entry_t *entry;
+	sysctl_node_t *node;
+
+	for (entry = sysctl_cache[h]; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0) {
+			sysctl_cache_hits++;
+			return &entry->node;
+		}
+	}
+	sysctl_cache_misses++;
+
+	if ((entry = malloc(sizeof(sysctl_cache_entry_t) + strlen(name))) == NULL) {
+		warn("malloc failed in sysctl_cache_lookup(%s)", name);
+		return NULL;
+	}
+
+	node = &entry->node;
+	if (sysctl_newnode(&node, name)) {
+		free(entry);
+		return NULL;
+	}
+
+	strcpy(entry->name, name);
+	entry->next = sysctl_cache[h];
+	sysctl_cache[h] = entry;
+	sysctl_cache_size++;
+
+	return node;
+}
+
+/* forget single node, e.g. when its oid went stale */
+static void
+sysctl_cache_drop(const char *name)
+{
+	sysctl_cache_entry_t **entry, *found;
+
+	for (entry = &sysctl_cache[sysctl_cache_hash(name)]; *entry; entry = &(*entry)->next) {
+		if (strcmp((*entry)->name, name) == 0) {
+			found = *entry;
+			*entry = found->next;
+			free(found);
+			sysctl_cache_size--;
+			return;
+		}
+	}
+}
+
+static void
+sysctl_cache_flush(void)
+{
+	sysctl_cache_entry_t *entry, *next;
+	int i;
+
+	for (i = 0; i < SYSCTL_CACHE_BUCKETS; i++) {
+		for (entry = sysctl_cache[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+		sysctl_cache[i] = NULL;
+	}
+	sysctl_cache_size = 0;
+}
+
+/* read node value by name into scratch buffer, re-resolving once if cached oid failed */
+static void*
+sysctl_cache_get(const char *name, sysctl_node_t **node)
+{
+	void *buf = NULL;
+
+	if ((*node = sysctl_cache_lookup(name)) && (*node)->getter
+		&& (buf = sysctl_get_scratch(*node)) == NULL) {
+		sysctl_cache_drop(name);
+		if ((*node = sysctl_cache_lookup(name)) && (*node)->getter)
+			buf = sysctl_get_scratch(*node);
+	}
+
+	return buf;
+}
+
+/* push new node userdata, copied from cached node */
+static sysctl_node_t*
+luaA_sysctl_pushnode(lua_State *L, const char *name)
+{
+	sysctl_node_t *cached, *node;
+
+	if ((cached = sysctl_cache_lookup(name)) == NULL)
+		return NULL;
+
+	node = lua_newuserdata(L, sizeof(sysctl_node_t));
+	memcpy(node, cached, sizeof(sysctl_node_t));
+
+	luaL_getmetatable(L, "sysctl_node");
+	lua_setmetatable(L, -2);
+	return node;
+}
+/* }}} */
+
+/* node metadata cache {{{ */
+
+/*
+ * Names, descriptions and formats never change for given OID, so they are
+ * fetched once and kept as Lua strings in a registry table keyed by raw
+ * OID bytes: { [oid] = { name = ..., desc = ..., format = ... } }.
+ * Every field is fetched on first use, sysctl.describe() fills whole
+ * subtree at once.
+ */
+static const char sysctl_meta_key = 'm';
+
+/* push metadata record of node, creating it if needed */
+static void
+luaA_sysctl_pushmeta(lua_State *L, const sysctl_node_t *node)
+{
+	lua_pushlightuserdata(L, (void *)&sysctl_meta_key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushlightuserdata(L, (void *)&sysctl_meta_key);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+
+	lua_pushlstring(L, (const char *)node->mib, node->mlen * sizeof(int));
+	lua_rawget(L, -2);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 3);
+		lua_pushlstring(L, (const char *)node->mib, node->mlen * sizeof(int));
+		lua_pushvalue(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_remove(L, -2);
+}
+
+/* fetch metadata field from kernel */
+static char*
+sysctl_meta_fetch(sysctl_node_t *node, sysctl_meta_t meta)
+{
+	char *info = sysctl_info(node, meta);
+
+	/* oidfmt is kind followed by format string */
+	if (info && meta == sm_type)
+		memmove(info, info + sizeof(u_int), strlen(info + sizeof(u_int)) + 1);
+	return info;
+}
+
+/* push cached name, desc or format of node */
+static int
+luaA_sysctl_pushinfo(lua_State *L, sysctl_node_t *node, const char *field, sysctl_meta_t meta)
+{
+	char *info;
+
+	luaA_sysctl_pushmeta(L, node);
+	lua_getfield(L, -1, field);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		if ((info = sysctl_meta_fetch(node, meta)) == NULL) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		lua_pushstring(L, info);
+		free(info);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -3, field);
+	}
+	lua_remove(L, -2);
+	return 1;
+}
+
+#define luaA_sysctl_pushname(L, node) luaA_sysctl_pushinfo(L, node, "name", sm_name)
+#define luaA_sysctl_pushdesc(L, node) luaA_sysctl_pushinfo(L, node, "desc", sm_desc)
+#define luaA_sysctl_pushformat(L, node) luaA_sysctl_pushinfo(L, node, "format", sm_type)
+
+/* forget all metadata, OIDs may be reused (fake tree rebuilt) */
+static void
+luaA_sysctl_flushmeta(lua_State *L)
+{
+	lua_pushlightuserdata(L, (void *)&sysctl_meta_key);
+	lua_pushnil(L);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+/* }}} */
+
+/* tree index {{{ */
+
+/*
+ * Whole tree snapshot for searching nodes without asking kernel:
+ * entries sorted by name, names & formats live in one arena. Matches
+ * are resolved by name through cache, so OIDs aren't kept (snapshots
+ * have none anyway). It's built once with sysctl.index() and rebuilt
+ * only when asked to.
+ */
+typedef struct sysctl_index_entry_t {
+	uint32_t name;
+	uint32_t fmt;
+	u_int kind;
+} sysctl_index_entry_t;
+
+typedef struct sysctl_index_t {
+	sysctl_index_entry_t *entries;
+	size_t nentries, maxentries;
+	char *names;
+	size_t namesz, maxnamesz;
+} sysctl_index_t;
+
+static sysctl_index_t sysctl_idx;
+
+static void
+sysctl_index_clear(void)
+{
+	free(sysctl_idx.entries);
+	free(sysctl_idx.names);
+	memset(&sysctl_idx, 0, sizeof(sysctl_index_t));
+}
+
+/* grow array to hold at least need items */
+static int
+sysctl_index_grow(void **ptr, size_t *max, size_t need, size_t itemsz)
+{
+	size_t newmax = *max? *max: 256;
+	void *newptr;
+
+	if (need <= *max) return (0);
+	while (newmax < need) newmax *= 2;
+	if ((newptr = realloc(*ptr, newmax * itemsz)) == NULL) {
+		warn("realloc failed in sysctl_index_grow");
+		return (-1);
+	}
+	*ptr = newptr;
+	*max = newmax;
+	return (0);
+}
+
+static uint32_t
+sysctl_index_addstr(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint32_t offset = sysctl_idx.namesz;
+
+	if (sysctl_index_grow((void **)&sysctl_idx.names, &sysctl_idx.maxnamesz, sysctl_idx.namesz + len, 1))
+		return (uint32_t)-1;
+	memcpy(sysctl_idx.names + offset, str, len);
+	sysctl_idx.namesz += len;
+	return offset;
+}
+
+static int
+sysctl_index_add(const char *name, const char *fmt, u_int kind)
+{
+	sysctl_index_entry_t *entry;
+
+	if (sysctl_index_grow((void **)&sysctl_idx.entries, &sysctl_idx.maxentries, sysctl_idx.nentries + 1, sizeof(sysctl_index_entry_t)))
+		return (-1);
+
+	entry = &sysctl_idx.entries[sysctl_idx.nentries];
+	if ((entry->name = sysctl_index_addstr(name)) == (uint32_t)-1
+		|| (entry->fmt = sysctl_index_addstr(fmt)) == (uint32_t)-1)
+		return (-1);
+	entry->kind = kind;
+	sysctl_idx.nentries++;
+	return (0);
+}
+
+static int
+sysctl_index_cmp(const void *a, const void *b)
+{
+	return strcmp(sysctl_idx.names + ((const sysctl_index_entry_t *)a)->name,
+		sysctl_idx.names + ((const sysctl_index_entry_t *)b)->name);
+}
+
+static void
+sysctl_index_sort(void)
+{
+	qsort(sysctl_idx.entries, sysctl_idx.nentries, sizeof(sysctl_index_entry_t), sysctl_index_cmp);
+}
+
+/* walk whole tree, one name & one oidfmt query per node */
+static int
+sysctl_index_build(void)
+{
+	sysctl_node_t node;
+	char *name, *type;
+	int result = 0;
+
+	sysctl_index_clear();
+	if (sysctl_first(&node)) return (-1);
+
+	do {
+		if ((name = sysctl_info(&node, sm_name)) == NULL)
+			continue;
+		if ((type = sysctl_info(&node, sm_type)) != NULL) {
+			result = sysctl_index_add(name, type + sizeof(u_int), *(u_int *)type);
+			free(type);
+		}
+		free(name);
+	} while (result == 0 && sysctl_next(&node) == 0);
+
+	sysctl_index_sort();
+	return result;
+}
+
+/* first entry with name not less than given */
+static size_t
+sysctl_index_lower_bound(const char *name, size_t len)
+{
+	size_t lo = 0, hi = sysctl_idx.nentries, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(sysctl_idx.names + sysctl_idx.entries[mid].name, name, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * match name against pattern: '*' matches any part of one name
+ * component, '?' matches one char; pattern matches whole subtree,
+ * so "dev.cpu" or "dev.*.0" both match "dev.cpu.0.freq", pattern
+ * ending with "." ("dev.cpu.") matches only nodes below it
+ */
+static int
+sysctl_glob(const char *pat, const char *str)
+{
+	const char *star = NULL, *mark = NULL;
+
+	while (*str) {
+		if ((*pat == '\0' || (*pat == '.' && pat[1] == '\0')) && *str == '.')
+			return 1;
+		if (*pat == '*') {
+			star = pat++;
+			mark = str;
+		} else if (*pat == *str || (*pat == '?' && *str != '.')) {
+			pat++;
+			str++;
+		} else if (star && *mark != '.') {
+			pat = star + 1;
+			str = ++mark;
+		} else {
+			return 0;
+		}
+	}
+	while (*pat == '*') pat++;
+	return *pat == '\0';
+}
+
+/* }}} */
+
+/* sysctl struct view methods {{{ */
+
+/*
+ * Struct view keeps raw struct value as read from kernel and decodes
+ * fields only when they are indexed. It's driven by the same struct
+ * descriptors as getters (see sysctl_struct_by_node), so view:totable()
+ * equals node:get() and every described struct gets a view. Its
+ * environment is the descriptor's interned key table, mapping field
+ * names to descriptor indexes.
+ */
+typedef struct sysctl_view_t {
+	const luaA_struct_t *st;
+	u_char data[1];
+} sysctl_view_t;
+
+/* push struct view of node value, or plain value if node isn't a known struct */
+static int
+luaA_sysctl_pushview(lua_State *L, sysctl_node_t *node)
+{
+	const luaA_struct_t *st;
+	sysctl_view_t *view;
+	size_t sz;
+	void *buf;
+
+	if (node->getter == NULL) return 0;
+
+	if ((st = sysctl_struct_by_node(node)) != NULL) {
+		/* read right into userdata, no intermediate buffer */
+		view = lua_newuserdata(L, offsetof(sysctl_view_t, data) + st->size);
+		sz = st->size;
+		if (sysctl_call(node->mib, node->mlen, view->data, &sz, NULL, 0) == 0 && sz == st->size) {
+			view->st = st;
+			luaA_struct_pushkeys(L, st->fields, st->nfields);
+			lua_setfenv(L, -2);
+			luaL_getmetatable(L, "sysctl_view");
+			lua_setmetatable(L, -2);
+			return 1;
+		}
+		lua_pop(L, 1);
+	}
+
+	if ((buf = sysctl_get_scratch(node)) == NULL)
+		return 0;
+	return node->getter(L, buf, node->sz);
+}
+
+#define SYSCTL_VIEW_METHOD(name) LUAA_FUNC(sysctl_view_##name)
+
+SYSCTL_VIEW_METHOD(index)
+{
+	sysctl_view_t *view;
+	int i;
+
+	luaA_checkmetaindex(L, "sysctl_view");
+
+	view = luaL_checkudata(L, 1, "sysctl_view");
+	lua_getfenv(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+	if (!lua_isnumber(L, -1))
+		return 0;
+
+	i = lua_tonumber(L, -1);
+	luaA_struct_pushfield(L, &view->st->fields[i], view->data);
+	return 1;
+}
+
+SYSCTL_VIEW_METHOD(totable)
+{
+	sysctl_view_t *view = luaL_checkudata(L, 1, "sysctl_view");
+	return luaA_struct_push(L, view->st, view->data);
+}
+
+SYSCTL_VIEW_METHOD(tostring)
+{
+	sysctl_view_t *view = luaL_checkudata(L, 1, "sysctl_view");
+	lua_pushfstring(L, "[udata sysctl_view(%s)]", view->st->name);
+	return 1;
+}
+
+/* }}} */
+
+/* compiled accessors {{{ */
+
+/*
+ * Compiled accessor is a C closure with everything needed to read node
+ * resolved in advance: inline mib, getter and read buffer. Hot path call
+ * is just one sysctl(3) and decoding, buffer is only grown if value
+ * doesn't fit it anymore.
+ */
+typedef struct sysctl_compiled_t {
+	int mib[CTL_MAXNAME];
+	size_t mlen;
+	sysctl_node_getter_t getter;
+	const luaA_struct_t *st;
+	char fmt[2];
+	size_t bufsz;
+	void *buf;
+} sysctl_compiled_t;
+
+static int
+luaA_sysctl_compiled_call(lua_State *L)
+{
+	sysctl_compiled_t *cc = lua_touserdata(L, lua_upvalueindex(1));
+	size_t sz = cc->bufsz;
+	void *buf;
+
+	while (sysctl_call(cc->mib, cc->mlen, cc->buf, &sz, NULL, 0)) {
+		if (errno != ENOMEM) return 0;
+		if ((buf = realloc(cc->buf, cc->bufsz * 2)) == NULL) return 0;
+		cc->buf = buf;
+		cc->bufsz *= 2;
+		sz = cc->bufsz;
+	}
+
+	if (cc->st && sz == cc->st->size)
+		return luaA_struct_push(L, cc->st, cc->buf);
+	/* refill packed array passed as argument */
+	if (lua_isuserdata(L, 1))
+		return luaA_sysctl_pusharray(L, cc->fmt, cc->buf, sz, 1);
+	/* numeric arrays push one value per item */
+	if (strchr("ILQ", cc->fmt[0]))
+		luaL_checkstack(L, sz / sizeof(int) + LUA_MINSTACK, "too many values");
+	return cc->getter(L, cc->buf, sz);
+}
+
+/* push compiled accessor closure for node */
+static int
+luaA_sysctl_pushcompiled(lua_State *L, sysctl_node_t *node)
+{
+	sysctl_compiled_t *cc;
+
+	if (node->getter == NULL) return 0;
+
+	cc = lua_newuserdata(L, sizeof(sysctl_compiled_t));
+	memcpy(cc->mib, node->mib, node->mlen * sizeof(int));
+	cc->mlen = node->mlen;
+	cc->getter = node->getter;
+	cc->st = sysctl_struct_by_node(node);
+	memcpy(cc->fmt, node->fmt, sizeof(cc->fmt));
+	cc->bufsz = node->sz + (node->sz >> 2);
+	if (cc->bufsz < 16) cc->bufsz = 16;
+	if ((cc->buf = malloc(cc->bufsz)) == NULL) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	luaL_getmetatable(L, "sysctl_compiled");
+	lua_setmetatable(L, -2);
+
+	lua_pushcclosure(L, luaA_sysctl_compiled_call, 1);
+	return 1;
+}
+
+static int
+luaA_sysctl_compiled_gc(lua_State *L)
+{
+	sysctl_compiled_t *cc = luaL_checkudata(L, 1, "sysctl_compiled");
+	free(cc->buf);
+	return 0;
+}
+
+/* }}} */
+
+/* background sampler {{{ */
+
+/*
+ * Sampler reads fixed set of nodes from its own thread. Every sample is
+ * written into back buffer, then buffers are swapped by publishing new
+ * front index. Readers copy front buffer out without any syscall or lock,
+ * each buffer carries sequence number (odd while being written), so
+ * reader just retries copy in the rare case writer got back to the same
+ * buffer in the middle of it. Nodes are resolved once on creation, so
+ * fake tree must not be replaced while sampler is running.
+ */
+typedef struct sysctl_sample_slot_t {
+	size_t len;
+	int error;
+} sysctl_sample_slot_t;
+
+typedef struct sysctl_sample_buf_t {
+	unsigned seq;
+	double time;
+	sysctl_sample_slot_t *slots;
+	u_char *data;
+} sysctl_sample_buf_t;
+
+typedef struct sysctl_sampler_t {
+	size_t nnodes;
+	sysctl_node_t *nodes;
+	size_t *offsets;
+	size_t datasz;
+	sysctl_sample_buf_t bufs[2];
+	int front;
+	/* some value outgrew its slot, reader lays slots out again */
+	int grow;
+	/* reader's private copy of front buffer */
+	sysctl_sample_buf_t copy;
+
+	double interval;
+	int running, stopping;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+} sysctl_sampler_t;
+
+static double
+sysctl_sampler_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+sysctl_sampler_freebufs(sysctl_sample_buf_t *bufs, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		free(bufs[i].slots);
+		free(bufs[i].data);
+	}
+}
+
+/*
+ * lay slots out for node sizes (probed again if asked) with room to grow,
+ * and allocate buffers for them; thread must not be running, old layout
+ * is kept on failure
+ */
+static int
+sysctl_sampler_layout(sysctl_sampler_t *s, int probe)
+{
+	sysctl_sample_buf_t bufs[3];
+	size_t *offsets, i, sz;
+	int k;
+
+	if ((offsets = calloc(s->nnodes + 1, sizeof(size_t))) == NULL)
+		return -1;
+	for (i = 0; i < s->nnodes; i++) {
+		sz = 0;
+		if (probe && sysctl_call(s->nodes[i].mib, s->nodes[i].mlen, NULL, &sz, NULL, 0) == 0)
+			s->nodes[i].sz = sz;
+		/* room for values growing between samples, aligned for getters */
+		sz = s->nodes[i].sz + (s->nodes[i].sz >> 2);
+		sz = (sz + sizeof(long) - 1) & ~(sizeof(long) - 1);
+		offsets[i + 1] = offsets[i] + (sz? sz: sizeof(long));
+	}
+
+	memset(bufs, 0, sizeof(bufs));
+	for (k = 0; k < 3; k++) {
+		bufs[k].slots = calloc(s->nnodes + 1, sizeof(sysctl_sample_slot_t));
+		bufs[k].data = malloc(offsets[s->nnodes] + 1);
+		if (bufs[k].slots == NULL || bufs[k].data == NULL) {
+			sysctl_sampler_freebufs(bufs, 3);
+			free(offsets);
+			return -1;
+		}
+	}
+
+	sysctl_sampler_freebufs(s->bufs, 2);
+	sysctl_sampler_freebufs(&s->copy, 1);
+	free(s->offsets);
+	s->bufs[0] = bufs[0];
+	s->bufs[1] = bufs[1];
+	s->copy = bufs[2];
+	s->offsets = offsets;
+	s->datasz = offsets[s->nnodes];
+	return 0;
+}
+
+/* read all nodes into back buffer and make it front one */
+static void
+sysctl_sampler_sample(sysctl_sampler_t *s)
+{
+	int back = !s->front;
+	sysctl_sample_buf_t *buf = &s->bufs[back];
+	size_t i, sz;
+
+	__atomic_store_n(&buf->seq, buf->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (i = 0; i < s->nnodes; i++) {
+		sz = s->offsets[i + 1] - s->offsets[i];
+		buf->slots[i].error = sysctl_call(s->nodes[i].mib, s->nodes[i].mlen, buf->data + s->offsets[i], &sz, NULL, 0)? errno: 0;
+		buf->slots[i].len = buf->slots[i].error? 0: sz;
+		if (buf->slots[i].error == ENOMEM)
+			__atomic_store_n(&s->grow, 1, __ATOMIC_RELAXED);
+	}
+	buf->time = sysctl_sampler_now();
+
+	__atomic_store_n(&buf->seq, buf->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->front, back, __ATOMIC_RELEASE);
+}
+
+/* copy front buffer into reader's private one, no locks involved */
+static void
+sysctl_sampler_copy(sysctl_sampler_t *s)
+{
+	sysctl_sample_buf_t *buf;
+	unsigned seq;
+
+	/* writer is in the middle of this buffer, let it finish */
+	for (;; sched_yield()) {
+		buf = &s->bufs[__atomic_load_n(&s->front, __ATOMIC_ACQUIRE)];
+		seq = __atomic_load_n(&buf->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) continue;
+
+		memcpy(s->copy.slots, buf->slots, s->nnodes * sizeof(sysctl_sample_slot_t));
+		memcpy(s->copy.data, buf->data, s->datasz);
+		s->copy.time = buf->time;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&buf->seq, __ATOMIC_RELAXED) == seq) break;
+	}
+}
+
+static void *
+sysctl_sampler_thread(void *arg)
+{
+	sysctl_sampler_t *s = arg;
+	struct timespec ts;
+	double next = sysctl_sampler_now();
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->stopping) {
+		next += s->interval;
+		/* don't try to catch up with missed ticks */
+		if (next < sysctl_sampler_now())
+			next = sysctl_sampler_now() + s->interval;
+		ts.tv_sec = (time_t)next;
+		ts.tv_nsec = (long)((next - ts.tv_sec) * 1e9);
+		if (pthread_cond_timedwait(&s->wakeup, &s->lock, &ts) == ETIMEDOUT && !s->stopping) {
+			pthread_mutex_unlock(&s->lock);
+			sysctl_sampler_sample(s);
+			pthread_mutex_lock(&s->lock);
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+static int
+sysctl_sampler_start(sysctl_sampler_t *s)
+{
+	if (s->running) return 0;
+	s->stopping = 0;
+	if (pthread_create(&s->thread, NULL, sysctl_sampler_thread, s)) return -1;
+	s->running = 1;
+	return 0;
+}
+
+static void
+sysctl_sampler_stop(sysctl_sampler_t *s)
+{
+	if (!s->running) return;
+	pthread_mutex_lock(&s->lock);
+	s->stopping = 1;
+	pthread_cond_signal(&s->wakeup);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+	s->running = 0;
+}
+
+static void
+sysctl_sampler_free(sysctl_sampler_t *s)
+{
+	sysctl_sampler_freebufs(s->bufs, 2);
+	sysctl_sampler_freebufs(&s->copy, 1);
+	free(s->nodes);
+	free(s->offsets);
+}
+
+/*
+ * sysctl.sampler{ nodes = { name or node, ... }, interval = seconds }
+ * First sample is taken right away, so sampler is readable at once.
+ * Nodes table is kept as sampler's environment to key read() results.
+ */
+static int
+luaA_sysctl_pushsampler(lua_State *L, int idx)
+{
+	sysctl_sampler_t *s;
+	sysctl_node_t *node;
+	size_t i;
+	double interval;
+	int autostart;
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	luaA_gettable(L, idx, "interval", number, interval);
+	lua_getfield(L, idx, "start");
+	autostart = lua_isnil(L, -1) || lua_toboolean(L, -1);
+	lua_pop(L, 1);
+	lua_getfield(L, idx, "nodes");
+	luaL_checktype(L, -1, LUA_TTABLE);
+
+	s = lua_newuserdata(L, sizeof(sysctl_sampler_t));
+	memset(s, 0, sizeof(sysctl_sampler_t));
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wakeup, NULL);
+	luaL_getmetatable(L, "sysctl_sampler");
+	lua_setmetatable(L, -2);
+
+	s->interval = interval > 0? interval: 1;
+	s->nnodes = lua_objlen(L, -2);
+	if ((s->nodes = calloc(s->nnodes + 1, sizeof(sysctl_node_t))) == NULL)
+		return luaL_error(L, "out of memory creating sampler");
+
+	for (i = 0; i < s->nnodes; i++) {
+		lua_rawgeti(L, -2, i + 1);
+		if (lua_isuserdata(L, -1))
+			node = luaL_checkudata(L, -1, "sysctl_node");
+		else
+			node = sysctl_cache_lookup(luaL_checkstring(L, -1));
+		if (node == NULL || node->getter == NULL)
+			return luaL_error(L, "can't sample node #%d", (int)i + 1);
+		lua_pop(L, 1);
+
+		s->nodes[i] = *node;
+	}
+
+	if (sysctl_sampler_layout(s, 0))
+		return luaL_error(L, "out of memory creating sampler");
+
+	lua_pushvalue(L, -2);
+	lua_setfenv(L, -2);
+
+	sysctl_sampler_sample(s);
+	if (autostart && sysctl_sampler_start(s))
+		return luaL_error(L, "can't start sampler thread");
+
+	return 1;
+}
+
+#define SYSCTL_SAMPLER_METHOD(name) LUAA_FUNC(sysctl_sampler_##name)
+
+/*
+ * sampler:read() returns table of last sampled values keyed the same
+ * way as nodes list, and time of the sample
+ */
+SYSCTL_SAMPLER_METHOD(read)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	const luaA_struct_t *st;
+	size_t i;
+	void *buf;
+	int n, running;
+
+	/* slots get bigger only here, while thread is stopped */
+	if (__atomic_load_n(&s->grow, __ATOMIC_RELAXED)) {
+		running = s->running;
+		sysctl_sampler_stop(s);
+		s->grow = 0;
+		n = sysctl_sampler_layout(s, 1);
+		sysctl_sampler_sample(s);
+		if (running)
+			sysctl_sampler_start(s);
+		if (n)
+			return luaL_error(L, "out of memory growing sampler");
+	}
+
+	sysctl_sampler_copy(s);
+
+	lua_getfenv(L, 1);
+	lua_createtable(L, 0, s->nnodes);
+	for (i = 0; i < s->nnodes; i++) {
+		if (s->copy.slots[i].error) continue;
+
+		lua_rawgeti(L, -2, i + 1);
+		buf = s->copy.data + s->offsets[i];
+		if ((st = sysctl_struct_by_node(&s->nodes[i])) && s->copy.slots[i].len == st->size) {
+			n = luaA_struct_push(L, st, buf);
+		} else {
+			if (strchr("ILQ", s->nodes[i].fmt[0]))
+				luaL_checkstack(L, s->copy.slots[i].len / sizeof(int) + LUA_MINSTACK, "too many values");
+			n = s->nodes[i].getter(L, buf, s->copy.slots[i].len);
+		}
+
+		if (n > 1)
+			luaA_sysctl_packvalues(L, n);
+		if (n > 0)
+			lua_rawset(L, -3);
+		else
+			lua_pop(L, 1);
+	}
+
+	lua_pushnumber(L, s->copy.time);
+	return 2;
+}
+
+SYSCTL_SAMPLER_METHOD(index)
+{
+	luaA_checkmetaindex(L, "sysctl_sampler");
+	return 0;
+}
+
+SYSCTL_SAMPLER_METHOD(start)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	lua_pushboolean(L, sysctl_sampler_start(s) == 0);
+	return 1;
+}
+
+SYSCTL_SAMPLER_METHOD(stop)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	sysctl_sampler_stop(s);
+	return 0;
+}
+
+SYSCTL_SAMPLER_METHOD(running)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	lua_pushboolean(L, s->running);
+	return 1;
+}
+
+SYSCTL_SAMPLER_METHOD(gc)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	sysctl_sampler_stop(s);
+	pthread_cond_destroy(&s->wakeup);
+	pthread_mutex_destroy(&s->lock);
+	sysctl_sampler_free(s);
+	return 0;
+}
+
+SYSCTL_SAMPLER_METHOD(tostring)
+{
+	sysctl_sampler_t *s = luaL_checkudata(L, 1, "sysctl_sampler");
+	lua_pushfstring(L, "sysctl_sampler: %d nodes, %f s, %s", (int)s->nnodes, s->interval, s->running? "running": "stopped");
+	return 1;
+}
+
+/* }}} */
+
+/* counter rates {{{ */
+
+#ifndef CPUSTATES
+#define CPUSTATES 5
+#endif
+
+/*
+ * Rate keeps previous raw value of counter node and turns every new read
+ * into per-second deltas of all its elements. Counters of both widths are
+ * unsigned and wrap modulo their width, so a counter that overflowed
+ * between reads still gives its true delta. With group set, deltas are
+ * instead normalized into percents within every group of elements
+ * (e.g. CPUSTATES states of each CPU in kern.cp_times).
+ */
+typedef struct sysctl_rate_t {
+	int mib[CTL_MAXNAME];
+	size_t mlen;
+	const luaA_struct_t *st;
+	size_t elemsz;
+	size_t group;
+	size_t bufsz, len;
+	struct timespec last;
+	void *prev, *cur;
+	double *out;
+} sysctl_rate_t;
+
+static void
+sysctl_rate_delta32(double *restrict out, const uint32_t *restrict cur, const uint32_t *restrict prev, size_t n, double scale)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		out[i] = (double)(uint32_t)(cur[i] - prev[i]) * scale;
+}
+
+static void
+sysctl_rate_delta64(double *restrict out, const uint64_t *restrict cur, const uint64_t *restrict prev, size_t n, double scale)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		out[i] = (double)(uint64_t)(cur[i] - prev[i]) * scale;
+}
+
+/* turn deltas into percents of their group total */
+static void
+sysctl_rate_normalize(double *out, size_t n, size_t group)
+{
+	size_t i, j;
+	double total;
+
+	for (i = 0; i + group <= n; i += group) {
+		total = 0;
+		for (j = 0; j < group; j++)
+			total += out[i + j];
+		total = total > 0? 100 / total: 0;
+		for (j = 0; j < group; j++)
+			out[i + j] *= total;
+	}
+}
+
+/* read counters into cur buffer, grows both buffers if needed */
+static int
+sysctl_rate_read(sysctl_rate_t *r)
+{
+	size_t sz = r->bufsz;
+	void *cur, *prev;
+	double *out;
+
+	while (sysctl_call(r->mib, r->mlen, r->cur, &sz, NULL, 0)) {
+		if (errno != ENOMEM) return -1;
+		if ((cur = realloc(r->cur, r->bufsz * 2)) == NULL) return -1;
+		r->cur = cur;
+		if ((prev = realloc(r->prev, r->bufsz * 2)) == NULL) return -1;
+		r->prev = prev;
+		if ((out = realloc(r->out, r->bufsz * 2 / r->elemsz * sizeof(double))) == NULL) return -1;
+		r->out = out;
+		r->bufsz *= 2;
+		sz = r->bufsz;
+	}
+	r->len = sz;
+	return 0;
+}
+
+/* swap buffers, so that cur becomes prev */
+static void
+sysctl_rate_swap(sysctl_rate_t *r)
+{
+	void *tmp = r->prev;
+	r->prev = r->cur;
+	r->cur = tmp;
+}
+
+static double
+sysctl_rate_elapsed(struct timespec *last)
+{
+	struct timespec now;
+	double dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	dt = (now.tv_sec - last->tv_sec) + (now.tv_nsec - last->tv_nsec) / 1e9;
+	*last = now;
+	return dt;
+}
+
+/*
+ * sysctl.rate(name [, group]) where group is number of elements to
+ * normalize to percents or "cpu" for CPUSTATES
+ */
+static int
+luaA_sysctl_pushrate(lua_State *L, sysctl_node_t *node, int groupidx)
+{
+	sysctl_rate_t *r;
+	const luaA_struct_t *st = sysctl_struct_by_node(node);
+	size_t elemsz;
+
+	if (st)
+		elemsz = st->fields[0].size;
+	else switch (node->fmt[0]) {
+	case 'I': elemsz = sizeof(int); break;
+	case 'L': elemsz = sizeof(long); break;
+	case 'Q': elemsz = sizeof(int64_t); break;
+	default: return 0;
+	}
+	if (elemsz != sizeof(uint32_t) && elemsz != sizeof(uint64_t))
+		return 0;
+
+	r = lua_newuserdata(L, sizeof(sysctl_rate_t));
+	memset(r, 0, sizeof(sysctl_rate_t));
+	luaL_getmetatable(L, "sysctl_rate");
+	lua_setmetatable(L, -2);
+
+	memcpy(r->mib, node->mib, node->mlen * sizeof(int));
+	r->mlen = node->mlen;
+	r->st = st;
+	r->elemsz = elemsz;
+	if (lua_type(L, groupidx) == LUA_TSTRING)
+		r->group = strcmp(lua_tostring(L, groupidx), "cpu") == 0? CPUSTATES: 0;
+	else
+		r->group = luaL_optinteger(L, groupidx, 0);
+
+	r->bufsz = (node->sz + elemsz - 1) / elemsz * elemsz;
+	if (r->bufsz < 16 * elemsz) r->bufsz = 16 * elemsz;
+	r->cur = malloc(r->bufsz);
+	r->prev = malloc(r->bufsz);
+	r->out = malloc(r->bufsz / elemsz * sizeof(double));
+	if (r->cur == NULL || r->prev == NULL || r->out == NULL)
+		return luaL_error(L, "out of memory creating rate");
+
+	if (sysctl_rate_read(r))
+		return 0;
+	sysctl_rate_elapsed(&r->last);
+	sysctl_rate_swap(r);
+
+	return 1;
+}
+
+#define SYSCTL_RATE_METHOD(name) LUAA_FUNC(sysctl_rate_##name)
+
+/*
+ * rate:sample() or rate() returns array of per-second deltas
+ * (percents if grouped, table keyed by field names for structs)
+ * and seconds passed since previous sample; struct is read as array
+ * of elements as wide as its first field, so only integer fields of
+ * that width and alignment get into the table, others are left out
+ */
+SYSCTL_RATE_METHOD(sample)
+{
+	sysctl_rate_t *r = luaL_checkudata(L, 1, "sysctl_rate");
+	size_t prevlen = r->len, n, i;
+	double dt;
+	int j;
+
+	if (sysctl_rate_read(r))
+		return 0;
+	dt = sysctl_rate_elapsed(&r->last);
+
+	/* number of elements changed, start over */
+	if (r->len != prevlen || dt <= 0) {
+		sysctl_rate_swap(r);
+		return 0;
+	}
+
+	n = r->len / r->elemsz;
+	if (r->elemsz == sizeof(uint32_t))
+		sysctl_rate_delta32(r->out, r->cur, r->prev, n, 1 / dt);
+	else
+		sysctl_rate_delta64(r->out, r->cur, r->prev, n, 1 / dt);
+	if (r->group)
+		sysctl_rate_normalize(r->out, n, r->group);
+	sysctl_rate_swap(r);
+
+	if (r->st) {
+		luaA_struct_pushkeys(L, r->st->fields, r->st->nfields);
+		lua_createtable(L, 0, r->st->nfields);
+		for (j = 0; j < r->st->nfields; j++) {
+			const luaA_field_t *field = &r->st->fields[j];
+			if ((field->type != ft_unsigned && field->type != ft_signed)
+				|| field->size != r->elemsz || field->offset % r->elemsz)
+				continue;
+			lua_rawgeti(L, -2, j + 1);
+			lua_pushnumber(L, r->out[field->offset / r->elemsz]);
+			lua_rawset(L, -3);
+		}
+		lua_remove(L, -2);
+	} else {
+		lua_createtable(L, n, 0);
+		for (i = 0; i < n; i++) {
+			luaA_isettable(L, -2, i + 1, number, r->out[i]);
+		}
+	}
+
+	lua_pushnumber(L, dt);
+	return 2;
+}
+
+SYSCTL_RATE_METHOD(call)
+{
+	return luaA_sysctl_rate_sample(L);
+}
+
+SYSCTL_RATE_METHOD(index)
+{
+	luaA_checkmetaindex(L, "sysctl_rate");
+	return 0;
+}
+
+SYSCTL_RATE_METHOD(gc)
+{
+	sysctl_rate_t *r = luaL_checkudata(L, 1, "sysctl_rate");
+	free(r->cur);
+	free(r->prev);
+	free(r->out);
+	return 0;
+}
+
+/* }}} */
+
+/* change watchers {{{ */
+
+/*
+ * Watcher polls fixed set of nodes and hashes their raw values, only
+ * nodes whose bytes changed since previous poll are decoded. Struct
+ * nodes also keep previous raw value, so that only changed fields are
+ * reported.
+ */
+typedef struct sysctl_watch_node_t {
+	int mib[CTL_MAXNAME];
+	size_t mlen;
+	sysctl_node_getter_t getter;
+	const luaA_struct_t *st;
+	char fmt[2];
+	uint64_t hash;
+	size_t len;
+	int seen;
+	size_t bufsz;
+	void *buf, *prev;
+} sysctl_watch_node_t;
+
+typedef struct sysctl_watch_t {
+	size_t nnodes;
+	sysctl_watch_node_t nodes[1];
+} sysctl_watch_t;
+
+/* 64-bit FNV-1a */
+static uint64_t
+sysctl_hash(const void *buf, size_t sz)
+{
+	const u_char *ptr = buf, *end = ptr + sz;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (ptr < end) {
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* read node into its buffer, growing it if needed */
+static int
+sysctl_watch_read(sysctl_watch_node_t *wn)
+{
+	size_t sz = wn->bufsz;
+	void *buf;
+
+	while (sysctl_call(wn->mib, wn->mlen, wn->buf, &sz, NULL, 0)) {
+		if (errno != ENOMEM) return (-1);
+		if ((buf = realloc(wn->buf, wn->bufsz * 2)) == NULL) return (-1);
+		wn->buf = buf;
+		if (wn->st) {
+			if ((buf = realloc(wn->prev, wn->bufsz * 2)) == NULL) return (-1);
+			wn->prev = buf;
+		}
+		wn->bufsz *= 2;
+		sz = wn->bufsz;
+	}
+	wn->len = sz;
+	return (0);
+}
+
+/* sysctl.watch{ name or node, ... } */
+static int
+luaA_sysctl_pushwatch(lua_State *L, int idx)
+{
+	sysctl_watch_t *w;
+	sysctl_watch_node_t *wn;
+	sysctl_node_t *node;
+	size_t i, n;
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	n = lua_objlen(L, idx);
+
+	w = lua_newuserdata(L, sizeof(sysctl_watch_t) + (n? n - 1: 0) * sizeof(sysctl_watch_node_t));
+	memset(w, 0, sizeof(sysctl_watch_t) + (n? n - 1: 0) * sizeof(sysctl_watch_node_t));
+	luaL_getmetatable(L, "sysctl_watch");
+	lua_setmetatable(L, -2);
+
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, idx, i + 1);
+		if (lua_isuserdata(L, -1))
+			node = luaL_checkudata(L, -1, "sysctl_node");
+		else
+			node = sysctl_cache_lookup(luaL_checkstring(L, -1));
+		if (node == NULL || node->getter == NULL)
+			return luaL_error(L, "can't watch node #%d", (int)i + 1);
+		lua_pop(L, 1);
+
+		wn = &w->nodes[w->nnodes++];
+		memcpy(wn->mib, node->mib, node->mlen * sizeof(int));
+		wn->mlen = node->mlen;
+		wn->getter = node->getter;
+		wn->st = sysctl_struct_by_node(node);
+		memcpy(wn->fmt, node->fmt, sizeof(wn->fmt));
+		wn->bufsz = node->sz + (node->sz >> 2);
+		if (wn->bufsz < 16) wn->bufsz = 16;
+		if ((wn->buf = malloc(wn->bufsz)) == NULL
+			|| (wn->st && (wn->prev = malloc(wn->bufsz)) == NULL))
+			return luaL_error(L, "out of memory creating watch");
+	}
+
+	/* keys of results are the same as in nodes list */
+	lua_pushvalue(L, idx);
+	lua_setfenv(L, -2);
+	return 1;
+}
+
+#define SYSCTL_WATCH_METHOD(name) LUAA_FUNC(sysctl_watch_##name)
+
+/*
+ * watch:poll() or watch() returns table of changed nodes only (structs
+ * hold only changed fields) or nothing if none has changed,
+ * first poll reports all nodes
+ */
+SYSCTL_WATCH_METHOD(poll)
+{
+	sysctl_watch_t *w = luaL_checkudata(L, 1, "sysctl_watch");
+	sysctl_watch_node_t *wn;
+	uint64_t hash;
+	size_t i;
+	void *tmp;
+	int n, changed = 0;
+
+	lua_settop(L, 1);
+	lua_getfenv(L, 1);
+	for (i = 0; i < w->nnodes; i++) {
+		wn = &w->nodes[i];
+		if (sysctl_watch_read(wn)) continue;
+
+		hash = sysctl_hash(wn->buf, wn->len);
+		if (wn->seen && hash == wn->hash) continue;
+
+		if (!changed++)
+			lua_newtable(L);
+		lua_rawgeti(L, 2, i + 1);
+
+		if (wn->st && wn->len == wn->st->size) {
+			if (wn->seen)
+				n = luaA_struct_pushdiff(L, wn->st, wn->prev, wn->buf);
+			else
+				n = luaA_struct_push(L, wn->st, wn->buf);
+			tmp = wn->prev;
+			wn->prev = wn->buf;
+			wn->buf = tmp;
+		} else {
+			if (strchr("ILQ", wn->fmt[0]))
+				luaL_checkstack(L, wn->len / sizeof(int) + LUA_MINSTACK, "too many values");
+			n = wn->getter(L, wn->buf, wn->len);
+		}
+
+		if (n > 1)
+			luaA_sysctl_packvalues(L, n);
+		if (n > 0)
+			lua_rawset(L, -3);
+		else
+			lua_pop(L, 1);
+
+		wn->hash = hash;
+		wn->seen = 1;
+	}
+
+	return changed? 1: 0;
+}
+
+SYSCTL_WATCH_METHOD(call)
+{
+	return luaA_sysctl_watch_poll(L);
+}
+
+/* make next poll report all nodes */
+SYSCTL_WATCH_METHOD(reset)
+{
+	sysctl_watch_t *w = luaL_checkudata(L, 1, "sysctl_watch");
+	size_t i;
+
+	for (i = 0; i < w->nnodes; i++)
+		w->nodes[i].seen = 0;
+	return 0;
+}
+
+SYSCTL_WATCH_METHOD(index)
+{
+	luaA_checkmetaindex(L, "sysctl_watch");
+	return 0;
+}
+
+SYSCTL_WATCH_METHOD(gc)
+{
+	sysctl_watch_t *w = luaL_checkudata(L, 1, "sysctl_watch");
+	size_t i;
+
+	for (i = 0; i < w->nnodes; i++) {
+		free(w->nodes[i].buf);
+		free(w->nodes[i].prev);
+	}
+	return 0;
+}
+
+/* }}} */
+
+/* node histories {{{ */
+
+/* history source reading one numeric element of node */
+typedef struct sysctl_history_source_t {
+	int mib[CTL_MAXNAME];
+	size_t mlen;
+	char fmt[2];
+	st_type_t stype;
+	size_t elem;
+	size_t bufsz;
+	u_char buf[1];
+} sysctl_history_source_t;
+
+static int
+sysctl_history_read(void *arg, double *value)
+{
+	sysctl_history_source_t *src = arg;
+	size_t sz = src->bufsz;
+	int unsign = src->fmt[1] == 'U';
+
+	if (sysctl_call(src->mib, src->mlen, src->buf, &sz, NULL, 0))
+		return (-1);
+
+	if (src->stype == st_loadavg) {
+		struct loadavg *la = (struct loadavg *)src->buf;
+		if (src->elem >= 3) return (-1);
+		*value = (double)la->ldavg[src->elem] / (double)la->fscale;
+		return (0);
+	}
+
+	switch (src->fmt[0]) {
+	case 'I':
+		if ((src->elem + 1) * sizeof(int) > sz) return (-1);
+		if (src->fmt[1] == 'K')
+			*value = (((int *)src->buf)[src->elem] - 2732.0) / 10.0;
+		else if (unsign)
+			*value = ((u_int *)src->buf)[src->elem];
+		else
+			*value = ((int *)src->buf)[src->elem];
+		return (0);
+	case 'L':
+		if ((src->elem + 1) * sizeof(long) > sz) return (-1);
+		if (unsign)
+			*value = ((u_long *)src->buf)[src->elem];
+		else
+			*value = ((long *)src->buf)[src->elem];
+		return (0);
+	case 'Q':
+		if ((src->elem + 1) * sizeof(int64_t) > sz) return (-1);
+		if (unsign)
+			*value = ((uint64_t *)src->buf)[src->elem];
+		else
+			*value = ((int64_t *)src->buf)[src->elem];
+		return (0);
+	}
+
+	return (-1);
+}
+
+/*
+ * sysctl.history(name, capacity [, steps [, element]]) makes history
+ * of element (1st by default) of numeric node or vm.loadavg,
+ * steps are consolidation levels in seconds, { 1, 60, 3600 } by default,
+ * sysctl.history(name, file [, element]) keeps it in history file
+ * under node name (with #element for other than 1st one)
+ */
+static int
+luaA_sysctl_pushhistory(lua_State *L, sysctl_node_t *node)
+{
+	static const double default_steps[] = { 1, 60, 3600 };
+	double steps[LUAA_HISTORY_MAXLEVELS];
+	int i, nsteps = 3, capacity, file = lua_isuserdata(L, 2);
+	size_t elem = luaL_optinteger(L, file? 3: 4, 1);
+	sysctl_history_source_t *src;
+	luaA_history_t *h;
+	size_t bufsz;
+
+	if (!strchr("ILQ", node->fmt[0]) && node->stype != st_loadavg)
+		return luaL_error(L, "history needs numeric node");
+	luaL_argcheck(L, elem > 0, file? 3: 4, "elements are counted from 1");
+
+	if (file) {
+		if (elem > 1)
+			lua_pushfstring(L, "%s#%d", luaL_checkstring(L, 1), (int)elem);
+		else
+			lua_pushvalue(L, 1);
+		h = luaA_histfile_pushhistory(L, 2, lua_tostring(L, -1));
+		lua_remove(L, -2);
+		goto source;
+	}
+
+	capacity = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, capacity > 0, 2, "history capacity must be positive");
+	memcpy(steps, default_steps, sizeof(default_steps));
+	if (lua_istable(L, 3)) {
+		nsteps = lua_objlen(L, 3);
+		if (nsteps >= LUAA_HISTORY_MAXLEVELS)
+			return luaL_error(L, "too many history levels");
+		for (i = 0; i < nsteps; i++) {
+			luaA_igettable(L, 3, i + 1, number, steps[i]);
+		}
+	}
+
+	h = luaA_history_new(L, capacity, steps, nsteps);
+
+source:
+	bufsz = node->sz + (node->sz >> 2) + sizeof(long);
+	if ((src = malloc(sizeof(sysctl_history_source_t) + bufsz)) == NULL)
+		return luaL_error(L, "out of memory creating history");
+	memcpy(src->mib, node->mib, node->mlen * sizeof(int));
+	src->mlen = node->mlen;
+	memcpy(src->fmt, node->fmt, sizeof(src->fmt));
+	src->stype = node->stype;
+	src->elem = elem - 1;
+	src->bufsz = bufsz;
+	h->arg = src;
+	h->read = sysctl_history_read;
+
+	return 1;
+}
+
+/* }}} */
+
+/* batch set {{{ */
+
+typedef enum { so_invalid, so_pending, so_unchanged, so_set, so_failed, so_skipped, so_rolledback, so_stuck } sysctl_setop_state_t;
+static const char *sysctl_setop_states[] = {
+	"invalid", "pending", "unchanged", "set", "failed", "skipped", "rolled back", "rollback failed"
+};
+
+/*
+ * One entry of batch set: resolved node, new value encoded the way
+ * its setter would do it and old value read back before any write.
+ */
+typedef struct sysctl_setop_t {
+	sysctl_node_t node;
+	const void *newval;
+	size_t newsz;
+	void *oldval;
+	size_t oldsz;
+	union {
+		int i;
+		unsigned int u;
+		long l;
+		unsigned long ul;
+		quad_t q;
+	} num, old;
+	sysctl_setop_state_t state;
+	const char *error;
+} sysctl_setop_t;
+
+/* encode value at idx for node, 0 or error message */
+static const char *
+sysctl_setop_encode(lua_State *L, sysctl_setop_t *op, int idx)
+{
+	sysctl_node_setter_t setter = op->node.setter;
+
+	if (setter == luaA_sysctl_setstring) {
+		if (lua_type(L, idx) != LUA_TSTRING && lua_type(L, idx) != LUA_TNUMBER)
+			return "string value expected";
+		op->newval = lua_tolstring(L, idx, &op->newsz);
+		return NULL;
+	}
+
+	if (!lua_isnumber(L, idx))
+		return "number value expected";
+
+	op->newval = &op->num;
+	if (setter == luaA_sysctl_setint) {
+		op->num.i = lua_tonumber(L, idx);
+		op->newsz = sizeof(int);
+	} else if (setter == luaA_sysctl_setuint) {
+		op->num.u = lua_tonumber(L, idx);
+		op->newsz = sizeof(unsigned int);
+	} else if (setter == luaA_sysctl_setlong) {
+		op->num.l = lua_tonumber(L, idx);
+		op->newsz = sizeof(long);
+	} else if (setter == luaA_sysctl_setulong) {
+		op->num.ul = lua_tonumber(L, idx);
+		op->newsz = sizeof(unsigned long);
+	} else if (setter == luaA_sysctl_setquad) {
+		op->num.q = lua_tonumber(L, idx);
+		op->newsz = sizeof(quad_t);
+	} else {
+		return "node type can't be set";
+	}
+	return NULL;
+}
+
+/* read old value, numbers go into op itself, strings into malloc'ed buffer */
+static int
+sysctl_setop_readold(sysctl_setop_t *op)
+{
+	size_t sz;
+
+	if (op->newval == &op->num) {
+		op->oldval = &op->old;
+		op->oldsz = op->newsz;
+		return sysctl_call(op->node.mib, op->node.mlen, op->oldval, &op->oldsz, NULL, 0);
+	}
+
+	for (;;) {
+		if (sysctl_call(op->node.mib, op->node.mlen, NULL, &sz, NULL, 0)) return (-1);
+		sz += sz >> 2;
+		if ((op->oldval = malloc(sz + 1)) == NULL) return (-1);
+		op->oldsz = sz;
+		if (sysctl_call(op->node.mib, op->node.mlen, op->oldval, &op->oldsz, NULL, 0) == 0) break;
+		free(op->oldval);
+		op->oldval = NULL;
+		if (errno != ENOMEM) return (-1);
+	}
+	/* kernel strings come with terminating zero, setter writes them without it */
+	if (op->oldsz && ((char *)op->oldval)[op->oldsz - 1] == '\0')
+		op->oldsz--;
+	((char *)op->oldval)[op->oldsz] = '\0';
+	return (0);
+}
+
+/*
+ * write entries in order, once one fails the already written ones
+ * are restored in reverse order and the rest is skipped
+ */
+static int
+sysctl_setops_apply(sysctl_setop_t *ops, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		if (ops[i].state != so_pending) continue;
+		if (ops[i].newsz == ops[i].oldsz && memcmp(ops[i].newval, ops[i].oldval, ops[i].newsz) == 0) {
+			ops[i].state = so_unchanged;
+			continue;
+		}
+		if (sysctl_call(ops[i].node.mib, ops[i].node.mlen, NULL, 0, ops[i].newval, ops[i].newsz) == 0) {
+			ops[i].state = so_set;
+			continue;
+		}
+
+		ops[i].state = so_failed;
+		ops[i].error = strerror(errno);
+		for (j = i - 1; j >= 0; j--) {
+			if (ops[j].state != so_set) continue;
+			if (sysctl_call(ops[j].node.mib, ops[j].node.mlen, NULL, 0, ops[j].oldval, ops[j].oldsz) == 0) {
+				ops[j].state = so_rolledback;
+			} else {
+				ops[j].state = so_stuck;
+				ops[j].error = strerror(errno);
+			}
+		}
+		for (j = i + 1; j < n; j++)
+			ops[j].state = so_skipped;
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+sysctl_setops_free(sysctl_setop_t *ops, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		if (ops[i].oldval && ops[i].oldval != &ops[i].old)
+			free(ops[i].oldval);
+}
+
+/*
+ * sysctl.set_many{ { name or node, value }, ... } resolves and checks
+ * all entries and reads their old values before the first write, then
+ * writes them in order rolling back on failure, returns true or false
+ * and array of { name, status, old [, error] } per entry
+ */
+static int
+luaA_sysctl_setmany(lua_State *L)
+{
+	sysctl_setop_t *ops;
+	sysctl_node_t *node;
+	int i, n, ok = 1;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	n = lua_objlen(L, 1);
+	ops = lua_newuserdata(L, n * sizeof(sysctl_setop_t) + 1);
+	memset(ops, 0, n * sizeof(sysctl_setop_t));
+
+	/* names and values stay on stack at 3 + 2 * i, strings are used in place */
+	luaL_checkstack(L, n * 2 + LUA_MINSTACK, "too many entries");
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, 1, i + 1);
+		if (!lua_istable(L, -1))
+			return luaL_error(L, "set_many entry #%d is not { name, value } pair", i + 1);
+		lua_rawgeti(L, -1, 1);
+		lua_rawgeti(L, -2, 2);
+		lua_remove(L, -3);
+
+		node = lua_isuserdata(L, -2)? luaL_checkudata(L, -2, "sysctl_node"): sysctl_cache_lookup(luaL_checkstring(L, -2));
+		if (node == NULL) {
+			ops[i].error = "no such node";
+		} else if (node->setter == NULL || node->getter == NULL) {
+			ops[i].error = node->setter? "node can't be read back": "node is read only";
+		} else {
+			ops[i].node = *node;
+			if ((ops[i].error = sysctl_setop_encode(L, &ops[i], -1)) == NULL
+				&& ops[i].newval == &ops[i].num && node->sz > ops[i].newsz)
+				ops[i].error = "node holds several values";
+		}
+		if (ops[i].error == NULL)
+			ops[i].state = so_pending;
+		else
+			ok = 0;
+	}
+
+	/* nothing raises lua errors from here till old values are freed */
+	for (i = 0; ok && i < n; i++) {
+		if (sysctl_setop_readold(&ops[i])) {
+			ops[i].state = so_invalid;
+			ops[i].error = strerror(errno);
+			ok = 0;
+		}
+	}
+
+	if (!ok) {
+		for (i = 0; i < n; i++)
+			if (ops[i].state == so_pending) ops[i].state = so_skipped;
+	} else {
+		ok = sysctl_setops_apply(ops, n) == 0;
+	}
+
+	lua_pushboolean(L, ok);
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		lua_createtable(L, 0, 4);
+		lua_pushvalue(L, 3 + 2 * i);
+		lua_setfield(L, -2, "name");
+		luaA_settable(L, -2, "status", string, sysctl_setop_states[ops[i].state]);
+		if (ops[i].error) {
+			luaA_settable(L, -2, "error", string, ops[i].error);
+		}
+		if (ops[i].oldval && ops[i].node.getter(L, ops[i].oldval, ops[i].oldsz) == 1)
+			lua_setfield(L, -2, "old");
+		lua_rawseti(L, -2, i + 1);
+	}
+	sysctl_setops_free(ops, n);
+	return 2;
+}
+
+/* }}} */
+
+/* metrics exporter {{{ */
+
+/*
+ * Renders configured nodes & mounts in Prometheus text exposition
+ * format. Nodes are resolved and their metric names & labels are built
+ * once: dotted name is sanitized into family name and numeric MIB
+ * components (cpu number, interface index) become labels named after
+ * preceding component, e.g. dev.cpu.0.temperature is rendered as
+ * dev_cpu_temperature{cpu="0"}. Every render appends samples to one
+ * growable buffer, then samples are grouped by family into another one,
+ * both buffers are reused between renders.
+ */
+typedef struct sysctl_buf_t {
+	char *data;
+	size_t len, max;
+	int failed;
+} sysctl_buf_t;
+
+typedef struct sysctl_export_item_t {
+	sysctl_node_t node;
+	const luaA_struct_t *st;
+	uint32_t family;
+	uint32_t labels;
+	uint32_t help;
+} sysctl_export_item_t;
+
+/* sample is family name and rest of the line, both nul terminated */
+typedef struct sysctl_export_rec_t {
+	uint32_t sample;
+	uint32_t help;
+	uint32_t seq;
+} sysctl_export_rec_t;
+
+#define SYSCTL_EXPORT_NOHELP ((uint32_t)-1)
+#define SYSCTL_EXPORT_MAXREQ 4096
+/* whole exchange with one client, ms */
+#define SYSCTL_EXPORT_TIMEOUT 1000
+
+typedef struct sysctl_exporter_t {
+	sysctl_export_item_t *items;
+	size_t nitems, maxitems;
+	uint32_t *mounts;
+	size_t nmounts, maxmounts;
+	uint32_t prefix;
+	uint32_t fsfamily[5], fshelp[5];
+	sysctl_buf_t strings;
+	sysctl_buf_t samples;
+	sysctl_buf_t out;
+	sysctl_export_rec_t *recs;
+	size_t nrecs, maxrecs;
+	int nlabels;
+	int fd;
+	char *path;
+} sysctl_exporter_t;
+
+static void
+sysctl_buf_add(sysctl_buf_t *b, const char *str, size_t len)
+{
+	/* string may live in the buffer itself, e.g. prefix */
+	size_t offset = str - b->data;
+	int inside = b->data && str >= b->data && str < b->data + b->max;
+
+	if (b->failed || sysctl_index_grow((void **)&b->data, &b->max, b->len + len + 1, 1)) {
+		b->failed = 1;
+		return;
+	}
+	if (inside)
+		str = b->data + offset;
+	memcpy(b->data + b->len, str, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
+
+#define sysctl_buf_puts(b, str) sysctl_buf_add(b, str, strlen(str))
+
+/* add string with terminating nul, returns its offset */
+static uint32_t
+sysctl_buf_addstr(sysctl_buf_t *b, const char *str)
+{
+	uint32_t offset = b->len;
+	sysctl_buf_add(b, str, strlen(str) + 1);
+	return offset;
+}
+
+static void
+sysctl_buf_printf(sysctl_buf_t *b, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (b->failed)
+		return;
+	va_start(ap, fmt);
+	len = vsnprintf(b->data + b->len, b->max - b->len, fmt, ap);
+	va_end(ap);
+	if (len < 0) {
+		b->failed = 1;
+		return;
+	}
+	if ((size_t)len >= b->max - b->len) {
+		if (sysctl_index_grow((void **)&b->data, &b->max, b->len + len + 1, 1)) {
+			b->failed = 1;
+			return;
+		}
+		va_start(ap, fmt);
+		vsnprintf(b->data + b->len, b->max - b->len, fmt, ap);
+		va_end(ap);
+	}
+	b->len += len;
+}
+
+/* add metric or label name, invalid chars are replaced with '_' */
+static void
+sysctl_buf_putname(sysctl_buf_t *b, const char *name, size_t len, int label)
+{
+	size_t i;
+	char c;
+
+	if (len && name[0] >= '0' && name[0] <= '9')
+		sysctl_buf_add(b, "_", 1);
+	for (i = 0; i < len; i++) {
+		c = name[i];
+		if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') && !(c >= '0' && c <= '9') && c != '_' && (label || c != ':'))
+			c = '_';
+		sysctl_buf_add(b, &c, 1);
+	}
+}
+
+/* add label value or help text, escaping backslashes, newlines and (in values) quotes */
+static void
+sysctl_buf_putescaped(sysctl_buf_t *b, const char *str, size_t len, int quotes)
+{
+	size_t i, start = 0;
+
+	for (i = 0; i < len; i++) {
+		if (str[i] != '\\' && str[i] != '\n' && !(quotes && str[i] == '"'))
+			continue;
+		sysctl_buf_add(b, str + start, i - start);
+		sysctl_buf_add(b, str[i] == '\n'? "\\n": str[i] == '"'? "\\\"": "\\\\", 2);
+		start = i + 1;
+	}
+	sysctl_buf_add(b, str + start, len - start);
+}
+
+static int
+sysctl_isnumeric(const char *str, size_t len)
+{
+	size_t i;
+
+	if (len == 0) return 0;
+	for (i = 0; i < len; i++)
+		if (str[i] < '0' || str[i] > '9') return 0;
+	return 1;
+}
+
+/*
+ * add node to exporter: family is prefix and non-numeric name components
+ * joined with '_', each numeric component becomes label named after the
+ * last non-numeric one (with position appended for second and further
+ * ones in a row)
+ */
+static int
+sysctl_export_additem(sysctl_exporter_t *e, sysctl_node_t *node, const char *name)
+{
+	sysctl_export_item_t *item;
+	const char *comp, *end, *last = "index";
+	size_t len, lastlen = 5;
+	int first = 1, run = 0;
+	char *desc;
+
+	if (sysctl_index_grow((void **)&e->items, &e->maxitems, e->nitems + 1, sizeof(sysctl_export_item_t)))
+		return (-1);
+	item = &e->items[e->nitems];
+	item->node = *node;
+	item->st = sysctl_struct_by_node(node);
+
+	item->family = e->strings.len;
+	sysctl_buf_puts(&e->strings, e->strings.data + e->prefix);
+	for (comp = name; *comp; comp = *end? end + 1: end) {
+		end = comp + strcspn(comp, ".");
+		if ((len = end - comp) == 0 || sysctl_isnumeric(comp, len)) continue;
+		if (!first) sysctl_buf_add(&e->strings, "_", 1);
+		sysctl_buf_putname(&e->strings, comp, len, 0);
+		first = 0;
+	}
+	sysctl_buf_add(&e->strings, "", 1);
+
+	item->labels = e->strings.len;
+	first = 1;
+	for (comp = name; *comp; comp = *end? end + 1: end) {
+		end = comp + strcspn(comp, ".");
+		if ((len = end - comp) == 0) continue;
+		if (!sysctl_isnumeric(comp, len)) {
+			last = comp;
+			lastlen = len;
+			run = 0;
+			continue;
+		}
+		if (!first) sysctl_buf_add(&e->strings, ",", 1);
+		sysctl_buf_putname(&e->strings, last, lastlen, 1);
+		if (run++)
+			sysctl_buf_printf(&e->strings, "_%d", run - 1);
+		sysctl_buf_add(&e->strings, "=\"", 2);
+		sysctl_buf_add(&e->strings, comp, len);
+		sysctl_buf_add(&e->strings, "\"", 1);
+		first = 0;
+	}
+	sysctl_buf_add(&e->strings, "", 1);
+
+	item->help = SYSCTL_EXPORT_NOHELP;
+	if ((desc = sysctl_info(node, sm_desc)) != NULL) {
+		if (*desc) {
+			item->help = e->strings.len;
+			sysctl_buf_putescaped(&e->strings, desc, strlen(desc), 0);
+			sysctl_buf_add(&e->strings, "", 1);
+		}
+		free(desc);
+	}
+
+	if (e->strings.failed)
+		return (-1);
+	e->nitems++;
+	return (0);
+}
+
+/* add every readable leaf node matching glob pattern (or whole subtree) */
+static int
+sysctl_export_addglob(sysctl_exporter_t *e, const char *pattern)
+{
+	size_t i, prefix = strcspn(pattern, "*?");
+	sysctl_node_t *node;
+	const char *name;
+
+	if (sysctl_idx.nentries == 0 && sysctl_index_build())
+		return (-1);
+
+	for (i = sysctl_index_lower_bound(pattern, prefix); i < sysctl_idx.nentries; i++) {
+		name = sysctl_idx.names + sysctl_idx.entries[i].name;
+		if (strncmp(name, pattern, prefix) != 0)
+			break;
+		if ((sysctl_idx.entries[i].kind & CTLTYPE) == CTLTYPE_NODE || !sysctl_glob(pattern, name))
+			continue;
+		if ((node = sysctl_cache_lookup(name)) && node->getter
+			&& sysctl_export_additem(e, node, name))
+			return (-1);
+	}
+	return (0);
+}
+
+/* start sample of family with optional field suffix */
+static void
+sysctl_export_begin(sysctl_exporter_t *e, uint32_t help, const char *family, const char *field)
+{
+	sysctl_export_rec_t *rec;
+
+	if (sysctl_index_grow((void **)&e->recs, &e->maxrecs, e->nrecs + 1, sizeof(sysctl_export_rec_t))) {
+		e->samples.failed = 1;
+		return;
+	}
+	rec = &e->recs[e->nrecs];
+	rec->sample = e->samples.len;
+	rec->help = help;
+	rec->seq = e->nrecs++;
+
+	sysctl_buf_puts(&e->samples, family);
+	if (field) {
+		sysctl_buf_add(&e->samples, "_", 1);
+		sysctl_buf_putname(&e->samples, field, strlen(field), 0);
+	}
+	sysctl_buf_add(&e->samples, "", 1);
+	e->nlabels = 0;
+}
+
+/* add label pairs, either prerendered ones (value is NULL) or single escaped one */
+static void
+sysctl_export_label(sysctl_exporter_t *e, const char *name, const char *value, size_t len)
+{
+	if (value == NULL && *name == '\0')
+		return;
+	sysctl_buf_add(&e->samples, e->nlabels++? ",": "{", 1);
+	if (value == NULL) {
+		sysctl_buf_puts(&e->samples, name);
+		return;
+	}
+	sysctl_buf_puts(&e->samples, name);
+	sysctl_buf_add(&e->samples, "=\"", 2);
+	sysctl_buf_putescaped(&e->samples, value, len, 1);
+	sysctl_buf_add(&e->samples, "\"", 1);
+}
+
+static void
+sysctl_export_index(sysctl_exporter_t *e, const char *name, long index)
+{
+	char value[32];
+	sysctl_export_label(e, name, value, snprintf(value, sizeof(value), "%ld", index));
+}
+
+/* finish sample with preformatted value */
+static void
+sysctl_export_end(sysctl_exporter_t *e, const char *value)
+{
+	if (e->nlabels)
+		sysctl_buf_add(&e->samples, "}", 1);
+	sysctl_buf_add(&e->samples, " ", 1);
+	sysctl_buf_puts(&e->samples, value);
+	sysctl_buf_add(&e->samples, "", 1);
+}
+
+static void
+sysctl_export_endint(sysctl_exporter_t *e, int64_t value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lld", (long long)value);
+	sysctl_export_end(e, buf);
+}
+
+static void
+sysctl_export_enduint(sysctl_exporter_t *e, uint64_t value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+	sysctl_export_end(e, buf);
+}
+
+static void
+sysctl_export_enddouble(sysctl_exporter_t *e, double value)
+{
+	char buf[32];
+
+	if (isnan(value))
+		sysctl_export_end(e, "NaN");
+	else if (isinf(value))
+		sysctl_export_end(e, value > 0? "+Inf": "-Inf");
+	else {
+		snprintf(buf, sizeof(buf), "%.15g", value);
+		sysctl_export_end(e, buf);
+	}
+}
+
+/* labels shared by all samples of struct node: item ones & top level strings */
+static void
+sysctl_export_structlabels(sysctl_exporter_t *e, sysctl_export_item_t *item, const void *buf)
+{
+	const luaA_field_t *field;
+	const char *str;
+	int i;
+
+	sysctl_export_label(e, e->strings.data + item->labels, NULL, 0);
+	for (i = 0; i < item->st->nfields; i++) {
+		field = &item->st->fields[i];
+		if (field->type != ft_string) continue;
+		str = (const char *)buf + field->offset;
+		sysctl_export_label(e, field->name, str, strnlen(str, field->size));
+	}
+}
+
+/* one sample per numeric field, nested fields are named by their path */
+static void
+sysctl_export_fields(sysctl_exporter_t *e, sysctl_export_item_t *item, const void *buf,
+	const luaA_field_t *fields, int nfields, char *path, size_t pathlen, int index)
+{
+	const luaA_field_t *field;
+	const u_char *ptr;
+	size_t len;
+	int i, j;
+
+	for (i = 0; i < nfields; i++) {
+		field = &fields[i];
+		ptr = (const u_char *)buf + field->offset;
+
+		len = pathlen;
+		if (field->name) {
+			len += snprintf(path + pathlen, BUFSIZ - pathlen, "%s%s", pathlen? "_": "", field->name);
+			if (len >= BUFSIZ) continue;
+		}
+
+		switch (field->type) {
+		case ft_struct:
+			sysctl_export_fields(e, item, buf, field->sub, field->nsub, path, len, index);
+			continue;
+		case ft_array:
+			for (j = 0; j < field->nsub; j++)
+				sysctl_export_fields(e, item, buf, &field->sub[j], 1, path, len, j);
+			continue;
+		case ft_string:
+		case ft_dev:
+			continue;
+		default:
+			break;
+		}
+
+		sysctl_export_begin(e, item->help, e->strings.data + item->family, path);
+		sysctl_export_structlabels(e, item, buf);
+		if (index >= 0)
+			sysctl_export_index(e, "index", index);
+
+		switch (field->type) {
+		case ft_signed:
+			switch (field->size) {
+			case 1: sysctl_export_endint(e, *(int8_t *)ptr); break;
+			case 2: sysctl_export_endint(e, *(int16_t *)ptr); break;
+			case 4: sysctl_export_endint(e, *(int32_t *)ptr); break;
+			default: sysctl_export_endint(e, *(int64_t *)ptr); break;
+			}
+			break;
+		case ft_unsigned:
+			switch (field->size) {
+			case 1: sysctl_export_enduint(e, *(uint8_t *)ptr); break;
+			case 2: sysctl_export_enduint(e, *(uint16_t *)ptr); break;
+			case 4: sysctl_export_enduint(e, *(uint32_t *)ptr); break;
+			default: sysctl_export_enduint(e, *(uint64_t *)ptr); break;
+			}
+			break;
+		case ft_float:
+			sysctl_export_enddouble(e, field->size == sizeof(float)? *(float *)ptr: *(double *)ptr);
+			break;
+		default:
+			sysctl_export_enduint(e, getpagesize());
+			break;
+		}
+	}
+}
+
+/* start sample of plain node value, elements of arrays are labeled */
+static void
+sysctl_export_beginnode(sysctl_exporter_t *e, sysctl_export_item_t *item, const char *field, const char *label, long index)
+{
+	sysctl_export_begin(e, item->help, e->strings.data + item->family, field);
+	sysctl_export_label(e, e->strings.data + item->labels, NULL, 0);
+	if (label)
+		sysctl_export_index(e, label, index);
+}
+
+static void
+sysctl_export_node(sysctl_exporter_t *e, sysctl_export_item_t *item)
+{
+	static const char *loads[] = { "1", "5", "15" };
+	sysctl_node_t *node = &item->node;
+	char path[BUFSIZ];
+	size_t i, n, sz;
+	void *buf;
+
+	if ((buf = sysctl_get_scratch(node)) == NULL)
+		return;
+	sz = node->sz;
+
+	switch (node->fmt[0]) {
+	case 'I':
+		n = sz / sizeof(int);
+		for (i = 0; i < n; i++) {
+			sysctl_export_beginnode(e, item, NULL, n > 1? "element": NULL, i);
+			if (node->fmt[1] == 'K')
+				sysctl_export_enddouble(e, (((int *)buf)[i] - 2732.0) / 10.0);
+			else if (node->fmt[1] == 'U')
+				sysctl_export_enduint(e, ((u_int *)buf)[i]);
+			else
+				sysctl_export_endint(e, ((int *)buf)[i]);
+		}
+		break;
+	case 'L':
+		n = sz / sizeof(long);
+		for (i = 0; i < n; i++) {
+			sysctl_export_beginnode(e, item, NULL, n > 1? "element": NULL, i);
+			if (node->fmt[1] == 'U')
+				sysctl_export_enduint(e, ((u_long *)buf)[i]);
+			else
+				sysctl_export_endint(e, ((long *)buf)[i]);
+		}
+		break;
+	case 'Q':
+		n = sz / sizeof(quad_t);
+		for (i = 0; i < n; i++) {
+			sysctl_export_beginnode(e, item, NULL, n > 1? "element": NULL, i);
+			sysctl_export_endint(e, ((quad_t *)buf)[i]);
+		}
+		break;
+	case 'A':
+		/* strings are exported as info metrics with value label */
+		sysctl_export_beginnode(e, item, "info", NULL, 0);
+		sysctl_export_label(e, "value", buf, strnlen(buf, sz));
+		sysctl_export_end(e, "1");
+		break;
+	default:
+		if (node->stype == st_loadavg && sz >= sizeof(struct loadavg)) {
+			for (i = 0; i < 3; i++) {
+				sysctl_export_beginnode(e, item, NULL, NULL, 0);
+				sysctl_export_label(e, "period", loads[i], strlen(loads[i]));
+				sysctl_export_enddouble(e, (double)((struct loadavg *)buf)->ldavg[i] / ((struct loadavg *)buf)->fscale);
+			}
+		} else if (node->stype == st_timeval && sz >= sizeof(struct timeval)) {
+			sysctl_export_beginnode(e, item, "seconds", NULL, 0);
+			sysctl_export_enddouble(e, ((struct timeval *)buf)->tv_sec + ((struct timeval *)buf)->tv_usec / 1e6);
+		} else if (item->st && sz == item->st->size) {
+			sysctl_export_fields(e, item, buf, item->st->fields, item->st->nfields, path, 0, -1);
+		}
+		break;
+	}
+}
+
+static void
+sysctl_export_mount(sysctl_exporter_t *e, const char *path)
+{
+	struct statvfs st;
+	uint64_t values[5];
+	int i;
+
+	luaA_stats_syscall(sizeof(st));
+	if (statvfs(path, &st))
+		return;
+	values[0] = (uint64_t)st.f_blocks * st.f_frsize;
+	values[1] = (uint64_t)st.f_bfree * st.f_frsize;
+	values[2] = (uint64_t)st.f_bavail * st.f_frsize;
+	values[3] = st.f_files;
+	values[4] = st.f_ffree;
+
+	for (i = 0; i < 5; i++) {
+		sysctl_export_begin(e, e->fshelp[i], e->strings.data + e->fsfamily[i], NULL);
+		sysctl_export_label(e, "mountpoint", path, strlen(path));
+		sysctl_export_enduint(e, values[i]);
+	}
+}
+
+static const char *sysctl_export_base;
+
+/* group samples by family, keeping their order within family */
+static int
+sysctl_export_cmp(const void *a, const void *b)
+{
+	const sysctl_export_rec_t *ra = a, *rb = b;
+	int result = strcmp(sysctl_export_base + ra->sample, sysctl_export_base + rb->sample);
+
+	if (result) return result;
+	return ra->seq < rb->seq? -1: ra->seq > rb->seq;
+}
+
+/* render all samples into out buffer, 0 or -1 if out of memory */
+static int
+sysctl_export_render(sysctl_exporter_t *e)
+{
+	const char *family, *prev = NULL;
+	size_t i;
+
+	e->samples.len = e->out.len = e->nrecs = 0;
+	e->samples.failed = e->out.failed = 0;
+
+	for (i = 0; i < e->nitems; i++)
+		sysctl_export_node(e, &e->items[i]);
+	for (i = 0; i < e->nmounts; i++)
+		sysctl_export_mount(e, e->strings.data + e->mounts[i]);
+	if (e->samples.failed)
+		return (-1);
+
+	sysctl_export_base = e->samples.data;
+	qsort(e->recs, e->nrecs, sizeof(sysctl_export_rec_t), sysctl_export_cmp);
+
+	for (i = 0; i < e->nrecs; i++) {
+		family = e->samples.data + e->recs[i].sample;
+		if (prev == NULL || strcmp(prev, family) != 0) {
+			if (e->recs[i].help != SYSCTL_EXPORT_NOHELP)
+				sysctl_buf_printf(&e->out, "# HELP %s %s\n", family, e->strings.data + e->recs[i].help);
+			sysctl_buf_printf(&e->out, "# TYPE %s untyped\n", family);
+			prev = family;
+		}
+		sysctl_buf_puts(&e->out, family);
+		sysctl_buf_puts(&e->out, family + strlen(family) + 1);
+		sysctl_buf_add(&e->out, "\n", 1);
+	}
+	return e->out.failed? -1: 0;
+}
+
+static void
+sysctl_export_close(sysctl_exporter_t *e)
+{
+	if (e->fd >= 0)
+		close(e->fd);
+	if (e->path) {
+		unlink(e->path);
+		free(e->path);
+	}
+	e->fd = -1;
+	e->path = NULL;
+}
+
+/* listen on unix socket ("unix:/path" or "/path") or loopback tcp port */
+static const char*
+sysctl_export_listen(sysctl_exporter_t *e, lua_State *L, int idx)
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	struct stat st;
+	const char *addr = NULL;
+	int fd, err, on = 1;
+
+	sysctl_export_close(e);
+
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(lua_tointeger(L, idx));
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+			return strerror(errno);
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+			goto failed;
+	} else {
+		addr = luaL_checkstring(L, idx);
+		if (strncmp(addr, "unix:", 5) == 0)
+			addr += 5;
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(addr) >= sizeof(sun.sun_path))
+			return "socket path is too long";
+		strcpy(sun.sun_path, addr);
+		if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+			return strerror(errno);
+		/* stale socket of previous run, but nothing else */
+		if (lstat(addr, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(addr);
+		if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)))
+			goto failed;
+	}
+
+	if (listen(fd, 16) || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		goto failed;
+	e->fd = fd;
+	if (addr)
+		e->path = strdup(addr);
+	return NULL;
+
+failed:
+	err = errno;
+	close(fd);
+	return strerror(err);
+}
+
+/* wait until fd is ready or deadline (ms of monotonic clock) passes */
+static int
+sysctl_export_wait(int fd, short events, int64_t deadline)
+{
+	struct pollfd pfd;
+	struct timespec now;
+	int64_t left;
+	int n;
+
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = deadline - ((int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+		if (left <= 0)
+			return (-1);
+		pfd.fd = fd;
+		pfd.events = events;
+		if ((n = poll(&pfd, 1, (int)left)) > 0)
+			return (0);
+		if (n == 0 || errno != EINTR)
+			return (-1);
+	}
+}
+
+static int
+sysctl_export_write(int fd, const char *data, size_t len, int64_t deadline)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, data, len, MSG_NOSIGNAL);
+		luaA_stats_syscall(n > 0? n: 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN && sysctl_export_wait(fd, POLLOUT, deadline) == 0) continue;
+			return (-1);
+		}
+		data += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * read request head, answer GET or HEAD with fresh render, socket is
+ * non-blocking and whole exchange has one deadline, so slow client
+ * can't hold caller for longer than SYSCTL_EXPORT_TIMEOUT
+ */
+static void
+sysctl_export_respond(sysctl_exporter_t *e, int fd)
+{
+	static const char notallowed[] = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\n\r\n";
+	static const char failed[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+	char req[SYSCTL_EXPORT_MAXREQ], head[128];
+	struct timespec now;
+	int64_t deadline;
+	size_t len = 0;
+	ssize_t n;
+	int get, body;
+
+	/* accepted socket doesn't inherit O_NONBLOCK everywhere */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 + SYSCTL_EXPORT_TIMEOUT;
+
+	while (len < sizeof(req) - 1) {
+		n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		luaA_stats_syscall(n > 0? n: 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN && sysctl_export_wait(fd, POLLIN, deadline) == 0) continue;
+			break;
+		}
+		if (n == 0)
+			break;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+
+	get = strncmp(req, "GET ", 4) == 0;
+	body = get || strncmp(req, "HEAD ", 5) == 0;
+	if (!body) {
+		sysctl_export_write(fd, notallowed, sizeof(notallowed) - 1, deadline);
+		return;
+	}
+	if (sysctl_export_render(e)) {
+		sysctl_export_write(fd, failed, sizeof(failed) - 1, deadline);
+		return;
+	}
+
+	n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\n\r\n",
+		(unsigned long)e->out.len);
+	if (sysctl_export_write(fd, head, n, deadline) == 0 && get)
+		sysctl_export_write(fd, e->out.data, e->out.len, deadline);
+}
+
+/*
+ * sysctl.exporter{ nodes = { name, pattern or node, ... }, mounts = { path, ... },
+ *                  prefix = "", listen = port or "unix:/path" }
+ * Names with wildcards or names of subtrees add every readable node under
+ * them (see sysctl.find), mounts are reported with statvfs(3).
+ */
+static int
+luaA_sysctl_pushexporter(lua_State *L, int idx)
+{
+	static const char *fsfamilies[] = { "fs_size_bytes", "fs_free_bytes", "fs_avail_bytes", "fs_files", "fs_files_free" };
+	static const char *fshelps[] = {
+		"Size of file system in bytes.",
+		"Free space in bytes.",
+		"Free space available to unprivileged users in bytes.",
+		"Total file nodes.",
+		"Free file nodes."
+	};
+	sysctl_exporter_t *e;
+	sysctl_node_t *node;
+	const char *name, *prefix, *error;
+	char *nodename;
+	size_t i, n;
+	int result;
+
+	luaL_checktype(L, idx, LUA_TTABLE);
+	luaA_gettable(L, idx, "prefix", string, prefix);
+
+	e = lua_newuserdata(L, sizeof(sysctl_exporter_t));
+	memset(e, 0, sizeof(sysctl_exporter_t));
+	e->fd = -1;
+	luaL_getmetatable(L, "sysctl_exporter");
+	lua_setmetatable(L, -2);
+
+	prefix = prefix? prefix: "";
+	e->prefix = e->strings.len;
+	sysctl_buf_putname(&e->strings, prefix, strlen(prefix), 0);
+	sysctl_buf_add(&e->strings, "", 1);
+	for (i = 0; i < 5; i++) {
+		e->fsfamily[i] = e->strings.len;
+		sysctl_buf_putname(&e->strings, prefix, strlen(prefix), 0);
+		sysctl_buf_addstr(&e->strings, fsfamilies[i]);
+		e->fshelp[i] = sysctl_buf_addstr(&e->strings, fshelps[i]);
+	}
+
+	lua_getfield(L, idx, "nodes");
+	n = lua_istable(L, -1)? lua_objlen(L, -1): 0;
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, -1, i + 1);
+		if (lua_isuserdata(L, -1)) {
+			node = luaL_checkudata(L, -1, "sysctl_node");
+			if ((nodename = sysctl_info(node, sm_name)) == NULL)
+				return luaL_error(L, "can't get name of node #%d", (int)i + 1);
+			result = node->getter? sysctl_export_additem(e, node, nodename): -1;
+			free(nodename);
+		} else {
+			name = luaL_checkstring(L, -1);
+			node = NULL;
+			if (name[strcspn(name, "*?")] == '\0' && (node = sysctl_cache_lookup(name)) == NULL)
+				result = -1;
+			else if (node && node->fmt[0] != 'N')
+				result = node->getter? sysctl_export_additem(e, node, name): -1;
+			else
+				result = sysctl_export_addglob(e, name);
+		}
+		if (result)
+			return luaL_error(L, "can't export node #%d", (int)i + 1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, idx, "mounts");
+	n = lua_istable(L, -1)? lua_objlen(L, -1): 0;
+	for (i = 0; i < n; i++) {
+		lua_rawgeti(L, -1, i + 1);
+		if (sysctl_index_grow((void **)&e->mounts, &e->maxmounts, e->nmounts + 1, sizeof(uint32_t)))
+			return luaL_error(L, "out of memory creating exporter");
+		e->mounts[e->nmounts++] = sysctl_buf_addstr(&e->strings, luaL_checkstring(L, -1));
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	if (e->strings.failed)
+		return luaL_error(L, "out of memory creating exporter");
+
+	lua_getfield(L, idx, "listen");
+	if (!lua_isnil(L, -1) && (error = sysctl_export_listen(e, L, lua_gettop(L))) != NULL)
+		return luaL_error(L, "can't listen: %s", error);
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+#define SYSCTL_EXPORTER_METHOD(name) LUAA_FUNC(sysctl_exporter_##name)
+
+/* exporter:render() returns exposition text */
+SYSCTL_EXPORTER_METHOD(render)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+
+	if (sysctl_export_render(e))
+		return luaL_error(L, "out of memory rendering metrics");
+	lua_pushlstring(L, e->out.data? e->out.data: "", e->out.len);
+	return 1;
+}
+
+/* exporter:listen(port or "unix:/path") returns true or nil and error */
+SYSCTL_EXPORTER_METHOD(listen)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+	const char *error = sysctl_export_listen(e, L, 2);
+
+	if (error) {
+		lua_pushnil(L);
+		lua_pushstring(L, error);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+ * exporter:serve([timeout]) waits up to timeout seconds (0 by default,
+ * negative to wait forever) for connections, answers all pending ones
+ * and returns their number
+ */
+SYSCTL_EXPORTER_METHOD(serve)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+	double timeout = luaL_optnumber(L, 2, 0);
+	struct pollfd pfd;
+	int fd, n = 0;
+
+	if (e->fd < 0)
+		return luaL_error(L, "exporter is not listening");
+
+	pfd.fd = e->fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout < 0? -1: (int)(timeout * 1000)) <= 0) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	while ((fd = accept(e->fd, NULL, NULL)) >= 0) {
+		sysctl_export_respond(e, fd);
+		close(fd);
+		n++;
 	}
 
-	(*node)->sz = 0;
-	sysctl((*node)->mib, (*node)->mlen, NULL, &((*node)->sz), NULL, 0); /* prefetch size */
-	(*node)->getter = (flags & CTLFLAG_RD)? get_getter_by_type((*node)->type, (*node)->fmt, (*node)->stype): NULL;
-	(*node)->setter = (flags & CTLFLAG_WR)? get_setter_by_type((*node)->type, (*node)->fmt, (*node)->stype): NULL;
+	lua_pushinteger(L, n);
+	return 1;
+}
 
-	return (0);
+/* exporter:fd() returns listening socket to poll in other event loop */
+SYSCTL_EXPORTER_METHOD(fd)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+
+	if (e->fd < 0)
+		return 0;
+	lua_pushinteger(L, e->fd);
+	return 1;
+}
+
+SYSCTL_EXPORTER_METHOD(close)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+	sysctl_export_close(e);
+	return 0;
+}
+
+SYSCTL_EXPORTER_METHOD(index)
+{
+	luaA_checkmetaindex(L, "sysctl_exporter");
+	return 0;
+}
+
+SYSCTL_EXPORTER_METHOD(tostring)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+	lua_pushfstring(L, "sysctl_exporter: %d nodes, %d mounts", (int)e->nitems, (int)e->nmounts);
+	return 1;
+}
+
+SYSCTL_EXPORTER_METHOD(gc)
+{
+	sysctl_exporter_t *e = luaL_checkudata(L, 1, "sysctl_exporter");
+
+	sysctl_export_close(e);
+	free(e->items);
+	free(e->mounts);
+	free(e->recs);
+	free(e->strings.data);
+	free(e->samples.data);
+	free(e->out.data);
+	return 0;
 }
+
 /* }}} */
 
 /* sysctl node methods {{{ */
 
-#define SYSCTL_NODE_METHOD(name) static int luaA_sysctl_node_##name (lua_State *L)
+#define SYSCTL_NODE_METHOD(name) LUAA_FUNC(sysctl_node_##name)
 
 SYSCTL_NODE_METHOD(tostring)
 {
 	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
-	char *name = sysctl_info(node, sm_name);
 
-	if (name) {
+	if (luaA_sysctl_pushname(L, node)) {
 		char access[3] = "--\0";
 		char fmt[3] = "\0\0\0";
 		if (node->getter) access[0] = 'r';
@@ -821,8 +4351,7 @@ SYSCTL_NODE_METHOD(tostring)
 		fmt[0] = node->fmt[0];
 		fmt[1] = node->fmt[1];
 
-		lua_pushfstring(L, "[udata sysctl_node(%s) %s%s(%d) %s]", name, fmt, st_names[node->stype], node->sz, access);
-		free(name);
+		lua_pushfstring(L, "[udata sysctl_node(%s) %s%s(%d) %s]", lua_tostring(L, -1), fmt, st_names[node->stype], node->sz, access);
 		return 1;
 	}
 	return 0;
@@ -844,16 +4373,52 @@ SYSCTL_NODE_METHOD(get)
 	int result = 0;
 
 	if (node->getter) {
-		void *buf = sysctl_get(node);
-		if (buf) {
+		void *buf = sysctl_get_scratch(node);
+		if (buf)
 			result = node->getter(L, buf, node->sz);
-			free(buf);
-		}
 	}
 
 	return result;
 }
 
+/* raw value bytes, e.g. to record node into snapshot */
+SYSCTL_NODE_METHOD(raw)
+{
+	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
+	void *buf;
+
+	if (node->getter && (buf = sysctl_get_scratch(node))) {
+		lua_pushlstring(L, buf, node->sz);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* node:array([arr]) reads numeric node into packed array, arr is refilled if given */
+SYSCTL_NODE_METHOD(array)
+{
+	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
+	void *buf;
+
+	if (node->getter && (buf = sysctl_get_scratch(node)))
+		return luaA_sysctl_pusharray(L, node->fmt, buf, node->sz, 2);
+
+	return 0;
+}
+
+SYSCTL_NODE_METHOD(view)
+{
+	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
+	return luaA_sysctl_pushview(L, node);
+}
+
+SYSCTL_NODE_METHOD(compile)
+{
+	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
+	return luaA_sysctl_pushcompiled(L, node);
+}
+
 SYSCTL_NODE_METHOD(next)
 {
 	sysctl_node_t *node = NULL;
@@ -873,8 +4438,6 @@ SYSCTL_NODE_METHOD(next)
 	newnode = lua_newuserdata(L, sizeof(sysctl_node_t));
 
 	memcpy(newnode, node, sizeof(sysctl_node_t));
-	if ((newnode->mib = calloc(node->mlen, sizeof(int))) == NULL) goto node_next_failed; 
-	memcpy(newnode->mib, node->mib, node->mlen * sizeof(int));
 
 	if (sysctl_next(newnode) || sysctl_type(newnode, &flags))
 		goto node_next_failed;
@@ -885,8 +4448,8 @@ SYSCTL_NODE_METHOD(next)
 			if (newnode->mib[i] != state->mib[i]) goto node_next_failed;
 	}
 
-	newnode->getter = (flags & CTLFLAG_RD)? get_getter_by_type(node->type, node->fmt, node->stype): NULL;
-	newnode->setter = (flags & CTLFLAG_WR)? get_setter_by_type(node->type, node->fmt, node->stype): NULL;
+	newnode->getter = (flags & CTLFLAG_RD)? get_getter_by_type(newnode->type, newnode->fmt, newnode->stype): NULL;
+	newnode->setter = (flags & CTLFLAG_WR)? get_setter_by_type(newnode->type, newnode->fmt, newnode->stype): NULL;
 	newnode->sz = 0;
 
 	luaL_getmetatable(L, "sysctl_node");
@@ -905,12 +4468,10 @@ SYSCTL_NODE_METHOD(node)
 	sysctl_node_t *newnode;
 
 	int i, top = lua_gettop(L) - 1;
-	if (top < 1) return 0;
+	if (top < 1 || node->mlen + top > CTL_MAXNAME) return 0;
 
 	newnode = lua_newuserdata(L, sizeof(sysctl_node_t));
 	newnode->mlen = node->mlen + top;
-	if ((newnode->mib = calloc(newnode->mlen, sizeof(int))) == NULL)
-		goto sysctl_node_node_failed_nofree;
 
 	memcpy(newnode->mib, node->mib, node->mlen * sizeof(int));
 	for (i = 0; i < top; i++) {
@@ -926,8 +4487,6 @@ SYSCTL_NODE_METHOD(node)
 	return 1;
 
 sysctl_node_node_failed:
-	free(newnode->mib);
-sysctl_node_node_failed_nofree:
 	lua_pop(L, 1);
 	return 0;
 }
@@ -953,14 +4512,10 @@ SYSCTL_NODE_METHOD(index)
 		return luaA_sysctl_node_get(L);
 	else {
 		sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
-		if (strcmp(index, "name") == 0 || strcmp(index, "desc") == 0) {
-			char *name = sysctl_info(node, *index == 'n'? sm_name: sm_desc);
-			if (name) {
-				lua_pushstring(L, name);
-				free(name);
-			} else {
-				result = 0;
-			}
+		if (strcmp(index, "name") == 0) {
+			result = luaA_sysctl_pushname(L, node);
+		} else if (strcmp(index, "desc") == 0) {
+			result = luaA_sysctl_pushdesc(L, node);
 		} else if (strcmp(index, "type") == 0) {
 			lua_pushnumber(L, node->type);
 		} else if (strcmp(index, "struct") == 0) {
@@ -968,7 +4523,7 @@ SYSCTL_NODE_METHOD(index)
 		} else if (strcmp(index, "readonly") == 0) {
 			lua_pushboolean(L, node->setter == NULL);
 		} else if (strcmp(index, "format") == 0) {
-			lua_pushlstring(L, node->fmt, 2);
+			result = luaA_sysctl_pushformat(L, node);
 		} else {
 			result = 0;
 		}
@@ -994,7 +4549,7 @@ SYSCTL_NODE_METHOD(eq)
 	sysctl_node_t *node2 = luaL_checkudata(L, 2, "sysctl_node");
 	int i, result = 1;
 
-	if (node1->mib != node2->mib) {
+	if (node1 != node2) {
 		if (node1->mlen == node2->mlen) {
 			for (i = 0; i < node1->mlen; i++) {
 				if (node1->mib[i] != node2->mib[i]) {
@@ -1011,52 +4566,32 @@ SYSCTL_NODE_METHOD(eq)
 	return 1;
 }
 
-SYSCTL_NODE_METHOD(gc)
-{
-	sysctl_node_t *node = luaL_checkudata(L, 1, "sysctl_node");
-	if (node->mib) free(node->mib);
-	return 0;
-}
-
 /* }}} */
 
 /* sysctl methods {{{ */
 
-#define SYSCTL_METHOD(name) static int luaA_sysctl_##name (lua_State *L)
+#define SYSCTL_METHOD(name) LUAA_FUNC(sysctl_##name)
 
 SYSCTL_METHOD(set)
 {
 	const char* nodename = luaL_checkstring(L, 1);
-	sysctl_node_t *node = NULL;
-	int result = 0;
+	sysctl_node_t *node = sysctl_cache_lookup(nodename);
 
-	if (sysctl_newnode(&node, nodename) == 0) {
-		if (node->setter)
-			result = node->setter(L, node, 2);
-		if (node->mib) free(node->mib);
-		free(node);
-	}
+	if (node && node->setter)
+		return node->setter(L, node, 2);
 
-	return result;
+	return 0;
 }
 
 SYSCTL_METHOD(get)
 {
 	const char* nodename = luaL_checkstring(L, 1);
-	sysctl_node_t *node = NULL;
+	sysctl_node_t *node;
 	int result = 0;
-	
-	if (sysctl_newnode(&node, nodename) == 0) {
-		if (node->getter) {
-			void *buf = sysctl_get(node);
-			if (buf) {
-				result = node->getter(L, buf, node->sz);
-				free(buf);
-			}
-		}
-		if (node->mib) free(node->mib);
-		free(node);
-	}
+	void *buf = sysctl_cache_get(nodename, &node);
+
+	if (buf)
+		result = node->getter(L, buf, node->sz);
 
 	return result;
 }
@@ -1064,20 +4599,381 @@ SYSCTL_METHOD(get)
 SYSCTL_METHOD(node)
 {
 	const char* nodename = luaL_checkstring(L, 1);
-	sysctl_node_t *node = lua_newuserdata(L, sizeof(sysctl_node_t));
 
-	if (sysctl_newnode(&node, nodename)) {
-		lua_pop(L, 1);
+	if (luaA_sysctl_pushnode(L, nodename) == NULL)
 		/*return luaL_error(L, "not a sysctl node name %s", nodename);*/
 		return 0;
+
+	return 1;
+}
+
+/* sysctl.set_many{ { name or node, value }, ... } */
+SYSCTL_METHOD(set_many)
+{
+	return luaA_sysctl_setmany(L);
+}
+
+/* sysctl.get_many{ "name", node, ... } returns table of values keyed by names or nodes */
+SYSCTL_METHOD(get_many)
+{
+	sysctl_node_t *node;
+	void *buf;
+	int i, n, len;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	len = lua_objlen(L, 1);
+	lua_createtable(L, 0, len);
+
+	for (i = 1; i <= len; i++) {
+		lua_rawgeti(L, 1, i);
+		if (lua_isuserdata(L, -1)) {
+			node = luaL_checkudata(L, -1, "sysctl_node");
+			buf = node->getter? sysctl_get_scratch(node): NULL;
+		} else {
+			buf = sysctl_cache_get(luaL_checkstring(L, -1), &node);
+		}
+
+		n = 0;
+		if (buf) {
+			/* numeric arrays push one value per item */
+			if (strchr("ILQ", node->fmt[0]))
+				luaL_checkstack(L, node->sz / sizeof(int) + LUA_MINSTACK, "too many values");
+			n = node->getter(L, buf, node->sz);
+		}
+
+		if (n > 1)
+			luaA_sysctl_packvalues(L, n);
+		if (n > 0)
+			lua_rawset(L, -3);
+		else
+			lua_pop(L, 1);
+	}
+
+	return 1;
+}
+
+/* sysctl.array(name [, arr]) */
+SYSCTL_METHOD(array)
+{
+	sysctl_node_t *node;
+	void *buf = sysctl_cache_get(luaL_checkstring(L, 1), &node);
+
+	if (buf)
+		return luaA_sysctl_pusharray(L, node->fmt, buf, node->sz, 2);
+
+	return 0;
+}
+
+SYSCTL_METHOD(view)
+{
+	const char* nodename = luaL_checkstring(L, 1);
+	sysctl_node_t *node = sysctl_cache_lookup(nodename);
+
+	if (node)
+		return luaA_sysctl_pushview(L, node);
+
+	return 0;
+}
+
+SYSCTL_METHOD(compile)
+{
+	const char* nodename = luaL_checkstring(L, 1);
+	sysctl_node_t *node = sysctl_cache_lookup(nodename);
+
+	if (node)
+		return luaA_sysctl_pushcompiled(L, node);
+
+	return 0;
+}
+
+/*
+ * sysctl.index() (re)builds index from kernel tree,
+ * sysctl.index(snapshot) builds it from snapshot table (see sysctlrec.lua)
+ */
+SYSCTL_METHOD(index)
+{
+	int i;
+
+	if (lua_isnoneornil(L, 1)) {
+		if (sysctl_index_build())
+			return 0;
+	} else {
+		luaL_checktype(L, 1, LUA_TTABLE);
+		sysctl_index_clear();
+		for (i = 1; ; i++) {
+			const char *name, *fmt;
+			int rw;
+
+			lua_rawgeti(L, 1, i);
+			if (lua_isnil(L, -1)) {
+				lua_pop(L, 1);
+				break;
+			}
+			luaL_checktype(L, -1, LUA_TTABLE);
+			luaA_gettable(L, -1, "name", string, name);
+			luaA_gettable(L, -1, "fmt", string, fmt);
+			luaA_gettable(L, -1, "rw", boolean, rw);
+			if (name == NULL)
+				return luaL_error(L, "snapshot entry #%d has no name", i);
+			if (fmt == NULL)
+				fmt = "";
+			if (sysctl_index_add(name, fmt, sysctl_kind_by_fmt(fmt) | CTLFLAG_RD | (rw? CTLFLAG_WR: 0)))
+				return luaL_error(L, "out of memory building index");
+			lua_pop(L, 1);
+		}
+		sysctl_index_sort();
+	}
+
+	lua_pushnumber(L, sysctl_idx.nentries);
+	return 1;
+}
+
+/* sysctl.find(pattern) returns array of matching node names, see sysctl_glob */
+SYSCTL_METHOD(find)
+{
+	const char *pattern = luaL_checkstring(L, 1);
+	size_t i, prefix = strcspn(pattern, "*?");
+	int n = 0;
+
+	if (sysctl_idx.nentries == 0 && sysctl_index_build())
+		return 0;
+
+	lua_newtable(L);
+	/* literal part of pattern narrows range with binary search */
+	for (i = sysctl_index_lower_bound(pattern, prefix); i < sysctl_idx.nentries; i++) {
+		const char *name = sysctl_idx.names + sysctl_idx.entries[i].name;
+		if (strncmp(name, pattern, prefix) != 0)
+			break;
+		if (sysctl_glob(pattern, name)) {
+			luaA_isettable(L, -2, ++n, string, name);
+		}
+	}
+
+	return 1;
+}
+
+SYSCTL_METHOD(rate)
+{
+	sysctl_node_t *node = sysctl_cache_lookup(luaL_checkstring(L, 1));
+
+	if (node && node->getter)
+		return luaA_sysctl_pushrate(L, node, 2);
+
+	return 0;
+}
+
+SYSCTL_METHOD(history)
+{
+	sysctl_node_t *node = sysctl_cache_lookup(luaL_checkstring(L, 1));
+
+	if (node && node->getter)
+		return luaA_sysctl_pushhistory(L, node);
+
+	return 0;
+}
+
+/* sysctl.history_file(path [, capacity [, steps [, slots]]]), see luahistfile.h */
+SYSCTL_METHOD(history_file)
+{
+	return luaA_histfile_open(L);
+}
+
+/* sysctl.series([blocksize]) makes compressed series, see luaseries.h */
+SYSCTL_METHOD(series)
+{
+	luaA_series_new(L, luaL_optinteger(L, 1, LUAA_SERIES_BLOCKSIZE));
+	return 1;
+}
+
+/* sysctl.watch{ name or node, ... } */
+SYSCTL_METHOD(watch)
+{
+	return luaA_sysctl_pushwatch(L, 1);
+}
+
+/* sysctl.exporter{ nodes = {...}, mounts = {...}, prefix = "", listen = port or path } */
+SYSCTL_METHOD(exporter)
+{
+	return luaA_sysctl_pushexporter(L, 1);
+}
+
+/* sysctl.sampler{ nodes = {...}, interval = 1, start = true } */
+SYSCTL_METHOD(sampler)
+{
+	return luaA_sysctl_pushsampler(L, 1);
+}
+
+SYSCTL_METHOD(flush_cache)
+{
+	sysctl_cache_flush();
+	luaA_sysctl_flushmeta(L);
+	return 0;
+}
+
+/*
+ * sysctl.describe([prefix]) fetches name, description and format of all
+ * nodes under prefix (whole tree by default) into metadata cache,
+ * returns number of nodes described
+ */
+SYSCTL_METHOD(describe)
+{
+	sysctl_node_t node, prefix;
+	int n = 0;
+
+	if (lua_isnoneornil(L, 1)) {
+		prefix.mlen = 0;
+		if (sysctl_first(&node))
+			return 0;
 	} else {
-		luaL_getmetatable(L, "sysctl_node");
-		lua_setmetatable(L, -2);
+		if (sysctl_mib(&prefix, luaL_checkstring(L, 1)))
+			return 0;
+		node = prefix;
+	}
+
+	do {
+		/* stop as soon as walk leaves prefix subtree */
+		if (node.mlen < prefix.mlen || memcmp(node.mib, prefix.mib, prefix.mlen * sizeof(int)))
+			break;
+		if (luaA_sysctl_pushname(L, &node) + luaA_sysctl_pushdesc(L, &node) + luaA_sysctl_pushformat(L, &node))
+			n++;
+		lua_settop(L, 1);
+	} while (sysctl_next(&node) == 0);
+
+	lua_pushnumber(L, n);
+	return 1;
+}
+
+SYSCTL_METHOD(cache_stats)
+{
+	lua_createtable(L, 0, 3);
+	luaA_settable(L, -2, "hits", number, sysctl_cache_hits);
+	luaA_settable(L, -2, "misses", number, sysctl_cache_misses);
+	luaA_settable(L, -2, "size", number, sysctl_cache_size);
+	return 1;
+}
+
+#ifdef SYSCTL_FAKE
+/* pack lua value at idx into raw node buffer according to format */
+static void*
+fake_pack(lua_State *L, int idx, const char *fmt, size_t *sz)
+{
+	size_t i, n, elsz;
+	void *value;
+
+	if (lua_type(L, idx) == LUA_TSTRING || (*fmt != 'I' && *fmt != 'L' && *fmt != 'Q')) {
+		const char *str = luaL_checklstring(L, idx, &n);
+		/* strings keep their terminating zero just like kernel ones */
+		*sz = *fmt == 'A' && (n == 0 || str[n - 1] != '\0')? n + 1: n;
+		if ((value = malloc(*sz? *sz: 1)) == NULL) return NULL;
+		memcpy(value, str, *sz);
+		return value;
+	}
+
+	elsz = *fmt == 'I'? sizeof(int): (*fmt == 'L'? sizeof(long): sizeof(quad_t));
+	n = lua_istable(L, idx)? lua_objlen(L, idx): 1;
+	*sz = n * elsz;
+	if ((value = malloc(*sz? *sz: 1)) == NULL) return NULL;
+
+	for (i = 0; i < n; i++) {
+		lua_Number num;
+		if (lua_istable(L, idx)) {
+			luaA_igettable(L, idx, i + 1, number, num);
+		} else {
+			num = luaL_checknumber(L, idx);
+		}
+		switch (*fmt) {
+		case 'I':
+			if (fmt[1] == 'U') ((unsigned int *)value)[i] = num;
+			else ((int *)value)[i] = num;
+			break;
+		case 'L':
+			if (fmt[1] == 'U') ((unsigned long *)value)[i] = num;
+			else ((long *)value)[i] = num;
+			break;
+		default:
+			((quad_t *)value)[i] = num;
+		}
 	}
+	return value;
+}
+
+/*
+ * sysctl.fake{ { name = "kern.hz", fmt = "I", value = 100, desc = "...", rw = true }, ... }
+ * replaces whole fake tree, numeric values may be numbers or arrays,
+ * any value may be given as raw byte string (see sysctlrec.lua),
+ * fail = true (or errno) makes writes to node fail
+ */
+SYSCTL_METHOD(fake)
+{
+	int i;
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	sysctl_cache_flush();
+	sysctl_index_clear();
+	luaA_sysctl_flushmeta(L);
+	pthread_mutex_lock(&fake_lock);
+	fake_clear();
+	pthread_mutex_unlock(&fake_lock);
+
+	for (i = 1; ; i++) {
+		fake_oid_t *oid;
+		const char *name, *fmt, *desc;
+		u_int kind;
+		int rw, wrerr;
+		void *value = NULL;
+		size_t sz = 0;
+
+		lua_rawgeti(L, 1, i);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+		luaL_checktype(L, -1, LUA_TTABLE);
+
+		luaA_gettable(L, -1, "name", string, name);
+		luaA_gettable(L, -1, "fmt", string, fmt);
+		luaA_gettable(L, -1, "desc", string, desc);
+		luaA_gettable(L, -1, "rw", boolean, rw);
+		lua_getfield(L, -1, "fail");
+		wrerr = lua_isnumber(L, -1)? lua_tointeger(L, -1): (lua_toboolean(L, -1)? EINVAL: 0);
+		lua_pop(L, 1);
+		if (name == NULL)
+			return luaL_error(L, "fake node #%d has no name", i);
+
+		lua_getfield(L, -1, "value");
+		if (fmt == NULL)
+			fmt = lua_type(L, -1) == LUA_TSTRING? "A": (lua_isnil(L, -1)? "N": "I");
+
+		kind = sysctl_kind_by_fmt(fmt);
+		if (!lua_isnil(L, -1) && (value = fake_pack(L, lua_gettop(L), fmt, &sz)) == NULL)
+			return luaL_error(L, "can't set fake node %s value", name);
+
+		/* no lua errors while tree is locked */
+		pthread_mutex_lock(&fake_lock);
+		if ((oid = fake_add(name)) != NULL) {
+			oid->kind = kind | CTLFLAG_RD | (rw? CTLFLAG_WR: 0);
+			oid->wrerr = wrerr;
+			free(oid->fmt);
+			oid->fmt = strdup(fmt);
+			free(oid->desc);
+			oid->desc = desc? strdup(desc): NULL;
+			free(oid->value);
+			oid->value = value;
+			oid->sz = sz;
+		}
+		pthread_mutex_unlock(&fake_lock);
+		if (oid == NULL) {
+			free(value);
+			return luaL_error(L, "can't add fake node %s", name);
+		}
 
+		lua_pop(L, 2);
+	}
 
+	lua_pushnumber(L, fake_noids);
 	return 1;
 }
+#endif
 
 SYSCTL_METHOD(each)
 {
@@ -1089,23 +4985,21 @@ SYSCTL_METHOD(each)
 	if (lua_isuserdata(L, 1)) {
 		node = luaL_checkudata(L, 1, "sysctl_node");
 		lua_pushvalue(L, 1);
+	} else if (lua_isstring(L, 1)) {
+		const char* nodename = luaL_checkstring(L, 1);
+		if (luaA_sysctl_pushnode(L, nodename) == NULL) {
+			lua_pop(L, 1);
+			/*return luaL_error(L, "not a sysctl node name %s", nodename);*/
+			return 0;
+		}
 	} else {
 		node = lua_newuserdata(L, sizeof(sysctl_node_t));
-		if (lua_isstring(L, 1)) {
-			const char* nodename = luaL_checkstring(L, 1);
-			if (sysctl_newnode(&node, nodename)) {
-				lua_pop(L, 2);
-				/*return luaL_error(L, "not a sysctl node name %s", nodename);*/
-				return 0;
-			}
-		} else {
-			if (sysctl_first(node) || sysctl_newnode(&node, NULL)) {
-				lua_pop(L, 2);
-				/*return luaL_error(L, "couldn't fetch first node");*/
-				return 0;
-			}
-			stateless = 1;
+		if (sysctl_first(node) || sysctl_newnode(&node, NULL)) {
+			lua_pop(L, 2);
+			/*return luaL_error(L, "couldn't fetch first node");*/
+			return 0;
 		}
+		stateless = 1;
 		luaL_getmetatable(L, "sysctl_node");
 		lua_setmetatable(L, -2);
 	}
@@ -1129,9 +5023,30 @@ SYSCTL_METHOD(each)
 
 static const luaL_reg sysctl_methods[] = {
 	SYSCTL_REG(get),
+	SYSCTL_REG(get_many),
+	SYSCTL_REG(array),
+	SYSCTL_REG(view),
+	SYSCTL_REG(compile),
+	SYSCTL_REG(index),
+	SYSCTL_REG(find),
+	SYSCTL_REG(sampler),
+	SYSCTL_REG(exporter),
+	SYSCTL_REG(rate),
+	SYSCTL_REG(watch),
+	SYSCTL_REG(history),
+	SYSCTL_REG(history_file),
+	SYSCTL_REG(series),
 	SYSCTL_REG(set),
+	SYSCTL_REG(set_many),
 	SYSCTL_REG(node),
 	SYSCTL_REG(each),
+	SYSCTL_REG(describe),
+	SYSCTL_REG(flush_cache),
+	SYSCTL_REG(cache_stats),
+#ifdef SYSCTL_FAKE
+	SYSCTL_REG(fake),
+#endif
+	LUAA_STATS_REG
 
 	SYSCTL_ENDREG
 };
@@ -1139,7 +5054,6 @@ static const luaL_reg sysctl_methods[] = {
 static const luaL_reg sysctl_meta[] = {
 	SYSCTL_NODE_META(index),
 	SYSCTL_NODE_META(newindex),
-	SYSCTL_NODE_META(gc),
 	SYSCTL_NODE_META(tostring),
 	SYSCTL_NODE_META(eq),
 
@@ -1147,11 +5061,110 @@ static const luaL_reg sysctl_meta[] = {
 	SYSCTL_NODE_REG(set),
 	SYSCTL_NODE_REG(node),
 	SYSCTL_NODE_REG(next),
+	SYSCTL_NODE_REG(view),
+	SYSCTL_NODE_REG(compile),
+	SYSCTL_NODE_REG(raw),
+	SYSCTL_NODE_REG(array),
+
+	SYSCTL_ENDREG
+};
+
+#define SYSCTL_VIEW_META(name) {"__" #name, luaA_sysctl_view_##name}
+#define SYSCTL_VIEW_REG(name) {#name, luaA_sysctl_view_##name}
+
+static const luaL_reg sysctl_view_meta[] = {
+	SYSCTL_VIEW_META(index),
+	SYSCTL_VIEW_META(tostring),
+
+	SYSCTL_VIEW_REG(totable),
+
+	SYSCTL_ENDREG
+};
+
+#define SYSCTL_SAMPLER_META(name) {"__" #name, luaA_sysctl_sampler_##name}
+#define SYSCTL_SAMPLER_REG(name) {#name, luaA_sysctl_sampler_##name}
+
+static const luaL_reg sysctl_sampler_meta[] = {
+	SYSCTL_SAMPLER_META(index),
+	SYSCTL_SAMPLER_META(gc),
+	SYSCTL_SAMPLER_META(tostring),
+
+	SYSCTL_SAMPLER_REG(read),
+	SYSCTL_SAMPLER_REG(start),
+	SYSCTL_SAMPLER_REG(stop),
+	SYSCTL_SAMPLER_REG(running),
+
+	SYSCTL_ENDREG
+};
+
+#define SYSCTL_RATE_META(name) {"__" #name, luaA_sysctl_rate_##name}
+#define SYSCTL_RATE_REG(name) {#name, luaA_sysctl_rate_##name}
+
+static const luaL_reg sysctl_rate_meta[] = {
+	SYSCTL_RATE_META(index),
+	SYSCTL_RATE_META(call),
+	SYSCTL_RATE_META(gc),
+
+	SYSCTL_RATE_REG(sample),
+
+	SYSCTL_ENDREG
+};
+
+#define SYSCTL_WATCH_META(name) {"__" #name, luaA_sysctl_watch_##name}
+#define SYSCTL_WATCH_REG(name) {#name, luaA_sysctl_watch_##name}
+
+static const luaL_reg sysctl_watch_meta[] = {
+	SYSCTL_WATCH_META(index),
+	SYSCTL_WATCH_META(call),
+	SYSCTL_WATCH_META(gc),
+
+	SYSCTL_WATCH_REG(poll),
+	SYSCTL_WATCH_REG(reset),
+
+	SYSCTL_ENDREG
+};
+
+#define SYSCTL_EXPORTER_META(name) {"__" #name, luaA_sysctl_exporter_##name}
+#define SYSCTL_EXPORTER_REG(name) {#name, luaA_sysctl_exporter_##name}
+
+static const luaL_reg sysctl_exporter_meta[] = {
+	SYSCTL_EXPORTER_META(index),
+	SYSCTL_EXPORTER_META(gc),
+	SYSCTL_EXPORTER_META(tostring),
+
+	SYSCTL_EXPORTER_REG(render),
+	SYSCTL_EXPORTER_REG(listen),
+	SYSCTL_EXPORTER_REG(serve),
+	SYSCTL_EXPORTER_REG(fd),
+	SYSCTL_EXPORTER_REG(close),
+
+	SYSCTL_ENDREG
+};
+
+static const luaL_reg sysctl_compiled_meta[] = {
+	{"__gc", luaA_sysctl_compiled_gc},
 
 	SYSCTL_ENDREG
 };
 /* }}} */
 
-LUAA_OPEN(sysctl, "sysctl_node", "1.3")
+LUALIB_API int luaopen_sysctl (lua_State *L) {
+	luaA_deftype(L, sysctl_view);
+	luaA_deftype(L, sysctl_compiled);
+	luaA_deftype(L, sysctl_sampler);
+	luaA_deftype(L, sysctl_rate);
+	luaA_deftype(L, sysctl_watch);
+	luaA_deftype(L, sysctl_exporter);
+	luaA_histfile_register(L);
+	luaA_series_register(L);
+	luaL_newmetatable(L, "sysctl_node");
+	luaL_register(L, NULL, sysctl_meta);
+	lua_pop(L, 1);
+	luaL_register(L, "sysctl", sysctl_methods);
+	lua_pushliteral(L, "version");
+	lua_pushliteral(L, "sysctl library for lua 1.3");
+	lua_rawset(L, -3);
+	return 1;
+}
 
 /* vim: set fdm=marker: */
@@ -0,0 +1,159 @@
+#ifndef __LUA_ARRAY__
+
+#define __LUA_ARRAY__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "luahelper.h"
+
+/*
+ * Packed numeric array userdata.
+ *
+ * Numbers are kept in one malloc'ed array of doubles, not on Lua stack
+ * or in a table. Array is 1-based from Lua side, supports # and [],
+ * can be converted with :totable() and refilled in place by its
+ * producer, so repeated polls don't allocate anything once array
+ * is big enough.
+ */
+
+#define LUAA_ARRAY "packed_array"
+
+typedef struct luaA_array_t {
+	size_t len;
+	size_t cap;
+	double *items;
+} luaA_array_t;
+
+/* make sure array can hold n items, contents are kept */
+static inline int
+luaA_array_reserve(luaA_array_t *arr, size_t n)
+{
+	double *items;
+
+	if (n <= arr->cap) return 0;
+	if ((items = realloc(arr->items, n * sizeof(double))) == NULL) return -1;
+	arr->items = items;
+	arr->cap = n;
+	return 0;
+}
+
+/* push new empty array with room for n items */
+static inline luaA_array_t *
+luaA_array_push(lua_State *L, size_t n)
+{
+	luaA_array_t *arr = lua_newuserdata(L, sizeof(luaA_array_t));
+
+	memset(arr, 0, sizeof(luaA_array_t));
+	luaL_getmetatable(L, LUAA_ARRAY);
+	lua_setmetatable(L, -2);
+	if (luaA_array_reserve(arr, n))
+		luaL_error(L, "out of memory allocating array of %d items", (int)n);
+	return arr;
+}
+
+/* array at idx if any, otherwise push new one, so it's always on top */
+static inline luaA_array_t *
+luaA_array_reuse(lua_State *L, int idx, size_t n)
+{
+	luaA_array_t *arr;
+
+	if (lua_isnoneornil(L, idx))
+		return luaA_array_push(L, n);
+
+	arr = luaL_checkudata(L, idx, LUAA_ARRAY);
+	if (luaA_array_reserve(arr, n))
+		luaL_error(L, "out of memory allocating array of %d items", (int)n);
+	lua_pushvalue(L, idx);
+	return arr;
+}
+
+#define LUAA_ARRAY_FILL(name, type) \
+	static inline void luaA_array_fill##name (luaA_array_t *arr, const type *values, size_t n) { \
+		size_t i; \
+		for (i = 0; i < n; i++) \
+			arr->items[i] = values[i]; \
+		arr->len = n; \
+	}
+
+LUAA_ARRAY_FILL(int, int)
+LUAA_ARRAY_FILL(uint, unsigned int)
+LUAA_ARRAY_FILL(long, long)
+LUAA_ARRAY_FILL(ulong, unsigned long)
+LUAA_ARRAY_FILL(int64, int64_t)
+LUAA_ARRAY_FILL(uint64, uint64_t)
+LUAA_ARRAY_FILL(double, double)
+
+#define LUAA_ARRAY_METHOD(name) static int luaA_array_##name (lua_State *L)
+
+LUAA_ARRAY_METHOD(len)
+{
+	luaA_array_t *arr = luaL_checkudata(L, 1, LUAA_ARRAY);
+	lua_pushinteger(L, arr->len);
+	return 1;
+}
+
+LUAA_ARRAY_METHOD(index)
+{
+	luaA_array_t *arr;
+	lua_Integer i;
+
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		luaA_checkmetaindex(L, LUAA_ARRAY);
+		return 0;
+	}
+
+	arr = luaL_checkudata(L, 1, LUAA_ARRAY);
+	i = lua_tointeger(L, 2);
+	if (i < 1 || (size_t)i > arr->len)
+		return 0;
+
+	lua_pushnumber(L, arr->items[i - 1]);
+	return 1;
+}
+
+LUAA_ARRAY_METHOD(totable)
+{
+	luaA_array_t *arr = luaL_checkudata(L, 1, LUAA_ARRAY);
+	size_t i;
+
+	lua_createtable(L, arr->len, 0);
+	for (i = 0; i < arr->len; i++) {
+		luaA_isettable(L, -2, i + 1, number, arr->items[i]);
+	}
+	return 1;
+}
+
+LUAA_ARRAY_METHOD(tostring)
+{
+	luaA_array_t *arr = luaL_checkudata(L, 1, LUAA_ARRAY);
+	lua_pushfstring(L, LUAA_ARRAY ": %d items", (int)arr->len);
+	return 1;
+}
+
+LUAA_ARRAY_METHOD(gc)
+{
+	luaA_array_t *arr = luaL_checkudata(L, 1, LUAA_ARRAY);
+	free(arr->items);
+	return 0;
+}
+
+LUAA_SREG(packed_array_meta)
+LUAA_MREG(array, len)
+LUAA_MREG(array, index)
+LUAA_MREG(array, tostring)
+LUAA_MREG(array, gc)
+LUAA_REG(array, totable)
+LUAA_EREG
+
+/* register array metatable, safe to call from several modules */
+static inline void
+luaA_array_register(lua_State *L)
+{
+	if (luaL_newmetatable(L, LUAA_ARRAY))
+		luaL_register(L, NULL, packed_array_meta);
+	lua_pop(L, 1);
+}
+
+#endif
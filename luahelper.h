@@ -23,8 +23,152 @@
     value = lua_to##luatype(L, -1); \
     lua_pop(L, 1)
 
+/*
+ * Per function call stats, built only with -DLUAA_STATS.
+ *
+ * Every LUAA_FUNC counts its calls and nanoseconds spent (with log2
+ * latency histogram), syscalls issued and bytes moved by them are
+ * counted with luaA_stats_syscall() at syscall sites and go to the
+ * innermost function running in this thread. Functions are listed
+ * per module (i.e. per translation unit) once called for the first
+ * time, LUAA_STATS_REG adds stats() & reset_stats() to module table.
+ * Calls ending in lua error are counted, but their time is not; the
+ * function they leave current is dropped at the next call, once its
+ * frame is known to be gone (stack grows down).
+ */
+#ifdef LUAA_STATS
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define LUAA_STATS_BUCKETS 32
+
+typedef struct luaA_stat_t {
+	const char *name;
+	struct luaA_stat_t *next;
+	int linked;
+	uint64_t calls, syscalls, bytes, ns;
+	uint64_t hist[LUAA_STATS_BUCKETS];
+} luaA_stat_t;
+
+static luaA_stat_t *luaA_stats_head;
+static __thread luaA_stat_t *luaA_stats_current;
+/* stack address of the call that made current one current */
+static __thread void *luaA_stats_frame;
+
+#define luaA_stats_syscall(nbytes) \
+	do { \
+		if (luaA_stats_current) { \
+			luaA_stats_current->syscalls++; \
+			luaA_stats_current->bytes += (nbytes); \
+		} \
+	} while (0)
+
+static inline uint64_t
+luaA_stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int
+luaA_stats_call(lua_State *L, luaA_stat_t *stat, lua_CFunction func)
+{
+	luaA_stat_t *outer;
+	void *outerframe;
+	uint64_t start, ns;
+	int result, bucket;
+
+	/* left by call that ended in lua error, this one runs where it was */
+	if (luaA_stats_current && (char *)luaA_stats_frame <= (char *)&outer)
+		luaA_stats_current = luaA_stats_frame = NULL;
+	outer = luaA_stats_current;
+	outerframe = luaA_stats_frame;
+
+	if (!stat->linked) {
+		stat->next = luaA_stats_head;
+		luaA_stats_head = stat;
+		stat->linked = 1;
+	}
+	stat->calls++;
+	luaA_stats_current = stat;
+	luaA_stats_frame = &outer;
+
+	start = luaA_stats_now();
+	result = func(L);
+	ns = luaA_stats_now() - start;
+
+	/* bucket i holds calls shorter than 2^i ns */
+	bucket = ns? 64 - __builtin_clzll(ns): 0;
+	stat->hist[bucket < LUAA_STATS_BUCKETS? bucket: LUAA_STATS_BUCKETS - 1]++;
+	stat->ns += ns;
+	luaA_stats_current = outer;
+	luaA_stats_frame = outerframe;
+	return result;
+}
+
+/* module.stats() returns { [name] = { calls, syscalls, bytes, ns, hist = { [upper ns] = calls } } } */
+static inline int
+luaA_stats_push(lua_State *L)
+{
+	luaA_stat_t *stat;
+	int i;
+
+	lua_newtable(L);
+	for (stat = luaA_stats_head; stat; stat = stat->next) {
+		lua_createtable(L, 0, 5);
+		luaA_settable(L, -2, "calls", number, stat->calls);
+		luaA_settable(L, -2, "syscalls", number, stat->syscalls);
+		luaA_settable(L, -2, "bytes", number, stat->bytes);
+		luaA_settable(L, -2, "ns", number, stat->ns);
+		lua_newtable(L);
+		for (i = 0; i < LUAA_STATS_BUCKETS; i++) {
+			if (stat->hist[i] == 0) continue;
+			lua_pushnumber(L, (double)(1ULL << i));
+			lua_pushnumber(L, stat->hist[i]);
+			lua_rawset(L, -3);
+		}
+		lua_setfield(L, -2, "hist");
+		lua_setfield(L, -2, stat->name);
+	}
+	return 1;
+}
+
+static inline int
+luaA_stats_reset(lua_State *L)
+{
+	luaA_stat_t *stat;
+
+	(void)L;
+	for (stat = luaA_stats_head; stat; stat = stat->next) {
+		stat->calls = stat->syscalls = stat->bytes = stat->ns = 0;
+		memset(stat->hist, 0, sizeof(stat->hist));
+	}
+	return 0;
+}
+
+#define LUAA_FUNC(name) \
+	static int luaA_##name##_body (lua_State *L); \
+	static int luaA_##name (lua_State *L) { \
+		static luaA_stat_t stat = { #name, NULL, 0, 0, 0, 0, 0, { 0 } }; \
+		return luaA_stats_call(L, &stat, luaA_##name##_body); \
+	} \
+	static int luaA_##name##_body (lua_State *L)
+
+#define LUAA_STATS_REG { "stats", luaA_stats_push }, { "reset_stats", luaA_stats_reset },
+
+#else
+
+#define luaA_stats_syscall(nbytes) do { } while (0)
+
 #define LUAA_FUNC(name) static int luaA_##name (lua_State *L)
 
+#define LUAA_STATS_REG
+
+#endif
+
 #define luaA_settype(L, idx, type) \
 	luaL_getmetatable(L, type); \
 	lua_setmetatable(L, idx)
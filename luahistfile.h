@@ -0,0 +1,447 @@
+#ifndef __LUA_HISTFILE__
+
+#define __LUA_HISTFILE__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "luahistory.h"
+
+/*
+ * Histories kept in memory mapped file.
+ *
+ * File is a fixed header followed by fixed number of equally sized
+ * slots, every slot is sequence number, name and history rings laid
+ * out exactly as in memory. Reopened file is validated and its rings
+ * are used in place, nothing is parsed or copied until range() asks.
+ * Sequence number of slot is odd while it's updated, so slot left
+ * half-written by a crash is found and cleared on next open.
+ */
+
+#define LUAA_HISTFILE "history_file"
+#define LUAA_HISTFILE_MAGIC "LUAHIST"
+#define LUAA_HISTFILE_VERSION 1
+#define LUAA_HISTFILE_ORDER 0x01020304
+#define LUAA_HISTFILE_NAMELEN 56
+
+#ifndef EFTYPE
+#define EFTYPE EINVAL
+#endif
+
+typedef struct luaA_histfile_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t order;
+	uint32_t nslots;
+	uint32_t capacity;
+	uint32_t nlevels;
+	uint32_t pad;
+	double steps[LUAA_HISTORY_MAXLEVELS];
+	uint64_t slotsize;
+	uint64_t size;
+} luaA_histfile_header_t;
+
+/* slot header, nlevels rings follow it */
+typedef struct luaA_histslot_t {
+	uint64_t seq;
+	char name[LUAA_HISTFILE_NAMELEN];
+} luaA_histslot_t;
+
+typedef struct luaA_histfile_t {
+	int fd;
+	u_char *base;
+	size_t size;
+} luaA_histfile_t;
+
+#define luaA_histfile_header(f) ((luaA_histfile_header_t *)(f)->base)
+#define luaA_histfile_slotsize(capacity, nlevels) (sizeof(luaA_histslot_t) + (nlevels) * luaA_ring_size(capacity))
+#define luaA_histfile_size(nslots, capacity, nlevels) \
+	(sizeof(luaA_histfile_header_t) + (uint64_t)(nslots) * luaA_histfile_slotsize(capacity, nlevels))
+
+static inline luaA_histslot_t *
+luaA_histfile_slot(const luaA_histfile_t *f, uint32_t i)
+{
+	return (luaA_histslot_t *)(f->base + sizeof(luaA_histfile_header_t) + i * luaA_histfile_header(f)->slotsize);
+}
+
+static inline luaA_ring_t *
+luaA_histfile_ring(const luaA_histfile_t *f, luaA_histslot_t *slot, uint32_t level)
+{
+	return (luaA_ring_t *)((u_char *)(slot + 1) + level * luaA_ring_size(luaA_histfile_header(f)->capacity));
+}
+
+/* empty slot's rings, name is kept */
+static inline void
+luaA_histfile_clearslot(const luaA_histfile_t *f, luaA_histslot_t *slot)
+{
+	const luaA_histfile_header_t *hdr = luaA_histfile_header(f);
+	uint32_t i;
+
+	__atomic_store_n(&slot->seq, slot->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < hdr->nlevels; i++)
+		luaA_ring_init(luaA_histfile_ring(f, slot, i), hdr->capacity, hdr->steps[i]);
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* whether slot was completely written and its rings can be indexed safely */
+static inline int
+luaA_histfile_slotvalid(const luaA_histfile_t *f, luaA_histslot_t *slot)
+{
+	const luaA_histfile_header_t *hdr = luaA_histfile_header(f);
+	const luaA_ring_t *ring;
+	uint32_t i;
+
+	if (slot->seq & 1) return 0;
+	if (memchr(slot->name, 0, LUAA_HISTFILE_NAMELEN) == NULL) return 0;
+
+	for (i = 0; i < hdr->nlevels; i++) {
+		ring = luaA_histfile_ring(f, slot, i);
+		if (ring->capacity != hdr->capacity || ring->step != hdr->steps[i]
+			|| ring->head >= ring->capacity || ring->count > ring->capacity)
+			return 0;
+	}
+	return 1;
+}
+
+/* whether mapped header describes file of given layout */
+static inline int
+luaA_histfile_valid(const luaA_histfile_t *f, uint32_t nslots, uint32_t capacity, const double *steps, uint32_t nlevels)
+{
+	const luaA_histfile_header_t *hdr = luaA_histfile_header(f);
+
+	if (f->size < sizeof(luaA_histfile_header_t)) return 0;
+	if (hdr->version != LUAA_HISTFILE_VERSION
+		|| hdr->order != LUAA_HISTFILE_ORDER)
+		return 0;
+	if (hdr->nslots != nslots || hdr->capacity != capacity || hdr->nlevels != nlevels
+		|| memcmp(hdr->steps, steps, nlevels * sizeof(double)))
+		return 0;
+	return hdr->slotsize == luaA_histfile_slotsize(capacity, nlevels)
+		&& hdr->size == luaA_histfile_size(nslots, capacity, nlevels)
+		&& hdr->size == f->size;
+}
+
+/*
+ * whether mapped file isn't history file at all, so it mustn't be
+ * overwritten; zero magic is left by creation that was interrupted
+ */
+static inline int
+luaA_histfile_foreign(const luaA_histfile_t *f)
+{
+	static const char zero[sizeof(((luaA_histfile_header_t *)0)->magic)];
+	const luaA_histfile_header_t *hdr = luaA_histfile_header(f);
+
+	return memcmp(hdr->magic, LUAA_HISTFILE_MAGIC, sizeof(hdr->magic))
+		&& memcmp(hdr->magic, zero, sizeof(hdr->magic));
+}
+
+static inline void
+luaA_histfile_unmap(luaA_histfile_t *f)
+{
+	if (f->base) munmap(f->base, f->size);
+	if (f->fd >= 0) close(f->fd);
+	f->base = NULL;
+	f->fd = -1;
+}
+
+/*
+ * map history file, reusing it if it has the same layout, history file
+ * of other layout is recreated empty, any other file is left intact
+ * and EFTYPE returned, steps[0] is 0 for raw level,
+ * returns 0 or -1 with errno set
+ */
+static inline int
+luaA_histfile_map(luaA_histfile_t *f, const char *path, uint32_t nslots, uint32_t capacity, const double *steps, uint32_t nlevels)
+{
+	luaA_histfile_header_t *hdr;
+	luaA_histslot_t *slot;
+	struct stat st;
+	uint32_t i;
+	int err;
+
+	f->base = NULL;
+	if ((f->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) return (-1);
+	/* one writer per file, rings have no locking */
+	if (flock(f->fd, LOCK_EX | LOCK_NB) || fstat(f->fd, &st)) goto fail;
+
+	f->size = st.st_size;
+	if (f->size > 0 && f->size < sizeof(luaA_histfile_header_t)) {
+		errno = EFTYPE;
+		goto fail;
+	}
+	if (f->size > 0) {
+		if ((f->base = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0)) == MAP_FAILED) {
+			f->base = NULL;
+			goto fail;
+		}
+		if (luaA_histfile_foreign(f)) {
+			errno = EFTYPE;
+			goto fail;
+		}
+		if (luaA_histfile_valid(f, nslots, capacity, steps, nlevels)) {
+			for (i = 0; i < nslots; i++) {
+				slot = luaA_histfile_slot(f, i);
+				if (luaA_histfile_slotvalid(f, slot)) continue;
+				/* its points are lost anyway, slot is freed as name may be torn too */
+				slot->name[0] = 0;
+				luaA_histfile_clearslot(f, slot);
+			}
+			/* creation was interrupted after header, slots are sane now */
+			if (memcmp(luaA_histfile_header(f)->magic, LUAA_HISTFILE_MAGIC, sizeof(hdr->magic))) {
+				__atomic_thread_fence(__ATOMIC_RELEASE);
+				memcpy(luaA_histfile_header(f)->magic, LUAA_HISTFILE_MAGIC, sizeof(hdr->magic));
+			}
+			return (0);
+		}
+		munmap(f->base, f->size);
+		f->base = NULL;
+	}
+
+	/* new file, zero filled by ftruncate, magic goes last */
+	f->size = luaA_histfile_size(nslots, capacity, nlevels);
+	if (ftruncate(f->fd, 0) || ftruncate(f->fd, f->size)) goto fail;
+	if ((f->base = mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0)) == MAP_FAILED) {
+		f->base = NULL;
+		goto fail;
+	}
+
+	hdr = luaA_histfile_header(f);
+	hdr->version = LUAA_HISTFILE_VERSION;
+	hdr->order = LUAA_HISTFILE_ORDER;
+	hdr->nslots = nslots;
+	hdr->capacity = capacity;
+	hdr->nlevels = nlevels;
+	memcpy(hdr->steps, steps, nlevels * sizeof(double));
+	hdr->slotsize = luaA_histfile_slotsize(capacity, nlevels);
+	hdr->size = f->size;
+	for (i = 0; i < nslots; i++)
+		luaA_histfile_clearslot(f, luaA_histfile_slot(f, i));
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(hdr->magic, LUAA_HISTFILE_MAGIC, sizeof(hdr->magic));
+	return (0);
+
+fail:
+	err = errno;
+	luaA_histfile_unmap(f);
+	errno = err;
+	return (-1);
+}
+
+/* slot with given name, empty one is taken for new name if create is set */
+static inline luaA_histslot_t *
+luaA_histfile_find(const luaA_histfile_t *f, const char *name, int create)
+{
+	const luaA_histfile_header_t *hdr = luaA_histfile_header(f);
+	luaA_histslot_t *slot, *empty = NULL;
+	uint32_t i;
+
+	for (i = 0; i < hdr->nslots; i++) {
+		slot = luaA_histfile_slot(f, i);
+		if (slot->name[0] == 0) {
+			if (empty == NULL) empty = slot;
+		} else if (strncmp(slot->name, name, LUAA_HISTFILE_NAMELEN) == 0) {
+			return slot;
+		}
+	}
+
+	if (!create || empty == NULL) return NULL;
+
+	/* name is written under odd seq too, so torn one gets dropped */
+	__atomic_store_n(&empty->seq, empty->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	strncpy(empty->name, name, LUAA_HISTFILE_NAMELEN - 1);
+	empty->name[LUAA_HISTFILE_NAMELEN - 1] = 0;
+	luaA_histfile_clearslot(f, empty);
+	return empty;
+}
+
+/* lua interface {{{ */
+
+/*
+ * push history living in slot of file at fidx, its rings are used in
+ * place, file is kept in history's environment so it's not unmapped
+ */
+static inline luaA_history_t *
+luaA_histfile_pushhistory(lua_State *L, int fidx, const char *name)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, fidx, LUAA_HISTFILE);
+	luaA_histslot_t *slot;
+	luaA_history_t *h;
+	uint32_t i;
+
+	if (f->base == NULL)
+		luaL_error(L, "history file is closed");
+	if (strlen(name) >= LUAA_HISTFILE_NAMELEN)
+		luaL_error(L, "history name is too long: %s", name);
+	if ((slot = luaA_histfile_find(f, name, 1)) == NULL)
+		luaL_error(L, "no free slots in history file for %s", name);
+
+	if (fidx < 0) fidx = lua_gettop(L) + fidx + 1;
+	h = lua_newuserdata(L, sizeof(luaA_history_t));
+	memset(h, 0, sizeof(luaA_history_t));
+	luaL_getmetatable(L, LUAA_HISTORY);
+	lua_setmetatable(L, -2);
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, fidx);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+
+	h->nlevels = luaA_histfile_header(f)->nlevels;
+	for (i = 0; i < (uint32_t)h->nlevels; i++)
+		h->rings[i] = luaA_histfile_ring(f, slot, i);
+	h->seq = &slot->seq;
+	return h;
+}
+
+/*
+ * history_file(path [, capacity [, steps [, slots]]]) opens or creates
+ * file of slots histories (32 by default) with rings of capacity
+ * points (1024) for raw level and each of steps ({ 1, 60, 3600 }),
+ * history file of other layout is recreated, other files are refused
+ */
+static inline int
+luaA_histfile_open(lua_State *L)
+{
+	static const double default_steps[] = { 1, 60, 3600 };
+	const char *path = luaL_checkstring(L, 1);
+	lua_Integer capacity = luaL_optinteger(L, 2, 1024);
+	lua_Integer nslots = luaL_optinteger(L, 4, 32);
+	double steps[LUAA_HISTORY_MAXLEVELS];
+	uint32_t i, nlevels = 4;
+	luaA_histfile_t *f;
+
+	luaL_argcheck(L, capacity > 0 && capacity <= INT32_MAX, 2, "history capacity must be positive");
+	luaL_argcheck(L, nslots > 0 && nslots <= INT32_MAX, 4, "history file needs some slots");
+
+	steps[0] = 0;
+	memcpy(steps + 1, default_steps, sizeof(default_steps));
+	if (lua_istable(L, 3)) {
+		nlevels = lua_objlen(L, 3) + 1;
+		if (nlevels > LUAA_HISTORY_MAXLEVELS)
+			return luaL_error(L, "too many history levels");
+		for (i = 1; i < nlevels; i++) {
+			luaA_igettable(L, 3, i, number, steps[i]);
+		}
+	}
+
+	f = lua_newuserdata(L, sizeof(luaA_histfile_t));
+	f->fd = -1;
+	f->base = NULL;
+	luaL_getmetatable(L, LUAA_HISTFILE);
+	lua_setmetatable(L, -2);
+
+	if (luaA_histfile_map(f, path, nslots, capacity, steps, nlevels)) {
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s: %s", path, strerror(errno));
+		return 2;
+	}
+	return 1;
+}
+
+#define LUAA_HISTFILE_METHOD(name) static int luaA_histfile_##name (lua_State *L)
+
+/* file:history(name) returns history stored under name, new one if missing */
+LUAA_HISTFILE_METHOD(history)
+{
+	luaA_histfile_pushhistory(L, 1, luaL_checkstring(L, 2));
+	return 1;
+}
+
+/* file:names() returns array of stored histories names */
+LUAA_HISTFILE_METHOD(names)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, 1, LUAA_HISTFILE);
+	luaA_histslot_t *slot;
+	uint32_t i;
+	int n = 0;
+
+	lua_newtable(L);
+	for (i = 0; f->base && i < luaA_histfile_header(f)->nslots; i++) {
+		slot = luaA_histfile_slot(f, i);
+		if (slot->name[0] == 0) continue;
+		luaA_isettable(L, -2, ++n, string, slot->name);
+	}
+	return 1;
+}
+
+/* file:remove(name) frees slot of history, its history objects must not be used then */
+LUAA_HISTFILE_METHOD(remove)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, 1, LUAA_HISTFILE);
+	luaA_histslot_t *slot;
+
+	if (f->base == NULL || (slot = luaA_histfile_find(f, luaL_checkstring(L, 2), 0)) == NULL)
+		return 0;
+
+	luaA_histfile_clearslot(f, slot);
+	slot->name[0] = 0;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/* file:sync() flushes mapped pages to disk, kernel does it anyway later */
+LUAA_HISTFILE_METHOD(sync)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, 1, LUAA_HISTFILE);
+
+	if (f->base == NULL || msync(f->base, f->size, MS_SYNC))
+		return 0;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+LUAA_HISTFILE_METHOD(index)
+{
+	luaA_checkmetaindex(L, LUAA_HISTFILE);
+	return 0;
+}
+
+LUAA_HISTFILE_METHOD(tostring)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, 1, LUAA_HISTFILE);
+
+	if (f->base == NULL) {
+		lua_pushliteral(L, LUAA_HISTFILE ": closed");
+	} else {
+		lua_pushfstring(L, LUAA_HISTFILE ": %d slots of %d points, %d levels",
+			(int)luaA_histfile_header(f)->nslots, (int)luaA_histfile_header(f)->capacity,
+			(int)luaA_histfile_header(f)->nlevels);
+	}
+	return 1;
+}
+
+LUAA_HISTFILE_METHOD(gc)
+{
+	luaA_histfile_t *f = luaL_checkudata(L, 1, LUAA_HISTFILE);
+	luaA_histfile_unmap(f);
+	return 0;
+}
+
+LUAA_SREG(history_file_meta)
+LUAA_MREG(histfile, index)
+LUAA_MREG(histfile, tostring)
+LUAA_MREG(histfile, gc)
+LUAA_REG(histfile, history)
+LUAA_REG(histfile, names)
+LUAA_REG(histfile, remove)
+LUAA_REG(histfile, sync)
+LUAA_EREG
+
+/* register history file metatable, safe to call from several modules */
+static inline void
+luaA_histfile_register(lua_State *L)
+{
+	luaA_history_register(L);
+	if (luaL_newmetatable(L, LUAA_HISTFILE))
+		luaL_register(L, NULL, history_file_meta);
+	lua_pop(L, 1);
+}
+
+/* }}} */
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef __LUA_HISTORY__
+
+#define __LUA_HISTORY__
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "luahelper.h"
+#include "luaarray.h"
+
+/*
+ * Fixed size history of numeric samples.
+ *
+ * Every history has raw level with last samples and a few RRD-like
+ * consolidation levels (1s, 1min & 1h by default), each of them is
+ * a ring of points with average, min & max of samples fallen into
+ * its step. Current step is accumulated aside and gets into ring
+ * once first sample of the next step arrives. Rings are plain
+ * structs without pointers, so they can live in any memory,
+ * e.g. in mapped file (see luahistfile.h).
+ */
+
+#define LUAA_HISTORY "history"
+#define LUAA_HISTORY_MAXLEVELS 8
+
+typedef struct luaA_point_t {
+	double time;
+	double value;
+	double min;
+	double max;
+} luaA_point_t;
+
+typedef struct luaA_ring_t {
+	double step;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t count;
+	uint32_t bcount;
+	double bstart, bsum, bmin, bmax;
+	luaA_point_t points[1];
+} luaA_ring_t;
+
+typedef struct luaA_history_t {
+	int nlevels;
+	luaA_ring_t *rings[LUAA_HISTORY_MAXLEVELS];
+	/* producer of samples for push() without value */
+	int (*read) (void *arg, double *value);
+	void *arg;
+	int owned;
+	/* sequence number of rings' slot, odd while it's being updated */
+	uint64_t *seq;
+} luaA_history_t;
+
+#define luaA_ring_size(capacity) (sizeof(luaA_ring_t) + ((capacity) - 1) * sizeof(luaA_point_t))
+
+static inline void
+luaA_ring_init(luaA_ring_t *ring, uint32_t capacity, double step)
+{
+	memset(ring, 0, sizeof(luaA_ring_t));
+	ring->capacity = capacity;
+	ring->step = step;
+}
+
+static inline void
+luaA_ring_append(luaA_ring_t *ring, const luaA_point_t *point)
+{
+	ring->points[ring->head] = *point;
+	ring->head = (ring->head + 1) % ring->capacity;
+	if (ring->count < ring->capacity) ring->count++;
+}
+
+/* i-th point counting from the oldest one */
+static inline const luaA_point_t *
+luaA_ring_at(const luaA_ring_t *ring, uint32_t i)
+{
+	return &ring->points[(ring->head + ring->capacity - ring->count + i) % ring->capacity];
+}
+
+/* add sample, consolidating it into current step if ring has one */
+static inline void
+luaA_ring_add(luaA_ring_t *ring, double time, double value)
+{
+	luaA_point_t point;
+	double start;
+
+	if (ring->step <= 0) {
+		point.time = time;
+		point.value = point.min = point.max = value;
+		luaA_ring_append(ring, &point);
+		return;
+	}
+
+	start = floor(time / ring->step) * ring->step;
+	if (ring->bcount && start != ring->bstart) {
+		point.time = ring->bstart;
+		point.value = ring->bsum / ring->bcount;
+		point.min = ring->bmin;
+		point.max = ring->bmax;
+		luaA_ring_append(ring, &point);
+		ring->bcount = 0;
+	}
+
+	if (ring->bcount++ == 0) {
+		ring->bstart = start;
+		ring->bsum = ring->bmin = ring->bmax = value;
+	} else {
+		ring->bsum += value;
+		if (value < ring->bmin) ring->bmin = value;
+		if (value > ring->bmax) ring->bmax = value;
+	}
+}
+
+static inline void
+luaA_history_add(luaA_history_t *h, double time, double value)
+{
+	int i;
+
+	if (h->seq) {
+		__atomic_store_n(h->seq, *h->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	for (i = 0; i < h->nlevels; i++)
+		luaA_ring_add(h->rings[i], time, value);
+	if (h->seq)
+		__atomic_store_n(h->seq, *h->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline double
+luaA_history_now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * push new history with raw level and given consolidation steps,
+ * all rings are allocated in one block
+ */
+static inline luaA_history_t *
+luaA_history_new(lua_State *L, int capacity, const double *steps, int nsteps)
+{
+	luaA_history_t *h;
+	u_char *mem;
+	int i;
+
+	if (nsteps + 1 > LUAA_HISTORY_MAXLEVELS)
+		luaL_error(L, "too many history levels");
+	if (capacity <= 0)
+		luaL_error(L, "history capacity must be positive");
+
+	h = lua_newuserdata(L, sizeof(luaA_history_t));
+	memset(h, 0, sizeof(luaA_history_t));
+	luaL_getmetatable(L, LUAA_HISTORY);
+	lua_setmetatable(L, -2);
+
+	if ((mem = malloc((nsteps + 1) * luaA_ring_size(capacity))) == NULL)
+		luaL_error(L, "out of memory allocating history");
+	h->owned = 1;
+	h->nlevels = nsteps + 1;
+	for (i = 0; i < h->nlevels; i++) {
+		h->rings[i] = (luaA_ring_t *)(mem + i * luaA_ring_size(capacity));
+		luaA_ring_init(h->rings[i], capacity, i? steps[i - 1]: 0);
+	}
+	return h;
+}
+
+#define LUAA_HISTORY_METHOD(name) static int luaA_history_##name (lua_State *L)
+
+/* history:push([value [, time]]), without value it's read from history source */
+LUAA_HISTORY_METHOD(push)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	double value, time = luaL_optnumber(L, 3, 0);
+
+	if (lua_isnoneornil(L, 2)) {
+		if (h->read == NULL || h->read(h->arg, &value))
+			return 0;
+	} else {
+		value = luaL_checknumber(L, 2);
+	}
+
+	luaA_history_add(h, time > 0? time: luaA_history_now(), value);
+	lua_pushnumber(L, value);
+	return 1;
+}
+
+/*
+ * history:range([level [, from [, to [, times, values, mins, maxs]]]])
+ * returns packed arrays of times, values and (for consolidated levels)
+ * mins & maxs of points within [from, to], level 0 is raw samples,
+ * given arrays are refilled in place
+ */
+LUAA_HISTORY_METHOD(range)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	int level = luaL_optinteger(L, 2, 0);
+	double from = luaL_optnumber(L, 3, -HUGE_VAL);
+	double to = luaL_optnumber(L, 4, HUGE_VAL);
+	luaA_array_t *arrs[4];
+	const luaA_point_t *point;
+	const luaA_ring_t *ring;
+	uint32_t i, first, last;
+	int k, narrs;
+	size_t n;
+
+	luaL_argcheck(L, level >= 0 && level < h->nlevels, 2, "no such history level");
+	ring = h->rings[level];
+
+	/* points are ordered by time, so range is contiguous */
+	for (first = 0; first < ring->count && luaA_ring_at(ring, first)->time < from; first++);
+	for (last = first; last < ring->count && luaA_ring_at(ring, last)->time <= to; last++);
+	n = last - first;
+
+	/* reused arrays are pushed, so they mustn't shift indexes of given ones */
+	narrs = level? 4: 2;
+	lua_settop(L, 4 + narrs);
+	for (k = 0; k < narrs; k++) {
+		arrs[k] = luaA_array_reuse(L, 5 + k, n);
+		arrs[k]->len = n;
+	}
+
+	for (i = first; i < last; i++) {
+		point = luaA_ring_at(ring, i);
+		arrs[0]->items[i - first] = point->time;
+		arrs[1]->items[i - first] = point->value;
+		if (level) {
+			arrs[2]->items[i - first] = point->min;
+			arrs[3]->items[i - first] = point->max;
+		}
+	}
+
+	return narrs;
+}
+
+/* history:last([level]) returns value and time of the latest point */
+LUAA_HISTORY_METHOD(last)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	int level = luaL_optinteger(L, 2, 0);
+	const luaA_point_t *point;
+
+	luaL_argcheck(L, level >= 0 && level < h->nlevels, 2, "no such history level");
+	if (h->rings[level]->count == 0)
+		return 0;
+
+	point = luaA_ring_at(h->rings[level], h->rings[level]->count - 1);
+	lua_pushnumber(L, point->value);
+	lua_pushnumber(L, point->time);
+	return 2;
+}
+
+/* history:levels() returns array of level steps, 0 for raw one */
+LUAA_HISTORY_METHOD(levels)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	int i;
+
+	lua_createtable(L, h->nlevels, 0);
+	for (i = 0; i < h->nlevels; i++) {
+		luaA_isettable(L, -2, i + 1, number, h->rings[i]->step);
+	}
+	return 1;
+}
+
+LUAA_HISTORY_METHOD(len)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	lua_pushinteger(L, h->rings[0]->count);
+	return 1;
+}
+
+LUAA_HISTORY_METHOD(index)
+{
+	luaA_checkmetaindex(L, LUAA_HISTORY);
+	return 0;
+}
+
+LUAA_HISTORY_METHOD(tostring)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	lua_pushfstring(L, LUAA_HISTORY ": %d of %d samples, %d levels", (int)h->rings[0]->count, (int)h->rings[0]->capacity, h->nlevels);
+	return 1;
+}
+
+LUAA_HISTORY_METHOD(gc)
+{
+	luaA_history_t *h = luaL_checkudata(L, 1, LUAA_HISTORY);
+	if (h->owned)
+		free(h->rings[0]);
+	free(h->arg);
+	return 0;
+}
+
+LUAA_SREG(history_meta)
+LUAA_MREG(history, index)
+LUAA_MREG(history, len)
+LUAA_MREG(history, tostring)
+LUAA_MREG(history, gc)
+LUAA_REG(history, push)
+LUAA_REG(history, range)
+LUAA_REG(history, last)
+LUAA_REG(history, levels)
+LUAA_EREG
+
+/* register history metatable, safe to call from several modules */
+static inline void
+luaA_history_register(lua_State *L)
+{
+	luaA_array_register(L);
+	if (luaL_newmetatable(L, LUAA_HISTORY))
+		luaL_register(L, NULL, history_meta);
+	lua_pop(L, 1);
+}
+
+#endif
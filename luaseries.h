@@ -0,0 +1,448 @@
+#ifndef __LUA_SERIES__
+
+#define __LUA_SERIES__
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "luahelper.h"
+
+/*
+ * Compressed time series, Gorilla style.
+ *
+ * Samples are (time, value) pairs, time is kept in milliseconds.
+ * Series is a list of fixed size blocks, every block starts with raw
+ * time and value of its first sample, so blocks decode independently.
+ * Next times are stored as delta of deltas with variable length prefix
+ * codes, values as XOR with previous value: identical value takes one
+ * bit, others store only meaningful bits of XOR, reusing previous
+ * leading/trailing zeros window when it fits.
+ */
+
+#define LUAA_SERIES "series"
+#define LUAA_SERIES_BLOCKSIZE 4096
+
+/* worst case size of one sample: 4 + 64 bits of time, 2 + 5 + 6 + 64 of value */
+#define LUAA_SERIES_MAXBITS 145
+
+typedef struct luaA_block_t {
+	uint32_t count;
+	uint32_t bits;
+	u_char data[1];
+} luaA_block_t;
+
+/* encoder or decoder state */
+typedef struct luaA_series_state_t {
+	int64_t time;
+	int64_t delta;
+	uint64_t value;
+	int lead;
+	int trail;
+} luaA_series_state_t;
+
+typedef struct luaA_series_t {
+	size_t blocksize;
+	size_t nblocks, maxblocks;
+	luaA_block_t **blocks;
+	uint64_t count;
+	luaA_series_state_t enc;
+} luaA_series_t;
+
+#define luaA_block_capacity(blocksize) (((blocksize) - offsetof(luaA_block_t, data)) * 8)
+
+/* bit level io, most significant bits first, block data is zeroed */
+static inline void
+luaA_bits_put(u_char *buf, uint32_t *pos, uint64_t value, int n)
+{
+	int off, room, take;
+
+	while (n > 0) {
+		off = *pos & 7;
+		room = 8 - off;
+		take = n < room? n: room;
+		buf[*pos >> 3] |= ((value >> (n - take)) & ((1U << take) - 1)) << (room - take);
+		*pos += take;
+		n -= take;
+	}
+}
+
+static inline uint64_t
+luaA_bits_get(const u_char *buf, uint32_t *pos, int n)
+{
+	uint64_t value = 0;
+	int off, room, take;
+
+	while (n > 0) {
+		off = *pos & 7;
+		room = 8 - off;
+		take = n < room? n: room;
+		value = (value << take) | ((buf[*pos >> 3] >> (room - take)) & ((1U << take) - 1));
+		*pos += take;
+		n -= take;
+	}
+	return value;
+}
+
+static inline int
+luaA_clz64(uint64_t x)
+{
+	return x? __builtin_clzll(x): 64;
+}
+
+static inline int
+luaA_ctz64(uint64_t x)
+{
+	return x? __builtin_ctzll(x): 64;
+}
+
+static inline uint64_t
+luaA_double_bits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static inline double
+luaA_bits_double(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static inline void
+luaA_series_init(luaA_series_t *s, size_t blocksize)
+{
+	memset(s, 0, sizeof(luaA_series_t));
+	s->blocksize = blocksize;
+}
+
+static inline void
+luaA_series_free(luaA_series_t *s)
+{
+	size_t i;
+	for (i = 0; i < s->nblocks; i++)
+		free(s->blocks[i]);
+	free(s->blocks);
+	s->blocks = NULL;
+	s->nblocks = s->maxblocks = 0;
+}
+
+static inline luaA_block_t *
+luaA_series_newblock(luaA_series_t *s)
+{
+	luaA_block_t **blocks, *block;
+
+	if (s->nblocks == s->maxblocks) {
+		size_t maxblocks = s->maxblocks? s->maxblocks * 2: 16;
+		if ((blocks = realloc(s->blocks, maxblocks * sizeof(luaA_block_t *))) == NULL)
+			return NULL;
+		s->blocks = blocks;
+		s->maxblocks = maxblocks;
+	}
+	if ((block = calloc(1, s->blocksize)) == NULL)
+		return NULL;
+	s->blocks[s->nblocks++] = block;
+	return block;
+}
+
+/* append sample, time is in milliseconds */
+static inline int
+luaA_series_add(luaA_series_t *s, int64_t time, double value)
+{
+	luaA_block_t *block = s->nblocks? s->blocks[s->nblocks - 1]: NULL;
+	luaA_series_state_t *enc = &s->enc;
+	uint64_t bits = luaA_double_bits(value), xor;
+	int64_t delta, dod;
+	int lead, trail;
+
+	if (block == NULL || block->bits + LUAA_SERIES_MAXBITS > luaA_block_capacity(s->blocksize)) {
+		if ((block = luaA_series_newblock(s)) == NULL)
+			return (-1);
+	}
+
+	if (block->count == 0) {
+		luaA_bits_put(block->data, &block->bits, (uint64_t)time, 64);
+		luaA_bits_put(block->data, &block->bits, bits, 64);
+		enc->time = time;
+		enc->delta = 0;
+		enc->value = bits;
+		enc->lead = -1;
+		enc->trail = 0;
+		block->count++;
+		s->count++;
+		return (0);
+	}
+
+	delta = time - enc->time;
+	dod = delta - enc->delta;
+	if (dod == 0) {
+		luaA_bits_put(block->data, &block->bits, 0, 1);
+	} else if (dod >= -64 && dod <= 63) {
+		luaA_bits_put(block->data, &block->bits, 2, 2);
+		luaA_bits_put(block->data, &block->bits, (uint64_t)dod, 7);
+	} else if (dod >= -256 && dod <= 255) {
+		luaA_bits_put(block->data, &block->bits, 6, 3);
+		luaA_bits_put(block->data, &block->bits, (uint64_t)dod, 9);
+	} else if (dod >= -2048 && dod <= 2047) {
+		luaA_bits_put(block->data, &block->bits, 14, 4);
+		luaA_bits_put(block->data, &block->bits, (uint64_t)dod, 12);
+	} else {
+		luaA_bits_put(block->data, &block->bits, 15, 4);
+		luaA_bits_put(block->data, &block->bits, (uint64_t)dod, 64);
+	}
+	enc->time = time;
+	enc->delta = delta;
+
+	xor = bits ^ enc->value;
+	if (xor == 0) {
+		luaA_bits_put(block->data, &block->bits, 0, 1);
+	} else {
+		lead = luaA_clz64(xor);
+		trail = luaA_ctz64(xor);
+		if (lead > 31) lead = 31;
+		if (enc->lead >= 0 && lead >= enc->lead && trail >= enc->trail) {
+			/* fits into previous window */
+			luaA_bits_put(block->data, &block->bits, 2, 2);
+			luaA_bits_put(block->data, &block->bits, xor >> enc->trail, 64 - enc->lead - enc->trail);
+		} else {
+			luaA_bits_put(block->data, &block->bits, 3, 2);
+			luaA_bits_put(block->data, &block->bits, lead, 5);
+			/* 64 meaningful bits are stored as 0 */
+			luaA_bits_put(block->data, &block->bits, (64 - lead - trail) & 63, 6);
+			luaA_bits_put(block->data, &block->bits, xor >> trail, 64 - lead - trail);
+			enc->lead = lead;
+			enc->trail = trail;
+		}
+	}
+	enc->value = bits;
+
+	block->count++;
+	s->count++;
+	return (0);
+}
+
+/* streaming decoder over one series */
+typedef struct luaA_series_iter_t {
+	size_t block;
+	uint32_t index;
+	uint32_t pos;
+	luaA_series_state_t dec;
+} luaA_series_iter_t;
+
+/* decode next sample, returns 0 at the end of series */
+static inline int
+luaA_series_next(const luaA_series_t *s, luaA_series_iter_t *it, int64_t *time, double *value)
+{
+	const luaA_block_t *block;
+	luaA_series_state_t *dec = &it->dec;
+	int64_t dod;
+	int n;
+
+	while (it->block < s->nblocks && it->index >= s->blocks[it->block]->count) {
+		it->block++;
+		it->index = 0;
+		it->pos = 0;
+	}
+	if (it->block >= s->nblocks)
+		return 0;
+	block = s->blocks[it->block];
+
+	if (it->index++ == 0) {
+		dec->time = (int64_t)luaA_bits_get(block->data, &it->pos, 64);
+		dec->value = luaA_bits_get(block->data, &it->pos, 64);
+		dec->delta = 0;
+		dec->lead = -1;
+		dec->trail = 0;
+	} else {
+		if (luaA_bits_get(block->data, &it->pos, 1) == 0)
+			dod = 0;
+		else if (luaA_bits_get(block->data, &it->pos, 1) == 0)
+			dod = (int64_t)(luaA_bits_get(block->data, &it->pos, 7) << 57) >> 57;
+		else if (luaA_bits_get(block->data, &it->pos, 1) == 0)
+			dod = (int64_t)(luaA_bits_get(block->data, &it->pos, 9) << 55) >> 55;
+		else if (luaA_bits_get(block->data, &it->pos, 1) == 0)
+			dod = (int64_t)(luaA_bits_get(block->data, &it->pos, 12) << 52) >> 52;
+		else
+			dod = (int64_t)luaA_bits_get(block->data, &it->pos, 64);
+		dec->delta += dod;
+		dec->time += dec->delta;
+
+		if (luaA_bits_get(block->data, &it->pos, 1)) {
+			if (luaA_bits_get(block->data, &it->pos, 1)) {
+				dec->lead = luaA_bits_get(block->data, &it->pos, 5);
+				n = luaA_bits_get(block->data, &it->pos, 6);
+				if (n == 0) n = 64;
+				dec->trail = 64 - dec->lead - n;
+			}
+			n = 64 - dec->lead - dec->trail;
+			dec->value ^= luaA_bits_get(block->data, &it->pos, n) << dec->trail;
+		}
+	}
+
+	*time = dec->time;
+	*value = luaA_bits_double(dec->value);
+	return 1;
+}
+
+static inline size_t
+luaA_series_bytes(const luaA_series_t *s)
+{
+	return s->nblocks * s->blocksize;
+}
+
+/* really used bytes, without unfilled tail of the last block */
+static inline size_t
+luaA_series_usedbytes(const luaA_series_t *s)
+{
+	return s->nblocks? (s->nblocks - 1) * s->blocksize + offsetof(luaA_block_t, data)
+		+ (s->blocks[s->nblocks - 1]->bits + 7) / 8: 0;
+}
+
+/* lua interface {{{ */
+
+/* push new empty series */
+static inline luaA_series_t *
+luaA_series_new(lua_State *L, size_t blocksize)
+{
+	luaA_series_t *s;
+
+	if (blocksize < 64)
+		luaL_error(L, "series block size too small");
+
+	s = lua_newuserdata(L, sizeof(luaA_series_t));
+	luaA_series_init(s, blocksize);
+	luaL_getmetatable(L, LUAA_SERIES);
+	lua_setmetatable(L, -2);
+	return s;
+}
+
+#define LUAA_SERIES_METHOD(name) static int luaA_series_##name (lua_State *L)
+
+/* series:append(value [, time]), time is in seconds, now by default */
+LUAA_SERIES_METHOD(append)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+	double value = luaL_checknumber(L, 2), time;
+	struct timeval tv;
+
+	if (lua_isnoneornil(L, 3)) {
+		gettimeofday(&tv, NULL);
+		time = tv.tv_sec + tv.tv_usec / 1e6;
+	} else {
+		time = luaL_checknumber(L, 3);
+	}
+
+	if (luaA_series_add(s, llround(time * 1000), value))
+		return luaL_error(L, "out of memory appending to series");
+	return 0;
+}
+
+static int
+luaA_series_iter_call(lua_State *L)
+{
+	luaA_series_t *s = lua_touserdata(L, lua_upvalueindex(1));
+	luaA_series_iter_t *it = lua_touserdata(L, lua_upvalueindex(2));
+	double from = lua_tonumber(L, lua_upvalueindex(3));
+	double to = lua_tonumber(L, lua_upvalueindex(4));
+	int64_t time;
+	double value;
+
+	while (luaA_series_next(s, it, &time, &value)) {
+		if (time < from) continue;
+		if (time > to) return 0;
+		lua_pushnumber(L, time / 1000.0);
+		lua_pushnumber(L, value);
+		return 2;
+	}
+	return 0;
+}
+
+/*
+ * for time, value in series:iter([from [, to]]) do ... end
+ * decodes samples one by one, nothing is unpacked in advance
+ */
+LUAA_SERIES_METHOD(iter)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+	double from = luaL_optnumber(L, 2, -HUGE_VAL);
+	double to = luaL_optnumber(L, 3, HUGE_VAL);
+	luaA_series_iter_t *it;
+
+	(void)s;
+	lua_settop(L, 1);
+	it = lua_newuserdata(L, sizeof(luaA_series_iter_t));
+	memset(it, 0, sizeof(luaA_series_iter_t));
+	lua_pushnumber(L, from * 1000);
+	lua_pushnumber(L, to * 1000);
+	lua_pushcclosure(L, luaA_series_iter_call, 4);
+	return 1;
+}
+
+/* series:stats() returns samples, blocks, bytes and bytes per sample */
+LUAA_SERIES_METHOD(stats)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+
+	lua_createtable(L, 0, 5);
+	luaA_settable(L, -2, "samples", number, s->count);
+	luaA_settable(L, -2, "blocks", number, s->nblocks);
+	luaA_settable(L, -2, "bytes", number, luaA_series_bytes(s));
+	luaA_settable(L, -2, "used", number, luaA_series_usedbytes(s));
+	luaA_settable(L, -2, "bytes_per_sample", number, s->count? (double)luaA_series_usedbytes(s) / s->count: 0);
+	return 1;
+}
+
+LUAA_SERIES_METHOD(len)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+	lua_pushnumber(L, s->count);
+	return 1;
+}
+
+LUAA_SERIES_METHOD(index)
+{
+	luaA_checkmetaindex(L, LUAA_SERIES);
+	return 0;
+}
+
+LUAA_SERIES_METHOD(tostring)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+	lua_pushfstring(L, LUAA_SERIES ": %d samples in %d blocks", (int)s->count, (int)s->nblocks);
+	return 1;
+}
+
+LUAA_SERIES_METHOD(gc)
+{
+	luaA_series_t *s = luaL_checkudata(L, 1, LUAA_SERIES);
+	luaA_series_free(s);
+	return 0;
+}
+
+LUAA_SREG(series_meta)
+LUAA_MREG(series, index)
+LUAA_MREG(series, len)
+LUAA_MREG(series, tostring)
+LUAA_MREG(series, gc)
+LUAA_REG(series, append)
+LUAA_REG(series, iter)
+LUAA_REG(series, stats)
+LUAA_EREG
+
+/* register series metatable, safe to call from several modules */
+static inline void
+luaA_series_register(lua_State *L)
+{
+	if (luaL_newmetatable(L, LUAA_SERIES))
+		luaL_register(L, NULL, series_meta);
+	lua_pop(L, 1);
+}
+
+/* }}} */
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef __LUA_STRUCT__
+
+#define __LUA_STRUCT__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include "luahelper.h"
+
+/*
+ * Table driven struct decoder.
+ *
+ * Struct is described by static array of fields: name, type, offset & size.
+ * Offsets are always taken from start of the whole struct, even for fields
+ * of nested tables, so any field can be decoded straight from raw buffer.
+ * Field names are interned once per fields array into a key table kept in
+ * registry (names in array part, name to index map in hash part), so
+ * decoding doesn't hash any key string.
+ */
+
+typedef enum { ft_signed, ft_unsigned, ft_float, ft_string, ft_struct, ft_array, ft_dev, ft_pagesize } luaA_field_type_t;
+
+typedef struct luaA_field_t {
+	const char *name;
+	luaA_field_type_t type;
+	size_t offset;
+	size_t size;
+	const struct luaA_field_t *sub;
+	int nsub;
+} luaA_field_t;
+
+typedef struct luaA_struct_t {
+	const char *name;
+	size_t size;
+	const luaA_field_t *fields;
+	int nfields;
+} luaA_struct_t;
+
+#define LUAA_FIELD(st, name, member, type) { name, type, offsetof(st, member), sizeof(((st *)0)->member), NULL, 0 }
+#define LUAA_IFIELD(st, name, member) LUAA_FIELD(st, name, member, ft_signed)
+#define LUAA_UFIELD(st, name, member) LUAA_FIELD(st, name, member, ft_unsigned)
+#define LUAA_FFIELD(st, name, member) LUAA_FIELD(st, name, member, ft_float)
+#define LUAA_SFIELD(st, name, member) LUAA_FIELD(st, name, member, ft_string)
+#define LUAA_DFIELD(st, name, member) LUAA_FIELD(st, name, member, ft_dev)
+#define LUAA_SUBFIELD(name, type, sub) { name, type, 0, 0, sub, sizeof(sub) / sizeof(luaA_field_t) }
+#define LUAA_STRUCT(name, st, fields) { name, sizeof(st), fields, sizeof(fields) / sizeof(luaA_field_t) }
+
+/* push key table of fields array, it's built on first use */
+static inline void
+luaA_struct_pushkeys(lua_State *L, const luaA_field_t *fields, int nfields)
+{
+	int i;
+
+	lua_pushlightuserdata(L, (void *)fields);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	if (!lua_isnil(L, -1)) return;
+	lua_pop(L, 1);
+
+	lua_createtable(L, nfields, nfields);
+	for (i = 0; i < nfields; i++) {
+		if (fields[i].name == NULL) continue;
+		luaA_isettable(L, -2, i + 1, string, fields[i].name);
+		luaA_settable(L, -2, fields[i].name, number, i);
+	}
+	lua_pushlightuserdata(L, (void *)fields);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+}
+
+static inline void luaA_struct_pushfields(lua_State *L, const luaA_field_t *fields, int nfields, const void *buf);
+
+/* push single field value decoded from raw struct buffer */
+static inline void
+luaA_struct_pushfield(lua_State *L, const luaA_field_t *field, const void *buf)
+{
+	const u_char *ptr = (const u_char *)buf + field->offset;
+	int i;
+
+	switch (field->type) {
+	case ft_signed:
+		switch (field->size) {
+		case 1: lua_pushnumber(L, *(int8_t *)ptr); break;
+		case 2: lua_pushnumber(L, *(int16_t *)ptr); break;
+		case 4: lua_pushnumber(L, *(int32_t *)ptr); break;
+		default: lua_pushnumber(L, *(int64_t *)ptr); break;
+		}
+		break;
+	case ft_unsigned:
+		switch (field->size) {
+		case 1: lua_pushnumber(L, *(uint8_t *)ptr); break;
+		case 2: lua_pushnumber(L, *(uint16_t *)ptr); break;
+		case 4: lua_pushnumber(L, *(uint32_t *)ptr); break;
+		default: lua_pushnumber(L, *(uint64_t *)ptr); break;
+		}
+		break;
+	case ft_float:
+		lua_pushnumber(L, field->size == sizeof(float)? *(float *)ptr: *(double *)ptr);
+		break;
+	case ft_string:
+		lua_pushlstring(L, (const char *)ptr, strnlen((const char *)ptr, field->size));
+		break;
+	case ft_struct:
+		luaA_struct_pushfields(L, field->sub, field->nsub, buf);
+		break;
+	case ft_array:
+		lua_createtable(L, field->nsub, 0);
+		for (i = 0; i < field->nsub; i++) {
+			luaA_struct_pushfield(L, &field->sub[i], buf);
+			lua_rawseti(L, -2, i + 1);
+		}
+		break;
+	case ft_dev:
+		lua_createtable(L, 2, 0);
+		luaA_isettable(L, -2, 1, number, major(*(dev_t *)ptr));
+		luaA_isettable(L, -2, 2, number, minor(*(dev_t *)ptr));
+		break;
+	case ft_pagesize:
+		lua_pushnumber(L, getpagesize());
+		break;
+	}
+}
+
+/* push table of fields, presized and keyed by interned names */
+static inline void
+luaA_struct_pushfields(lua_State *L, const luaA_field_t *fields, int nfields, const void *buf)
+{
+	int i;
+
+	luaA_struct_pushkeys(L, fields, nfields);
+	lua_createtable(L, 0, nfields);
+	for (i = 0; i < nfields; i++) {
+		lua_rawgeti(L, -2, i + 1);
+		luaA_struct_pushfield(L, &fields[i], buf);
+		lua_rawset(L, -3);
+	}
+	lua_remove(L, -2);
+}
+
+/* whether field differs between two raw struct buffers */
+static inline int
+luaA_struct_fieldchanged(const luaA_field_t *field, const void *buf1, const void *buf2)
+{
+	int i;
+
+	switch (field->type) {
+	case ft_struct:
+	case ft_array:
+		for (i = 0; i < field->nsub; i++)
+			if (luaA_struct_fieldchanged(&field->sub[i], buf1, buf2))
+				return 1;
+		return 0;
+	case ft_pagesize:
+		return 0;
+	default:
+		return memcmp((const u_char *)buf1 + field->offset, (const u_char *)buf2 + field->offset, field->size) != 0;
+	}
+}
+
+/* push table of only those fields which differ between old and new buffers */
+static inline int
+luaA_struct_pushdiff(lua_State *L, const luaA_struct_t *st, const void *oldbuf, const void *newbuf)
+{
+	int i;
+
+	luaA_struct_pushkeys(L, st->fields, st->nfields);
+	lua_newtable(L);
+	for (i = 0; i < st->nfields; i++) {
+		if (!luaA_struct_fieldchanged(&st->fields[i], oldbuf, newbuf)) continue;
+		lua_rawgeti(L, -2, i + 1);
+		luaA_struct_pushfield(L, &st->fields[i], newbuf);
+		lua_rawset(L, -3);
+	}
+	lua_remove(L, -2);
+	return 1;
+}
+
+/* push whole struct as table */
+static inline int
+luaA_struct_push(lua_State *L, const luaA_struct_t *st, const void *buf)
+{
+	luaA_struct_pushfields(L, st->fields, st->nfields, buf);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Scrapes sysctl.exporter (see lsysctl.c) without curl and validates
+ * its text exposition: status line & content type, metric and label
+ * names, label value escapes, sample values, and that every family
+ * has one TYPE line before its samples and isn't split by other ones.
+ * Usage: ./metricscheck port | unix:/path | /path [-v]
+ * Exits with 0 if output is valid, prints first error otherwise.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define MAXFAMILIES 4096
+
+static char *families[MAXFAMILIES];
+static int nfamilies;
+static int lineno;
+
+static int
+fail(const char *msg, const char *line)
+{
+	fprintf(stderr, "line %d: %s\n%s\n", lineno, msg, line? line: "");
+	return 1;
+}
+
+static int
+connectto(const char *addr)
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	char *end;
+	long port = strtol(addr, &end, 10);
+	int fd;
+
+	if (*end == '\0') {
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+			return -1;
+		return fd;
+	}
+
+	if (strncmp(addr, "unix:", 5) == 0)
+		addr += 5;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, addr, sizeof(sun.sun_path) - 1);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)))
+		return -1;
+	return fd;
+}
+
+/* read whole response, it's closed by server */
+static char *
+fetch(int fd, size_t *len)
+{
+	static const char req[] = "GET /metrics HTTP/1.0\r\nHost: localhost\r\n\r\n";
+	size_t max = 65536;
+	char *buf = malloc(max), *ptr;
+	ssize_t n;
+
+	if (write(fd, req, sizeof(req) - 1) != sizeof(req) - 1)
+		return NULL;
+	*len = 0;
+	while ((n = read(fd, buf + *len, max - *len - 1)) > 0) {
+		*len += n;
+		if (*len == max - 1) {
+			if ((ptr = realloc(buf, max * 2)) == NULL)
+				return NULL;
+			buf = ptr;
+			max *= 2;
+		}
+	}
+	if (n < 0)
+		return NULL;
+	buf[*len] = '\0';
+	return buf;
+}
+
+static int
+isnamechar(char c, int first, int label)
+{
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!label && c == ':'))
+		return 1;
+	return !first && c >= '0' && c <= '9';
+}
+
+/* skip metric or label name, NULL if there's none */
+static const char *
+skipname(const char *ptr, int label)
+{
+	const char *start = ptr;
+
+	while (isnamechar(*ptr, ptr == start, label))
+		ptr++;
+	return ptr == start? NULL: ptr;
+}
+
+static int
+isvalue(const char *str)
+{
+	char *end;
+
+	if (strcmp(str, "+Inf") == 0 || strcmp(str, "-Inf") == 0 || strcmp(str, "NaN") == 0)
+		return 1;
+	if (*str == '\0')
+		return 0;
+	strtod(str, &end);
+	return *end == '\0';
+}
+
+/* family index, -1 if it wasn't seen */
+static int
+findfamily(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < nfamilies; i++)
+		if (strlen(families[i]) == len && strncmp(families[i], name, len) == 0)
+			return i;
+	return -1;
+}
+
+/* "# HELP name text" or "# TYPE name type", other comments are allowed */
+static int
+checkcomment(char *line, int *current)
+{
+	const char *name, *end;
+	int type = strncmp(line, "# TYPE ", 7) == 0;
+
+	if (!type && strncmp(line, "# HELP ", 7) != 0)
+		return 0;
+	name = line + 7;
+	if ((end = skipname(name, 0)) == NULL || (*end != ' ' && *end != '\0'))
+		return fail("bad metric name in comment", line);
+	if (!type)
+		return 0;
+
+	if (strcmp(end + 1, "counter") && strcmp(end + 1, "gauge") && strcmp(end + 1, "histogram")
+		&& strcmp(end + 1, "summary") && strcmp(end + 1, "untyped"))
+		return fail("unknown metric type", line);
+	if (findfamily(name, end - name) >= 0)
+		return fail("second TYPE line of family", line);
+	if (nfamilies == MAXFAMILIES)
+		return fail("too many families", NULL);
+	families[nfamilies] = strndup(name, end - name);
+	*current = nfamilies++;
+	return 0;
+}
+
+/* name{label="value",...} value [timestamp] */
+static int
+checksample(char *line, int current)
+{
+	const char *ptr, *name = line, *end;
+	char *space;
+	int family;
+
+	if ((end = skipname(name, 0)) == NULL)
+		return fail("bad metric name", line);
+	if ((family = findfamily(name, end - name)) >= 0 && family != current)
+		return fail("family is split by other ones", line);
+
+	ptr = end;
+	if (*ptr == '{') {
+		ptr++;
+		while (*ptr != '}') {
+			if ((ptr = skipname(ptr, 1)) == NULL || *ptr != '=' || ptr[1] != '"')
+				return fail("bad label", line);
+			for (ptr += 2; *ptr != '"'; ptr++) {
+				if (*ptr == '\0')
+					return fail("unterminated label value", line);
+				if (*ptr == '\\' && *++ptr != '\\' && *ptr != '"' && *ptr != 'n')
+					return fail("bad escape in label value", line);
+			}
+			ptr++;
+			if (*ptr == ',')
+				ptr++;
+			else if (*ptr != '}')
+				return fail("bad label separator", line);
+		}
+		ptr++;
+	}
+	if (*ptr++ != ' ')
+		return fail("no space before value", line);
+
+	/* optional timestamp */
+	if ((space = strchr(ptr, ' ')) != NULL) {
+		*space = '\0';
+		if (!isvalue(space + 1))
+			return fail("bad timestamp", line);
+	}
+	if (!isvalue(ptr))
+		return fail("bad value", line);
+	if (space)
+		*space = ' ';
+	return 0;
+}
+
+int main (int argc, char* argv[]) {
+	int verbose = argc > 2 && strcmp(argv[2], "-v") == 0;
+	int fd, current = -1, nsamples = 0;
+	char *resp, *body, *line, *next;
+	size_t len;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s port | unix:/path [-v]\n", argv[0]);
+		return 2;
+	}
+	if ((fd = connectto(argv[1])) < 0 || (resp = fetch(fd, &len)) == NULL) {
+		perror(argv[1]);
+		return 2;
+	}
+	close(fd);
+
+	if (strncmp(resp, "HTTP/1.", 7) != 0 || strncmp(resp + 8, " 200 ", 5) != 0)
+		return fail("bad status", strtok(resp, "\r\n"));
+	if ((body = strstr(resp, "\r\n\r\n")) == NULL)
+		return fail("no end of headers", NULL);
+	*body = '\0';
+	body += 4;
+	if (strstr(resp, "\r\nContent-Type: text/plain; version=0.0.4") == NULL)
+		return fail("bad content type", resp);
+	if (len - (body - resp) > 0 && body[len - (body - resp) - 1] != '\n')
+		return fail("body doesn't end with newline", NULL);
+
+	for (line = body; *line; line = next) {
+		next = strchr(line, '\n');
+		*next++ = '\0';
+		lineno++;
+		if (verbose)
+			puts(line);
+
+		if (*line == '#') {
+			if (checkcomment(line, &current))
+				return 1;
+		} else if (*line == '\0') {
+			return fail("empty line", NULL);
+		} else {
+			if (checksample(line, current))
+				return 1;
+			nsamples++;
+		}
+	}
+
+	printf("ok: %d families, %d samples, %lu bytes\n", nfamilies, nsamples, (unsigned long)(len - (body - resp)));
+	return 0;
+}
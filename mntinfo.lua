@@ -41,3 +41,11 @@ print()
 rootfs = mntinfo.getstat("/")
 print("Total space:", humanize_size(rootfs["blocks"] * rootfs["bsize"]))
 print("Avail space:", humanize_size(rootfs["bavail"] * rootfs["bsize"]))
+
+print()
+print("===== free space history, survives restarts =====")
+hist = mntinfo.history_file(os.getenv("HOME") .. "/.cache/mntinfo.hist")
+avail = hist:history("/.bavail")
+avail:push(rootfs["bavail"] * rootfs["bsize"])
+print(avail, avail:last())
+print_tbl(hist:names())
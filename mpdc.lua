@@ -32,6 +32,34 @@ print()
 print_table("playlistid", mpd:playlistid())
 print()
 
+-- big responses one item at a time
+--[[
+for file in mpd:iter_listall("music") do
+	print(file)
+end
+for song in mpd:iter_playlistinfo() do
+	print(song.Id, song.file)
+end
+]]
+
+-- one round trip for several commands
+local status, song, info = unpack(mpd:batch{"status", "currentsong", {"playlistid", 5}})
+print_table("batch status", status)
+print()
+
+-- wait for changes in host event loop instead of polling status
+--[[
+-- changes seen by idle cancelled with other command come back at once
+local changed = mpd:idle{"player", "mixer", "playlist"}
+if changed == true then
+	-- e.g. with luaposix: posix.poll({[mpd:fd()] = {events = {IN = true}}}, -1)
+	changed = mpd:idle_result()
+end
+if changed then
+	print(table.concat(changed, ", "))
+end
+]]
+
 mpd:reconnect()
 print_table("status", mpd:status())
 print()
@@ -0,0 +1,40 @@
+
+package.loadlib("./lnetstats.so", "luaopen_netstats")()
+
+function humanize_size(size)
+	local suffix = { "b", "Kb", "Mb", "Gb", "Tb" }
+	local i = 1
+	while size > 1024 and i < #suffix do
+		size = size / 1024
+		i = i + 1
+	end
+	return string.format("%0.1f %s", size, suffix[i])
+end
+
+-- first call only fills counters, rates come with the next one
+stats = netstats.sample()
+print(stats, #stats)
+
+for i = 1,3 do
+	os.execute("sleep 1")
+	-- the same userdata refilled in place, no tables until rows are asked
+	stats = netstats.sample()
+	print()
+	for j = 1,#stats do
+		local ifc = stats[j]
+		print(string.format("%-8s %s in %10s/s out %10s/s errors %d/%d", ifc.name, ifc.up == 1 and "up  " or "down",
+			humanize_size(ifc.rate.rx_bytes), humanize_size(ifc.rate.tx_bytes), ifc.rx_errors, ifc.tx_errors))
+	end
+end
+
+print()
+print("===== interface by name =====")
+lo = stats.lo0 or stats.lo
+for k, v in pairs(lo or {}) do print(k, v) end
+
+print()
+print("===== collector of its own =====")
+own = netstats.new()
+os.execute("sleep 1")
+print("elapsed", own:sample())
+for _, ifc in ipairs(own:totable()) do print(ifc.name, ifc.rate.rx_packets, ifc.rate.tx_packets) end
@@ -0,0 +1,35 @@
+
+package.loadlib("./lprocess.so", "luaopen_process")()
+
+function humanize_size(size)
+	local suffix = { "b", "Kb", "Mb", "Gb", "Tb" }
+	local i = 1
+	while size > 1024 and i < #suffix do
+		size = size / 1024
+		i = i + 1
+	end
+	return string.format("%0.1f %s", size, suffix[i])
+end
+
+-- first sample is taken by sampler() itself, cpu needs the second one
+procs = process.sampler()
+print(procs)
+
+for i = 1,3 do
+	os.execute("sleep 1")
+	print()
+	print("===== top by cpu, " .. procs:sample() .. " processes =====")
+	for _, p in ipairs(procs:top(5)) do
+		print(string.format("%6d %-16s %s %5.1f%% %10s", p.pid, p.name, p.state, p.cpu, humanize_size(p.rss)))
+	end
+end
+
+print()
+print("===== top by memory =====")
+for _, p in ipairs(procs:top(5, "rss")) do
+	print(string.format("%6d %-16s %10s %10s", p.pid, p.name, humanize_size(p.rss), humanize_size(p.vsize)))
+end
+
+print()
+print("===== init =====")
+for k, v in pairs(procs:get(1) or {}) do print(k, v) end
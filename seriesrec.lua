@@ -0,0 +1,35 @@
+-- records counters trace for benchseries: one line per sample,
+-- time followed by kern.cp_time and net.inet.ip.stats values
+-- usage: lua seriesrec.lua [samples [interval]] > trace.txt
+package.loadlib("./lsysctl.so", "luaopen_sysctl")()
+
+local samples = tonumber(arg[1]) or 3600
+local interval = tonumber(arg[2]) or 1
+
+local sampler = sysctl.sampler{ nodes = { "kern.cp_time", "net.inet.ip.stats" }, interval = interval }
+
+-- flattens struct tables in stable key order
+local function flatten(value, out)
+	if type(value) == "table" then
+		local keys = {}
+		for k in pairs(value) do table.insert(keys, k) end
+		table.sort(keys, function (a, b) return tostring(a) < tostring(b) end)
+		for _, k in ipairs(keys) do flatten(value[k], out) end
+	elseif type(value) == "number" then
+		table.insert(out, string.format("%.17g", value))
+	end
+	return out
+end
+
+local last
+for i = 1,samples do
+	os.execute("sleep " .. interval)
+	local values, time = sampler:read()
+	if values and time ~= last then
+		last = time
+		local line = flatten(values[1], { string.format("%.3f", time) })
+		flatten(values[2], line)
+		io.write(table.concat(line, " "), "\n")
+	end
+end
+sampler:stop()
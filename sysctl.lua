@@ -94,8 +94,17 @@ for k,n in pairs(node.value) do
 end
 ]]
 
+print("\n=== struct view, fields are decoded only when accessed ===")
+stats = sysctl.view("net.inet.ip.stats")
+print(stats)
+print("total:", stats.total, "delivered:", stats.delivered)
+print_tbl(tostring(stats), stats:totable())
+vm = sysctl.view("vm.vmtotal")
+print("free pages:", vm.free, "page size:", vm.pagesz)
+
 print("\n=== get nodes directly by MIB ids via node:node method (ifmib example) ===")
--- this is an entry point to ifmib data (see man ifmib for details)
+-- this is an entry point to ifmib data (see man ifmib for details),
+-- for counters of all interfaces at once see netstats.lua
 node = sysctl.node("net.link.generic.ifdata")
 print(node)
 
@@ -117,12 +126,146 @@ node = sysctl.node("vm.vmtotal")
 print_tbl(tostring(node), node:get())
 node = sysctl.node("vm.loadavg")
 print_tbl(tostring(node), { node:get() })
+
+print("\n=== compiled accessor, cheapest way to poll single node ===")
+loadavg = sysctl.compile("vm.loadavg")
+for i = 1,3 do
+	print(loadavg())
+end
+
+print("\n=== batch get, multiple values are packed into arrays ===")
+print_tbl("get_many", sysctl.get_many{ "kern.ostype", "vm.loadavg", "kern.cp_time", node })
 ]===]
 
+print("\n=== packed arrays for multi-value nodes, refilled in place ===")
+cp_times = sysctl.array("kern.cp_times")
+print(cp_times, #cp_times, cp_times[1])
+cp_node = sysctl.node("kern.cp_times")
+cp_poll = sysctl.compile("kern.cp_times")
+for i = 1,3 do
+	cp_node:array(cp_times)
+	cp_poll(cp_times)
+	print(unpack(cp_times:totable()))
+end
+
+print("\n=== counter rates, per CPU states in percents ===")
+cpu = sysctl.rate("kern.cp_times", "cpu")
+os.execute("sleep 1")
+print_tbl("cp_times %", cpu())
+ip = sysctl.rate("net.inet.ip.stats")
+os.execute("sleep 1")
+print_tbl("ipstat/s", ip:sample())
+
+print("\n=== watch, only changed nodes and struct fields are decoded ===")
+watch = sysctl.watch{ "hw.acpi.thermal.tz0.temperature", "hw.acpi.battery.life", "vm.vmtotal" }
+for i = 1,3 do
+	local changed = watch()
+	if changed then print_tbl("changed", changed) else print("nothing changed") end
+	os.execute("sleep 1")
+end
+
+print("\n=== native history with 1s/1min/1h consolidation ===")
+load = sysctl.history("vm.loadavg", 120)
+freq = sysctl.history("dev.cpu.0.freq", 120, { 10, 60 })
+for i = 1,3 do
+	load:push()
+	freq:push(sysctl.get("dev.cpu.0.freq"))
+	os.execute("sleep 1")
+end
+print(load, load:last())
+times, values = load:range()
+print(#times, values:totable()[1])
+times, avgs, mins, maxs = freq:range(1)
+print(#times, #avgs, #mins, #maxs)
+
+print("\n=== history in mapped file, reused as is after restart ===")
+hist = sysctl.history_file("/tmp/sysctl.hist", 600)
+load = sysctl.history("vm.loadavg", hist)
+load15 = sysctl.history("vm.loadavg", hist, 3)
+load:push()
+load15:push()
+print(hist, #load, #load15)
+print_tbl("stored", hist:names())
+hist:sync()
+
+print("\n=== compressed series, ~1-3 bytes per counter sample ===")
+swtch = sysctl.series()
+for i = 1,3 do
+	swtch:append(sysctl.get("vm.stats.sys.v_swtch"))
+	os.execute("sleep 1")
+end
+print(swtch, swtch:stats())
+for time, value in swtch:iter() do print(time, value) end
+
+print("\n=== background sampler, read() never blocks on syscalls ===")
+sampler = sysctl.sampler{ nodes = { "vm.loadavg", "kern.cp_time", "hw.usermem" }, interval = 0.5 }
+for i = 1,3 do
+	local values, time = sampler:read()
+	print_tbl(tostring(time), values)
+	os.execute("sleep 1")
+end
+sampler:stop()
+
+print("\n=== search index, '*' matches within one name component ===")
+print("indexed", sysctl.index(), "nodes")
+for _, name in ipairs(sysctl.find("dev.cpu.*.temperature")) do
+	print(name, sysctl.get(name))
+end
+print_tbl("kern.ipc", sysctl.find("kern.ipc"))
+
+print("\n=== describe subtree once, names & descriptions come from cache then ===")
+print(sysctl.describe("kern.ipc"), "nodes described")
+for n in sysctl.each("kern.ipc") do
+	print(n.name, n.format, n.desc)
+end
+
+print("\n=== prometheus exporter, check it with ./metricscheck unix:/tmp/sysctl.metrics ===")
+exporter = sysctl.exporter{
+	-- ifdata of first interface (IFDATA_GENERAL), interface index becomes label
+	nodes = { "vm.loadavg", "kern.cp_time", "dev.cpu.*.temperature", sysctl.node("net.link.generic.ifdata"):node(1, 1) },
+	mounts = { "/", "/tmp" },
+	prefix = "host_",
+}
+io.write(exporter:render())
+exporter:listen("unix:/tmp/sysctl.metrics")
+-- exporter:serve(-1) in a loop to serve forever
+print("served", exporter:serve(5), "scrapes")
+exporter:close()
+
+if sysctl.stats then
+	print("\n=== per function stats (built with -DLUAA_STATS) ===")
+	for name, st in pairs(sysctl.stats()) do
+		print(name, st.calls .. " calls", st.syscalls .. " syscalls", st.bytes .. " bytes", st.ns / st.calls .. " ns/call")
+	end
+	sysctl.reset_stats()
+end
+
 print("\n=== list all nodes in system ===")
 for n in sysctl.each() do
 	print(n,n.desc)
 end
+
+print("\n=== batch set, all or nothing ===")
+tuning = {
+	{ "kern.ipc.somaxconn", 1024 },
+	{ "kern.maxfiles", 65536 },
+	{ "net.inet.tcp.delayed_ack", 0 },
+}
+if sysctl.fake then
+	-- fake tree is writable, so rollback can be tried anywhere; it
+	-- replaces the whole tree, so this goes after everything else
+	sysctl.fake{
+		{ name = "kern.ipc.somaxconn", value = 128, rw = true },
+		{ name = "kern.maxfiles", value = 12328, rw = true },
+		{ name = "net.inet.tcp.delayed_ack", value = 1, rw = true, fail = true },
+	}
+end
+ok, results = sysctl.set_many(tuning)
+print("applied:", ok)
+for i, r in ipairs(results) do
+	print(r.name, r.status, r.old, r.error)
+end
+
 --[[
 node = sysctl.node("vm.swap_info")
 print(node:node(0))
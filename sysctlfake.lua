@@ -0,0 +1,117 @@
+-- checks cached name to MIB resolution of sysctl.get/set and set_many
+-- rollback against fake MIB tree
+-- run with: make check (needs lsysctl_fake.so)
+package.loadlib("./lsysctl_fake.so", "luaopen_sysctl")()
+
+local tree = {
+	{ name = "kern.hz", value = 100 },
+	{ name = "kern.ostype", value = "FreeBSD" },
+	{ name = "kern.ipc.somaxconn", value = 128, rw = true },
+	{ name = "kern.ipc.maxsockbuf", fmt = "LU", value = 2097152 },
+	{ name = "vm.stats.vm.v_page_count", fmt = "IU", value = 4000000 },
+	{ name = "kern.cp_time", fmt = "L", value = { 10, 20, 30, 40, 50 } },
+}
+
+local function check(tree)
+	assert(sysctl.fake(tree) > #tree, "fake tree isn't built")
+
+	-- names of leaves found by walking tree through next queries, uncached
+	local walked = {}
+	for n in sysctl.each() do
+		walked[n.name] = n
+	end
+
+	for _, def in ipairs(tree) do
+		local stats = sysctl.cache_stats()
+
+		-- first get resolves name, the next ones hit cache
+		local v1 = { sysctl.get(def.name) }
+		local v2 = { sysctl.get(def.name) }
+		local after = sysctl.cache_stats()
+		assert(after.misses == stats.misses + 1, def.name .. ": name isn't resolved once")
+		assert(after.hits == stats.hits + 1, def.name .. ": cached node isn't used")
+
+		-- cached node has the same MIB as the walked one
+		assert(walked[def.name], def.name .. ": not found by walk")
+		assert(sysctl.node(def.name) == walked[def.name], def.name .. ": cached MIB differs")
+		assert(walked[def.name]:raw() == sysctl.node(def.name):raw(), def.name .. ": values differ")
+
+		local expect = type(def.value) == "table" and def.value or { def.value }
+		assert(#v1 == #expect and #v2 == #expect, def.name .. ": wrong number of values")
+		for i = 1, #expect do
+			assert(v1[i] == expect[i] and v2[i] == expect[i], def.name .. ": wrong value")
+		end
+	end
+
+	-- writes go to the same cached node
+	assert(sysctl.set("kern.ipc.somaxconn", 1024) ~= nil, "set failed")
+	assert(sysctl.get("kern.ipc.somaxconn") == 1024, "set value isn't read back")
+end
+
+check(tree)
+
+-- rebuilt tree renumbers OIDs, cache must not return old ones
+table.insert(tree, 1, { name = "debug.first", value = 1 })
+table.insert(tree, 2, { name = "kern.aaa", value = 2 })
+check(tree)
+assert(sysctl.get("kern.nosuchnode") == nil, "missing node is resolved")
+
+-- set_many writes all entries or rolls them back
+local function batch(fail)
+	sysctl.fake{
+		{ name = "kern.ipc.somaxconn", value = 128, rw = true },
+		{ name = "kern.maxfiles", fmt = "L", value = 12328, rw = true },
+		{ name = "kern.hostname", value = "old", rw = true },
+		{ name = "net.inet.tcp.delayed_ack", value = 1, rw = true, fail = fail },
+	}
+	return {
+		{ "kern.ipc.somaxconn", 1024 },
+		{ "kern.maxfiles", 65536 },
+		{ "kern.hostname", "new" },
+		{ "net.inet.tcp.delayed_ack", 0 },
+	}
+end
+
+local function values()
+	return { sysctl.get("kern.ipc.somaxconn"), sysctl.get("kern.maxfiles"),
+		sysctl.get("kern.hostname"), sysctl.get("net.inet.tcp.delayed_ack") }
+end
+
+local function statuses(results)
+	local s = {}
+	for i, r in ipairs(results) do s[i] = r.status end
+	return table.concat(s, ",")
+end
+
+local ok, results = sysctl.set_many(batch(false))
+assert(ok == true, "batch isn't applied")
+assert(statuses(results) == "set,set,set,set", "wrong statuses: " .. statuses(results))
+local v = values()
+assert(v[1] == 1024 and v[2] == 65536 and v[3] == "new" and v[4] == 0, "new values aren't read back")
+assert(results[1].old == 128 and results[3].old == "old", "old values aren't reported")
+
+-- write of last node fails, earlier ones are restored
+ok, results = sysctl.set_many(batch(true))
+assert(ok == false, "failed batch is reported as applied")
+assert(statuses(results) == "rolled back,rolled back,rolled back,failed", "wrong statuses: " .. statuses(results))
+assert(results[4].error, "failure has no error")
+v = values()
+assert(v[1] == 128 and v[2] == 12328 and v[3] == "old" and v[4] == 1, "rolled back values differ")
+
+-- unknown node stops whole batch before any write
+local entries = batch(false)
+table.insert(entries, 3, { "kern.nosuchnode", 1 })
+ok, results = sysctl.set_many(entries)
+assert(ok == false and statuses(results) == "skipped,skipped,invalid,skipped,skipped", "wrong statuses: " .. statuses(results))
+
+-- value of wrong type is caught before anything is written
+entries = batch(false)
+entries[2][2] = "many"
+ok, results = sysctl.set_many(entries)
+assert(ok == false, "badly typed batch is reported as applied")
+assert(statuses(results) == "skipped,invalid,skipped,skipped", "wrong statuses: " .. statuses(results))
+assert(results[2].error == "number value expected", "wrong type error: " .. tostring(results[2].error))
+v = values()
+assert(v[1] == 128 and v[2] == 12328 and v[3] == "old" and v[4] == 1, "badly typed batch wrote something")
+
+print("ok", sysctl.cache_stats().size .. " cached nodes")
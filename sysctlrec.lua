@@ -0,0 +1,24 @@
+-- records sysctl tree (or its branch) into snapshot,
+-- which can be loaded into fake MIB tree with sysctl.fake(dofile("snapshot.lua"))
+-- usage: lua sysctlrec.lua [prefix] > snapshot.lua
+package.loadlib("./lsysctl.so", "luaopen_sysctl")()
+
+-- node.format gives first two chars only, restore full struct format
+function full_format(node)
+	local fmt = node.format:gsub("%z", "")
+	if node.struct == "device" then
+		return "T,dev_t"
+	elseif fmt:sub(1,1) == "S" and node.struct ~= "unknown" then
+		return "S," .. node.struct
+	end
+	return fmt
+end
+
+io.write("return {\n")
+for node in sysctl.each(arg[1]) do
+	local raw = node:raw()
+	io.write(string.format("\t{ name = %q, fmt = %q, desc = %q, rw = %s, value = %s },\n",
+		node.name, full_format(node), node.desc or "", tostring(not node.readonly),
+		raw and string.format("%q", raw) or "nil"))
+end
+io.write("}\n")